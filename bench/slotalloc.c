@@ -0,0 +1,260 @@
+//
+// slotalloc.c
+//
+// Three comparisons for the allocators in slotalloc.h:
+//
+// * Many short-lived tables: each round fills a handful of small slot tables and lists and
+//   throws them away, once with malloc and once from a Ch_SlotArena that's reset after
+//   every round.
+// * Random access to one big slot map: lookups by random ID, once with the map in
+//   malloc'd memory and once in huge pages (Ch_SlotHuge). The difference is TLB misses -
+//   it only shows if transparent huge pages are enabled ("madvise" or "always" in
+//   /sys/kernel/mm/transparent_hugepage/enabled).
+// * Growing one big slot list and one big slot map from empty, once with realloc and once
+//   in reserved address space (Ch_SlotVM), counting how often the block moved.
+//
+// Before that, a slotmap64 and a slot table are filled from a Ch_SlotVM, which has to
+// hold more than one block at a time for them. It exits with 1 if an add fails there.
+//
+//   cc -std=gnu99 -D_GNU_SOURCE -O2 -I.. slotalloc.c -o slotalloc
+//   ./slotalloc [rounds] [n] [grow_n]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "slotalloc.h"
+#include "slotlist.h"
+#include "slotmap.h"
+#include "slotmap64.h"
+#include "slottable.h"
+
+typedef struct {
+  uint32_t key;
+  uint32_t value;
+} Entry;
+
+typedef struct {
+  uint32_t version;
+  uint32_t value;
+  uint64_t pad[3];
+} Entity;
+
+#define CMP(x, e)   ((x) != (e)->key)
+#define TABLES      16
+#define PER_TABLE   200
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static uint64_t
+churn(Ch_SlotAlloc *al, int rounds, Ch_SlotArena *arena)
+{
+  uint64_t sum = 0;
+  int r, t;
+  uint32_t i;
+  for (r = 0; r < rounds; r++) {
+    Entry *tbl[TABLES];
+    uint32_t *list[TABLES];
+    for (t = 0; t < TABLES; t++) {
+      tbl[t] = NULL;
+      list[t] = NULL;
+      if (al) {
+        slottable_init(tbl[t], al);
+        slotlist_init(list[t], al);
+      }
+      for (i = 0; i < PER_TABLE; i++) {
+        Entry *e = slottable_add(tbl[t], i * 2654435761u, 0);
+        e->key = i;
+        e->value = r + i;
+        slotlist_push(list[t], i);
+      }
+    }
+    for (t = 0; t < TABLES; t++) {
+      for (i = 0; i < PER_TABLE; i += 7)
+        sum += slottable_find(tbl[t], i * 2654435761u, CMP, i)->value + slotlist_at(list[t], i);
+      if (!arena) {
+        slottable_free(tbl[t]);
+        slotlist_free(list[t]);
+      }
+    }
+    if (arena)
+      slotalloc_arena_reset(arena);
+  }
+  return sum;
+}
+
+static double
+lookups(Ch_SlotAlloc *al, uint32_t n, uint64_t *sum)
+{
+  Entity *m = NULL;
+  SLOT_ID *ids = malloc(sizeof(SLOT_ID) * n);
+  uint32_t i, x = 12345;
+  double t0;
+  if (al)
+    slotmap_init(m, al);
+  slotmap_reserve(m, n);
+  for (i = 0; i < n; i++)
+    slotmap_add(m, ids[i])->value = i;
+  t0 = now();
+  for (i = 0; i < n * 4; i++) {
+    x = x * 1664525 + 1013904223;
+    *sum += slotmap_at(m, ids[x % n])->value;
+  }
+  t0 = now() - t0;
+  slotmap_free(m);
+  free(ids);
+  return t0;
+}
+
+static double
+grow_list(Ch_SlotAlloc *al, uint32_t n, uint32_t *moves, uint64_t *sum)
+{
+  uint64_t *l = NULL, *last;
+  uint32_t i;
+  double t0;
+  if (al)
+    slotlist_init(l, al);
+  last = l;
+  t0 = now();
+  for (i = 0; i < n; i++) {
+    slotlist_push(l, i);
+    if (l != last) {
+      (*moves)++;
+      last = l;
+    }
+  }
+  t0 = now() - t0;
+  *sum += slotlist_at(l, n / 2);
+  slotlist_free(l);
+  return t0;
+}
+
+static double
+grow_map(Ch_SlotAlloc *al, uint32_t n, uint32_t *moves, uint64_t *sum)
+{
+  Entity *m = NULL, *last;
+  SLOT_ID id = SLOT_NONE_ID;
+  uint32_t i;
+  double t0;
+  if (al)
+    slotmap_init(m, al);
+  last = m;
+  t0 = now();
+  for (i = 0; i < n; i++) {
+    slotmap_add(m, id)->value = i;
+    if (m != last) {
+      (*moves)++;
+      last = m;
+    }
+  }
+  t0 = now() - t0;
+  *sum += slotmap_at(m, id)->value;
+  slotmap_free(m);
+  return t0;
+}
+
+//
+// Fills a slotmap64 (a directory and a page per SLOTMAP64_PAGE_ITEMS) and a slot table
+// (which allocates the grown table before freeing the old one) from 'vm'.
+// Returns: 1 if every add worked and every item is found, 0 if not.
+//
+static int
+vm_blocks(Ch_SlotVM *vm, uint32_t n, uint64_t *sum)
+{
+  Entity *m = NULL;
+  Entry *tbl = NULL;
+  SLOTMAP64_ID id = SLOTMAP64_NONE_ID, first = SLOTMAP64_NONE_ID;
+  int ok = slotmap64_init(m, &vm->alloc) && slottable_init(tbl, &vm->alloc);
+  uint32_t i;
+  if (!ok)
+    fprintf(stderr, "FAIL: couldn't start a slotmap64 and a slot table from a Ch_SlotVM\n");
+  for (i = 0; ok && i < n; i++) {
+    Entity *e = slotmap64_add(m, id);
+    Entry *t = slottable_add(tbl, i * 2654435761u, 0);
+    if (!e || !t) {
+      fprintf(stderr, "FAIL: add %u from a Ch_SlotVM failed (%s)\n", i,
+        !e ? "slotmap64" : "slottable");
+      ok = 0;
+      break;
+    }
+    if (i == 0)
+      first = id;
+    e->value = i;
+    t->key = i;
+    t->value = i;
+  }
+  for (i = 0; ok && i < n; i += 97) {
+    Entry *t = slottable_find(tbl, i * 2654435761u, CMP, i);
+    if (!t || t->value != i) {
+      fprintf(stderr, "FAIL: key %u not found in a slottable from a Ch_SlotVM\n", i);
+      ok = 0;
+    }
+  }
+  if (ok)
+    *sum += slotmap64_at(m, first)->value + slotmap64_at(m, id)->value;
+  slotmap64_free(m);
+  slottable_free(tbl);
+  return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+  int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+  uint32_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 4000000,
+    grow = argc > 3 ? strtoul(argv[3], NULL, 10) : 20000000, moves[4] = {0};
+  uint64_t sum = 0;
+  double t, heap, arena, small, huge, list[2], map[2];
+  Ch_SlotArena ar;
+  Ch_SlotHuge hp;
+  Ch_SlotVM vm;
+
+  if (n > SLOTMAP_MAX_ID)
+    n = SLOTMAP_MAX_ID;
+  slotalloc_arena_init(&ar, 0);
+  slotalloc_huge_init(&hp);
+
+  t = now();
+  sum += churn(NULL, rounds, NULL);
+  heap = now() - t;
+  t = now();
+  sum += churn(&ar.alloc, rounds, &ar);
+  arena = now() - t;
+
+  small = lookups(NULL, n, &sum);
+  huge = lookups(&hp.alloc, n, &sum);
+
+  if (!slotalloc_vm_init(&vm, (size_t)1 << 26)) {
+    fprintf(stderr, "couldn't reserve address space\n");
+    return 1;
+  }
+  if (!vm_blocks(&vm, 100000, &sum))
+    return 1;
+  slotalloc_vm_free(&vm);
+
+  if (!slotalloc_vm_init(&vm, 0)) {
+    fprintf(stderr, "couldn't reserve address space\n");
+    return 1;
+  }
+  list[0] = grow_list(NULL, grow, &moves[0], &sum);
+  list[1] = grow_list(&vm.alloc, grow, &moves[1], &sum);
+  map[0] = grow_map(NULL, grow < SLOTMAP_MAX_ID ? grow : SLOTMAP_MAX_ID, &moves[2], &sum);
+  map[1] = grow_map(&vm.alloc, grow < SLOTMAP_MAX_ID ? grow : SLOTMAP_MAX_ID, &moves[3], &sum);
+  slotalloc_vm_free(&vm);
+
+  printf("checksum %llu\n", (unsigned long long)sum);
+  printf("%d rounds of %d tables: malloc %.3fs, arena %.3fs\n", rounds, TABLES, heap, arena);
+  printf("%u random lookups x4: malloc %.3fs, huge pages %.3fs\n", n, small, huge);
+  printf("%u list pushes: realloc %.3fs (%u moves), reserved %.3fs (%u moves)\n", grow,
+    list[0], moves[0], list[1], moves[1]);
+  printf("%u map adds: realloc %.3fs (%u moves), reserved %.3fs (%u moves)\n",
+    grow < SLOTMAP_MAX_ID ? grow : SLOTMAP_MAX_ID, map[0], moves[2], map[1], moves[3]);
+  slotalloc_arena_free(&ar);
+  return 0;
+}
@@ -0,0 +1,555 @@
+//
+// slotbench.c
+//
+// The microbenchmark suite for the slot containers: insert, find, iterate and remove on
+// slotlist, slotmap, slotmap64 and slottable, next to a plain array and a reference hash
+// map (open addressing, linear probing), across sizes, key distributions and item sizes.
+//
+// The item size is fixed when building (ITEM_SIZE of 16 or 64 bytes), so `make bench`
+// builds this twice. Output is one CSV row per measurement:
+//
+//   container,item_size,n,op,dist,ns_op,bytes_elem,cycles_op,instr_op,llc_miss_op,br_miss_op
+//
+// 'dist' is the key order: seq, uniform, zipf (theta 0.99 - a few hot keys get most of
+// the lookups) or string (slottable and the hash map, keyed on "key-N" strings.)
+// The last four columns come from perf_event_open and are empty if it isn't available
+// (not Linux, or kernel.perf_event_paranoid set too high.)
+//
+//   cc -std=gnu99 -D_GNU_SOURCE -O2 -DITEM_SIZE=16 -I.. slotbench.c -lm -o slotbench-16
+//   ./slotbench-16 [max_exp] [min_exp]      # sizes 10^min_exp to 10^max_exp (2 to 6)
+//
+// Sizes go up to 10^8, but slotmap and slotlist stop at their 24-bit and 32-bit limits
+// and the string keys stop at 10^7.
+//
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "slotlist.h"
+#include "slotmap.h"
+#include "slotmap64.h"
+#include "slottable.h"
+
+#ifndef ITEM_SIZE
+#define ITEM_SIZE 16
+#endif
+
+typedef struct {
+  uint32_t version;
+  uint32_t key;
+  uint64_t value;
+#if ITEM_SIZE > 16
+  uint64_t pad[(ITEM_SIZE - 16) / 8];
+#endif
+} Item;
+
+#define CMP_KEY(k, e)  ((k) != (e)->key)
+#define CMP_STR(s, e)  strcmp(s, strs[(e)->key])
+#define MAX_STR_N      10000000
+#define KEY_HASH(k)    slottable_u32_hash(k)
+
+static char **strs;
+static uint64_t sink;
+
+//
+// timing and hardware counters
+//
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define NCOUNTERS 4
+
+typedef struct {
+  double t;
+  uint64_t c[NCOUNTERS];
+} Mark;
+
+static int perf_fd[NCOUNTERS] = {-1, -1, -1, -1};
+
+static void
+perf_open(void)
+{
+#ifdef __linux__
+  static const uint64_t cfg[NCOUNTERS][2] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  };
+  for (int i = 0; i < NCOUNTERS; i++) {
+    struct perf_event_attr pe;
+    memset(&pe, 0, sizeof(pe));
+    pe.size = sizeof(pe);
+    pe.type = cfg[i][0];
+    pe.config = cfg[i][1];
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    perf_fd[i] = syscall(__NR_perf_event_open, &pe, 0, -1, i ? perf_fd[0] : -1, 0);
+    if (perf_fd[i] < 0) {
+      while (i-- > 0)
+        close(perf_fd[i]);
+      perf_fd[0] = -1;
+      return;
+    }
+  }
+#endif
+}
+
+static Mark
+mark(void)
+{
+  Mark m;
+  struct timespec t;
+  memset(&m, 0, sizeof(m));
+#ifdef __linux__
+  for (int i = 0; perf_fd[0] >= 0 && i < NCOUNTERS; i++)
+    if (read(perf_fd[i], &m.c[i], sizeof(uint64_t)) != sizeof(uint64_t))
+      m.c[i] = 0;
+#endif
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  m.t = t.tv_sec * 1e9 + t.tv_nsec;
+  return m;
+}
+
+static void
+report(const char *container, uint64_t n, const char *op, const char *dist, Mark a,
+  uint64_t ops, size_t bytes)
+{
+  Mark b = mark();
+  printf("%s,%d,%llu,%s,%s,%.2f,%.1f", container, ITEM_SIZE, (unsigned long long)n, op, dist,
+    (b.t - a.t) / ops, (double)bytes / n);
+  for (int i = 0; i < NCOUNTERS; i++) {
+    if (perf_fd[0] >= 0)
+      printf(",%.2f", (double)(b.c[i] - a.c[i]) / ops);
+    else
+      printf(",");
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+//
+// key streams
+//
+static uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t
+rnd(void)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+//
+// Zipfian ranks, from Gray et al, "Quickly Generating Billion-Record Synthetic
+// Databases". Rank 0 is the hottest. Ranks are scattered over [0, n) so the hot keys
+// aren't all neighbors.
+//
+static void
+zipf_fill(uint32_t *out, uint64_t count, uint64_t n)
+{
+  const double theta = 0.99;
+  double zetan = 0, zeta2 = 1 + pow(0.5, theta), alpha = 1 / (1 - theta), eta;
+  for (uint64_t i = 1; i <= n; i++)
+    zetan += 1 / pow((double)i, theta);
+  eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+  for (uint64_t i = 0; i < count; i++) {
+    double u = (rnd() >> 11) * (1.0 / 9007199254740992.0), uz = u * zetan;
+    uint64_t r = uz < 1 ? 0 : uz < zeta2 ? 1 : (uint64_t)(n * pow(eta * u - eta + 1, alpha));
+    out[i] = ((r < n ? r : n - 1) * 2654435761ULL) % n;
+  }
+}
+
+static void
+uniform_fill(uint32_t *out, uint64_t count, uint64_t n)
+{
+  for (uint64_t i = 0; i < count; i++)
+    out[i] = rnd() % n;
+}
+
+static void
+shuffle_fill(uint32_t *out, uint64_t n)
+{
+  for (uint64_t i = 0; i < n; i++)
+    out[i] = i;
+  for (uint64_t i = n - 1; i > 0; i--) {
+    uint64_t j = rnd() % (i + 1);
+    uint32_t t = out[i];
+    out[i] = out[j];
+    out[j] = t;
+  }
+}
+
+//
+// The reference hash map: items in a flat array, a power-of-two table of item
+// indexes + 1 (0 is empty, UINT32_MAX is a tombstone) with the hashes beside them.
+//
+typedef struct {
+  uint32_t *slot, *hash;
+  Item *items;
+  uint64_t cap, count, used;
+} HashMap;
+
+static void
+hm_grow(HashMap *h)
+{
+  uint64_t cap = h->cap ? h->cap * 2 : 16;
+  uint32_t *slot = calloc(cap, sizeof(uint32_t)), *hash = malloc(cap * sizeof(uint32_t));
+  for (uint64_t i = 0; i < h->cap; i++) {
+    if (h->slot[i] && h->slot[i] != UINT32_MAX) {
+      uint64_t j = h->hash[i] & (cap - 1);
+      while (slot[j])
+        j = (j + 1) & (cap - 1);
+      slot[j] = h->slot[i];
+      hash[j] = h->hash[i];
+    }
+  }
+  free(h->slot);
+  free(h->hash);
+  h->slot = slot;
+  h->hash = hash;
+  h->cap = cap;
+  h->used = h->count;
+  h->items = realloc(h->items, (cap / 2 + 1) * sizeof(Item));
+}
+
+static Item *
+hm_add(HashMap *h, uint32_t hsh)
+{
+  if ((h->used + 1) * 2 > h->cap)
+    hm_grow(h);
+  uint64_t j = hsh & (h->cap - 1);
+  while (h->slot[j] && h->slot[j] != UINT32_MAX)
+    j = (j + 1) & (h->cap - 1);
+  if (!h->slot[j])
+    h->used++;
+  h->hash[j] = hsh;
+  h->slot[j] = ++h->count;
+  return h->items + h->count - 1;
+}
+
+#define hm_find(h, hsh, cmp, k) ({ \
+  uint64_t __j__ = (hsh) & ((h)->cap - 1); \
+  Item *__it__ = NULL; \
+  while ((h)->slot[__j__]) { \
+    if ((h)->slot[__j__] != UINT32_MAX && (h)->hash[__j__] == (hsh) && \
+        !cmp(k, (h)->items + (h)->slot[__j__] - 1)) { \
+      __it__ = (h)->items + (h)->slot[__j__] - 1; \
+      break; \
+    } \
+    __j__ = (__j__ + 1) & ((h)->cap - 1); \
+  } \
+  __j__ = __it__ ? __j__ : UINT64_MAX; \
+  __j__; \
+})
+
+// Removal leaves the item where it is (the array isn't compacted.)
+static void
+hm_remove(HashMap *h, uint64_t j)
+{
+  if (j != UINT64_MAX)
+    h->slot[j] = UINT32_MAX;
+}
+
+//
+// The benchmarks for one size. 'reps' containers are built, so that small sizes still
+// do about a million operations per measurement.
+//
+typedef struct {
+  uint64_t n, reps, finds;
+  uint32_t *uniform, *zipf, *order;
+} Run;
+
+#define FIND_ROWS(name, bytes, ...) { \
+  const char *dists[2] = {"uniform", "zipf"}; \
+  uint32_t *keys[2] = {r->uniform, r->zipf}; \
+  for (int d = 0; d < 2; d++) { \
+    uint32_t *ks = keys[d]; \
+    Mark m = mark(); \
+    for (uint64_t i = 0; i < r->finds; i++) { \
+      uint32_t k = ks[i]; \
+      __VA_ARGS__; \
+    } \
+    report(name, n, "find", dists[d], m, r->finds, bytes); \
+  } \
+}
+
+static void
+bench_array(Run *r)
+{
+  uint64_t n = r->n, cap = 0, i, x;
+  Item **a = calloc(r->reps, sizeof(Item *));
+  Mark m = mark();
+  for (x = 0; x < r->reps; x++) {
+    for (cap = i = 0; i < n; i++) {
+      if (i == cap) {
+        cap = cap ? cap * 2 : 16;
+        a[x] = realloc(a[x], cap * sizeof(Item));
+      }
+      a[x][i].value = i;
+    }
+  }
+  report("array", n, "insert", "seq", m, n * r->reps, cap * sizeof(Item));
+  FIND_ROWS("array", cap * sizeof(Item), sink += a[0][k].value);
+  m = mark();
+  for (x = 0; x < r->reps; x++)
+    for (i = 0; i < n; i++)
+      sink += a[x][i].value;
+  report("array", n, "iterate", "seq", m, n * r->reps, cap * sizeof(Item));
+  for (x = 0; x < r->reps; x++)
+    free(a[x]);
+  free(a);
+}
+
+static void
+bench_slotlist(Run *r)
+{
+  uint64_t n = r->n, i, x;
+  Item **l = calloc(r->reps, sizeof(Item *));
+  Mark m = mark();
+  for (x = 0; x < r->reps; x++)
+    for (i = 0; i < n; i++)
+      slotlist_add(l[x], 1)->value = i;
+  size_t bytes = sizeof(SLOT_ID) * SLOTLIST__HDR + slotlist_allocated(l[0]) * sizeof(Item);
+  report("slotlist", n, "insert", "seq", m, n * r->reps, bytes);
+  FIND_ROWS("slotlist", bytes, sink += slotlist_at(l[0], k).value);
+  m = mark();
+  for (x = 0; x < r->reps; x++)
+    for (i = 0; i < slotlist_count(l[x]); i++)
+      sink += slotlist_at(l[x], i).value;
+  report("slotlist", n, "iterate", "seq", m, n * r->reps, bytes);
+  m = mark();
+  for (x = 0; x < r->reps; x++) {
+    for (i = 0; i < n; i++) {
+      // swap-remove the element at a shuffled position (clamped to what's left)
+      uint32_t at = r->order[i] % slotlist_count(l[x]);
+      slotlist_at(l[x], at) = slotlist_last(l[x]);
+      slotlist_truncate(l[x], 1);
+    }
+  }
+  report("slotlist", n, "remove", "uniform", m, n * r->reps, bytes);
+  for (x = 0; x < r->reps; x++)
+    slotlist_free(l[x]);
+  free(l);
+}
+
+static void
+bench_slotmap(Run *r)
+{
+  uint64_t n = r->n, i, x;
+  Item **s = calloc(r->reps, sizeof(Item *));
+  SLOT_ID *ids = malloc(sizeof(SLOT_ID) * n * r->reps);
+  Mark m = mark();
+  for (x = 0; x < r->reps; x++)
+    for (i = 0; i < n; i++)
+      slotmap_add(s[x], ids[x * n + i])->value = i;
+  size_t bytes = slotmap__size(slotmap_allocated(s[0]), sizeof(Item));
+  report("slotmap", n, "insert", "seq", m, n * r->reps, bytes);
+  FIND_ROWS("slotmap", bytes, sink += slotmap_at(s[0], ids[k])->value);
+  m = mark();
+  for (x = 0; x < r->reps; x++)
+    slotmap_each(s[x], it, sink += it->value);
+  report("slotmap", n, "iterate", "seq", m, n * r->reps, bytes);
+  m = mark();
+  for (x = 0; x < r->reps; x++)
+    for (i = 0; i < n; i++)
+      slotmap_remove(s[x], ids[x * n + r->order[i]]);
+  report("slotmap", n, "remove", "uniform", m, n * r->reps, bytes);
+  for (x = 0; x < r->reps; x++)
+    slotmap_free(s[x]);
+  free(ids);
+  free(s);
+}
+
+static void
+bench_slotmap64(Run *r)
+{
+  uint64_t n = r->n, i, x;
+  Item **s = calloc(r->reps, sizeof(Item *));
+  SLOTMAP64_ID *ids = malloc(sizeof(SLOTMAP64_ID) * n * r->reps);
+  Mark m = mark();
+  for (x = 0; x < r->reps; x++)
+    for (i = 0; i < n; i++)
+      slotmap64_add(s[x], ids[x * n + i])->value = i;
+  size_t bytes = sizeof(uint32_t) * 8 + sizeof(uint8_t *) * slotmap64__cap(s[0]) +
+    slotmap64_allocated(s[0]) * sizeof(Item);
+  report("slotmap64", n, "insert", "seq", m, n * r->reps, bytes);
+  FIND_ROWS("slotmap64", bytes, sink += slotmap64_at(s[0], ids[k])->value);
+  m = mark();
+  for (x = 0; x < r->reps; x++) {
+    for (uint32_t p = 0; p < slotmap64_pages(s[x]); p++) {
+      Item *page = slotmap64_page(s[x], p);
+      uint64_t end = slotmap64_used(s[x]) - (uint64_t)p * SLOTMAP64_PAGE_ITEMS;
+      for (i = 0; i < end && i < SLOTMAP64_PAGE_ITEMS; i++)
+        sink += page[i].value;
+    }
+  }
+  report("slotmap64", n, "iterate", "seq", m, n * r->reps, bytes);
+  m = mark();
+  for (x = 0; x < r->reps; x++)
+    for (i = 0; i < n; i++)
+      slotmap64_remove(s[x], ids[x * n + r->order[i]]);
+  report("slotmap64", n, "remove", "uniform", m, n * r->reps, bytes);
+  for (x = 0; x < r->reps; x++)
+    slotmap64_free(s[x]);
+  free(ids);
+  free(s);
+}
+
+static void
+bench_slottable(Run *r)
+{
+  uint64_t n = r->n, i, x;
+  Item **t = calloc(r->reps, sizeof(Item *));
+  Mark m = mark();
+  for (x = 0; x < r->reps; x++) {
+    for (i = 0; i < n; i++) {
+      Item *it = slottable_add(t[x], KEY_HASH(i), 0);
+      it->key = i;
+      it->value = i;
+    }
+  }
+  size_t bytes = slottable_mem_usage(t[0]);
+  report("slottable", n, "insert", "seq", m, n * r->reps, bytes);
+  FIND_ROWS("slottable", bytes, sink += slottable_find(t[0], KEY_HASH(k), CMP_KEY, k)->value);
+  m = mark();
+  for (x = 0; x < r->reps; x++)
+    slottable_scan(t[x], id, item, v, sink += v->value);
+  report("slottable", n, "iterate", "seq", m, n * r->reps, bytes);
+  m = mark();
+  for (x = 0; x < r->reps; x++)
+    for (i = 0; i < n; i++)
+      slottable_remove(t[x], KEY_HASH(r->order[i]), CMP_KEY, r->order[i]);
+  report("slottable", n, "remove", "uniform", m, n * r->reps, bytes);
+  for (x = 0; x < r->reps; x++)
+    slottable_free(t[x]);
+  free(t);
+
+  if (n > MAX_STR_N)
+    return;
+  Item *ts = NULL;
+  m = mark();
+  for (i = 0; i < n; i++) {
+    Item *it = slottable_add(ts, slottable_str_fasthash(strs[i]), 0);
+    it->key = i;
+  }
+  report("slottable", n, "insert", "string", m, n, slottable_mem_usage(ts));
+  m = mark();
+  for (i = 0; i < r->finds; i++) {
+    char *k = strs[r->uniform[i]];
+    sink += slottable_find(ts, slottable_str_fasthash(k), CMP_STR, k)->key;
+  }
+  report("slottable", n, "find", "string", m, r->finds, slottable_mem_usage(ts));
+  slottable_free(ts);
+}
+
+static void
+bench_hashmap(Run *r)
+{
+  uint64_t n = r->n, i, x;
+  HashMap *h = calloc(r->reps, sizeof(HashMap));
+  Mark m = mark();
+  for (x = 0; x < r->reps; x++) {
+    for (i = 0; i < n; i++) {
+      Item *it = hm_add(&h[x], KEY_HASH(i));
+      it->key = i;
+      it->value = i;
+    }
+  }
+  size_t bytes = h[0].cap * sizeof(uint32_t) * 2 + (h[0].cap / 2 + 1) * sizeof(Item);
+  report("hashmap", n, "insert", "seq", m, n * r->reps, bytes);
+  FIND_ROWS("hashmap", bytes, sink += h[0].items[h[0].slot[hm_find(&h[0], KEY_HASH(k), CMP_KEY, k)] - 1].value);
+  m = mark();
+  for (x = 0; x < r->reps; x++)
+    for (i = 0; i < h[x].cap; i++)
+      if (h[x].slot[i] && h[x].slot[i] != UINT32_MAX)
+        sink += h[x].items[h[x].slot[i] - 1].value;
+  report("hashmap", n, "iterate", "seq", m, n * r->reps, bytes);
+  m = mark();
+  for (x = 0; x < r->reps; x++)
+    for (i = 0; i < n; i++)
+      hm_remove(&h[x], hm_find(&h[x], KEY_HASH(r->order[i]), CMP_KEY, r->order[i]));
+  report("hashmap", n, "remove", "uniform", m, n * r->reps, bytes);
+  for (x = 0; x < r->reps; x++) {
+    free(h[x].slot);
+    free(h[x].hash);
+    free(h[x].items);
+  }
+
+  if (n <= MAX_STR_N) {
+    HashMap hs = {0};
+    m = mark();
+    for (i = 0; i < n; i++)
+      hm_add(&hs, slottable_str_fasthash(strs[i]))->key = i;
+    bytes = hs.cap * sizeof(uint32_t) * 2 + (hs.cap / 2 + 1) * sizeof(Item);
+    report("hashmap", n, "insert", "string", m, n, bytes);
+    m = mark();
+    for (i = 0; i < r->finds; i++) {
+      char *k = strs[r->uniform[i]];
+      sink += hm_find(&hs, slottable_str_fasthash(k), CMP_STR, k);
+    }
+    report("hashmap", n, "find", "string", m, r->finds, bytes);
+    free(hs.slot);
+    free(hs.hash);
+    free(hs.items);
+  }
+  free(h);
+}
+
+int
+main(int argc, char **argv)
+{
+  int max_exp = argc > 1 ? atoi(argv[1]) : 6, min_exp = argc > 2 ? atoi(argv[2]) : 2;
+  if (max_exp > 8)
+    max_exp = 8;
+
+  perf_open();
+  printf("container,item_size,n,op,dist,ns_op,bytes_elem,"
+    "cycles_op,instr_op,llc_miss_op,br_miss_op\n");
+  for (int e = min_exp; e <= max_exp; e++) {
+    Run r;
+    r.n = (uint64_t)pow(10, e);
+    r.reps = r.n < (1 << 20) ? (1 << 20) / r.n : 1;
+    r.finds = r.n < (1 << 20) ? (1 << 20) : r.n < (1 << 22) ? r.n : (1 << 22);
+    r.uniform = malloc(sizeof(uint32_t) * r.finds);
+    r.zipf = malloc(sizeof(uint32_t) * r.finds);
+    r.order = malloc(sizeof(uint32_t) * r.n);
+    uniform_fill(r.uniform, r.finds, r.n);
+    zipf_fill(r.zipf, r.finds, r.n);
+    shuffle_fill(r.order, r.n);
+    if (r.n <= MAX_STR_N) {
+      strs = malloc(sizeof(char *) * r.n);
+      for (uint64_t i = 0; i < r.n; i++) {
+        strs[i] = malloc(24);
+        snprintf(strs[i], 24, "key-%llu", (unsigned long long)i);
+      }
+    }
+
+    bench_array(&r);
+    bench_slotlist(&r);
+    if (r.n <= SLOTMAP_MAX_ID)
+      bench_slotmap(&r);
+    bench_slotmap64(&r);
+    bench_slottable(&r);
+    bench_hashmap(&r);
+
+    if (r.n <= MAX_STR_N) {
+      for (uint64_t i = 0; i < r.n; i++)
+        free(strs[i]);
+      free(strs);
+    }
+    free(r.uniform);
+    free(r.zipf);
+    free(r.order);
+  }
+  fprintf(stderr, "(checksum %llu)\n", (unsigned long long)sink);
+  return 0;
+}
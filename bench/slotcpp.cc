@@ -0,0 +1,204 @@
+//
+// slotcpp.cc
+//
+// Puts the slotcpp.h templates next to the C macros they wrap: the same items, the same
+// operations, the same blocks underneath. The templates should come out no slower - the
+// item size is a constant either way, and both end up in the same inline functions.
+//
+//   c++ -std=gnu++17 -O2 -I.. slotcpp.cc -o slotcpp
+//   ./slotcpp [n] [rounds]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "slotcpp.h"
+
+typedef struct {
+  uint32_t version;
+  uint32_t key;
+  uint64_t value;
+} Item;
+
+typedef struct {
+  uint32_t key;
+  uint64_t value;
+} Pair;
+
+#define CMP_KEY(k, e)  ((k) != (e)->key)
+#define KEY_HASH(k)    slottable_u32_hash(k)
+
+enum { LIST_PUSH, LIST_ITER, MAP_ADD, MAP_AT, MAP_EACH, MAP_REMOVE,
+  TABLE_ADD, TABLE_FIND, TABLE_REMOVE, NOPS };
+
+static const char *names[NOPS] = {"list push", "list iterate", "map add", "map at",
+  "map each", "map remove", "table add", "table find", "table remove"};
+
+static uint64_t sink;
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void
+run_c(uint32_t n, const uint32_t *order, SLOT_ID *ids, double *t)
+{
+  double s;
+  uint64_t sum = 0;
+
+  Item *l = NULL;
+  s = now();
+  for (uint32_t i = 0; i < n; i++)
+    slotlist_push(l, ((Item){0, i, i}));
+  t[LIST_PUSH] += now() - s;
+  s = now();
+  for (uint32_t i = 0; i < slotlist_count(l); i++)
+    sum += slotlist_at(l, i).value;
+  t[LIST_ITER] += now() - s;
+  slotlist_free(l);
+
+  Item *m = NULL;
+  s = now();
+  for (uint32_t i = 0; i < n; i++) {
+    Item *it = slotmap_add(m, ids[i]);
+    it->key = i;
+    it->value = i;
+  }
+  t[MAP_ADD] += now() - s;
+  s = now();
+  for (uint32_t i = 0; i < n; i++)
+    sum += slotmap_at(m, ids[order[i]])->value;
+  t[MAP_AT] += now() - s;
+  s = now();
+  slotmap_each(m, it, sum += it->value);
+  t[MAP_EACH] += now() - s;
+  s = now();
+  for (uint32_t i = 0; i < n; i++)
+    slotmap_remove(m, ids[order[i]]);
+  t[MAP_REMOVE] += now() - s;
+  slotmap_free(m);
+
+  Pair *tbl = NULL;
+  s = now();
+  for (uint32_t i = 0; i < n; i++) {
+    if (!slottable_find(tbl, KEY_HASH(i), CMP_KEY, i)) {
+      Pair *p = slottable_add(tbl, KEY_HASH(i), 0);
+      p->key = i;
+      p->value = i;
+    }
+  }
+  t[TABLE_ADD] += now() - s;
+  s = now();
+  for (uint32_t i = 0; i < n; i++)
+    sum += slottable_find(tbl, KEY_HASH(order[i]), CMP_KEY, order[i])->value;
+  t[TABLE_FIND] += now() - s;
+  s = now();
+  for (uint32_t i = 0; i < n; i++)
+    slottable_remove(tbl, KEY_HASH(order[i]), CMP_KEY, order[i]);
+  t[TABLE_REMOVE] += now() - s;
+  slottable_free(tbl);
+
+  sink += sum;
+}
+
+static void
+run_cpp(uint32_t n, const uint32_t *order, SLOT_ID *ids, double *t)
+{
+  double s;
+  uint64_t sum = 0;
+
+  {
+    chelp::SlotList<Item> l;
+    s = now();
+    for (uint32_t i = 0; i < n; i++)
+      l.push_back(Item{0, i, i});
+    t[LIST_PUSH] += now() - s;
+    s = now();
+    for (const Item &it : l)
+      sum += it.value;
+    t[LIST_ITER] += now() - s;
+  }
+
+  {
+    chelp::SlotMap<Item> m;
+    s = now();
+    for (uint32_t i = 0; i < n; i++)
+      ids[i] = m.emplace(Item{0, i, i});
+    t[MAP_ADD] += now() - s;
+    s = now();
+    for (uint32_t i = 0; i < n; i++)
+      sum += m.at(ids[order[i]])->value;
+    t[MAP_AT] += now() - s;
+    s = now();
+    for (const Item &it : m)
+      sum += it.value;
+    t[MAP_EACH] += now() - s;
+    s = now();
+    for (uint32_t i = 0; i < n; i++)
+      m.remove(ids[order[i]]);
+    t[MAP_REMOVE] += now() - s;
+  }
+
+  {
+    chelp::SlotTable<uint32_t, uint64_t> tbl;
+    s = now();
+    for (uint32_t i = 0; i < n; i++)
+      tbl.emplace(i, i);
+    t[TABLE_ADD] += now() - s;
+    s = now();
+    for (uint32_t i = 0; i < n; i++)
+      sum += *tbl.find(order[i]);
+    t[TABLE_FIND] += now() - s;
+    s = now();
+    for (uint32_t i = 0; i < n; i++)
+      tbl.erase(order[i]);
+    t[TABLE_REMOVE] += now() - s;
+  }
+
+  sink += sum;
+}
+
+int
+main(int argc, char **argv)
+{
+  uint32_t n = argc > 1 ? atoi(argv[1]) : 1000000;
+  int rounds = argc > 2 ? atoi(argv[2]) : 10;
+  uint32_t *order = (uint32_t *)malloc(sizeof(uint32_t) * n);
+  SLOT_ID *ids = (SLOT_ID *)malloc(sizeof(SLOT_ID) * n);
+  double c[NOPS] = {0}, cpp[NOPS] = {0};
+
+  //
+  // Visit the keys in a shuffled order, so that lookups aren't just a linear walk.
+  //
+  srand(1);
+  for (uint32_t i = 0; i < n; i++)
+    order[i] = i;
+  for (uint32_t i = n - 1; i > 0; i--) {
+    uint32_t j = (((uint32_t)rand() << 16) ^ (uint32_t)rand()) % (i + 1), x = order[i];
+    order[i] = order[j];
+    order[j] = x;
+  }
+
+  //
+  // Alternate the two, after a round that isn't counted, so that neither one is the first
+  // to fault in the heap.
+  //
+  for (int r = -1; r < rounds; r++) {
+    double warm[NOPS] = {0};
+    run_c(n, order, ids, r < 0 ? warm : c);
+    run_cpp(n, order, ids, r < 0 ? warm : cpp);
+  }
+
+  printf("%-14s %12s %12s %8s\n", "", "C ns/op", "C++ ns/op", "C++/C");
+  for (int i = 0; i < NOPS; i++)
+    printf("%-14s %12.2f %12.2f %8.2f\n", names[i], c[i] * 1e9 / ((double)n * rounds),
+      cpp[i] * 1e9 / ((double)n * rounds), c[i] > 0 ? cpp[i] / c[i] : 0.0);
+  fprintf(stderr, "(checksum %llu)\n", (unsigned long long)sink);
+  free(order);
+  free(ids);
+  return 0;
+}
@@ -0,0 +1,120 @@
+//
+// slotdeque.c
+//
+// A work queue held at a steady depth: each step pushes a job on the back and pops one
+// off the front. This is done with a slotlist that pops with a memmove (what a queue
+// on a slotlist has to do), with a slotdeque popping one job at a time, and with a
+// slotdeque drained a span at a time. The slotlist's cost grows with the depth; the
+// deque's shouldn't.
+//
+//   cc -std=gnu99 -O2 -I.. slotdeque.c -o slotdeque
+//   ./slotdeque [steps]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "slotdeque.h"
+#include "slotlist.h"
+
+typedef struct {
+  uint32_t id;
+  uint32_t kind;
+  uint64_t arg;
+} Job;
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static double
+run_list(uint32_t depth, uint32_t steps, uint64_t *sum)
+{
+  Job *q = NULL;
+  double t;
+  for (uint32_t i = 0; i < depth; i++)
+    slotlist_push(q, ((Job){i, 0, i}));
+  t = now();
+  for (uint32_t i = 0; i < steps; i++) {
+    slotlist_push(q, ((Job){i, 1, i}));
+    *sum += slotlist_at(q, 0).arg;
+    memmove(slotlist_array(q), slotlist_array(q) + 1, sizeof(Job) * (slotlist_count(q) - 1));
+    slotlist_truncate(q, 1);
+  }
+  t = now() - t;
+  slotlist_free(q);
+  return t;
+}
+
+static double
+run_deque(uint32_t depth, uint32_t steps, uint64_t *sum)
+{
+  Job *q = NULL;
+  double t;
+  for (uint32_t i = 0; i < depth; i++)
+    slotdeque_push_back(q, ((Job){i, 0, i}));
+  t = now();
+  for (uint32_t i = 0; i < steps; i++) {
+    slotdeque_push_back(q, ((Job){i, 1, i}));
+    *sum += slotdeque_pop_front(q).arg;
+  }
+  t = now() - t;
+  slotdeque_free(q);
+  return t;
+}
+
+//
+// Pushes a batch of 64 and then drains as many spans as it takes to get back to 'depth'.
+//
+static double
+run_span(uint32_t depth, uint32_t steps, uint64_t *sum)
+{
+  Job *q = NULL;
+  double t;
+  for (uint32_t i = 0; i < depth; i++)
+    slotdeque_push_back(q, ((Job){i, 0, i}));
+  t = now();
+  for (uint32_t i = 0; i < steps; i += 64) {
+    for (uint32_t k = 0; k < 64; k++)
+      slotdeque_push_back(q, ((Job){i + k, 1, i + k}));
+    while (slotdeque_count(q) > depth) {
+      uint32_t n, extra = slotdeque_count(q) - depth;
+      Job *run = slotdeque_span(q, n);
+      if (n > extra)
+        n = extra;
+      for (uint32_t k = 0; k < n; k++)
+        *sum += run[k].arg;
+      slotdeque_drop_front(q, n);
+    }
+  }
+  t = now() - t;
+  slotdeque_free(q);
+  return t;
+}
+
+int
+main(int argc, char **argv)
+{
+  uint32_t steps = argc > 1 ? atoi(argv[1]) : 1000000;
+  uint32_t depths[] = {16, 256, 4096, 65536};
+  uint64_t sum = 0;
+
+  printf("%8s %14s %14s %14s\n", "depth", "list ns/op", "deque ns/op", "span ns/op");
+  for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+    //
+    // The memmove gets slow at depth, so the list takes fewer steps there.
+    //
+    uint32_t ls = depths[d] > 1024 ? steps / (depths[d] / 1024) : steps;
+    double list = run_list(depths[d], ls, &sum), deque = run_deque(depths[d], steps, &sum),
+      span = run_span(depths[d], steps, &sum);
+    printf("%8u %14.2f %14.2f %14.2f\n", depths[d], list * 1e9 / ls, deque * 1e9 / steps,
+      span * 1e9 / steps);
+  }
+  fprintf(stderr, "(checksum %llu)\n", (unsigned long long)sum);
+  return 0;
+}
@@ -0,0 +1,100 @@
+//
+// slotlist_kernels.c
+//
+// Times the slotlist_kernels.h find, count, filter and sort kernels on a slotlist of
+// random uint32_t keys, next to the plain loops (and qsort) they replace.
+//
+//   cc -std=gnu99 -O2 -I.. slotlist_kernels.c -o slotlist_kernels
+//   ./slotlist_kernels [n]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "slotlist_kernels.h"
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int
+cmp_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Keep the compiler from vectorizing the plain loops, so they stand in for hand-written ones.
+#define SCALAR __attribute__((optimize("no-tree-vectorize")))
+
+SCALAR static uint32_t
+scalar_find(const uint32_t *a, uint32_t n, uint32_t key)
+{
+  for (uint32_t i = 0; i < n; i++)
+    if (a[i] == key)
+      return i;
+  return SLOTLIST_MAX;
+}
+
+SCALAR static uint32_t
+scalar_count(const uint32_t *a, uint32_t n, uint32_t key)
+{
+  uint32_t c = 0;
+  for (uint32_t i = 0; i < n; i++)
+    c += a[i] >= key;
+  return c;
+}
+
+SCALAR static uint32_t
+scalar_filter(const uint32_t *a, uint32_t n, uint32_t key, uint32_t *out)
+{
+  uint32_t o = 0;
+  for (uint32_t i = 0; i < n; i++)
+    if (a[i] >= key)
+      out[o++] = a[i];
+  return o;
+}
+
+int
+main(int argc, char **argv)
+{
+  uint32_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000, i, r1, r2;
+  uint32_t *a = NULL, *b = NULL, *out = NULL, key = UINT32_MAX / 2, missing = 1;
+  double t;
+
+  srand(1);
+  for (i = 0; i < n; i++) {
+    uint32_t x = ((uint32_t)rand() << 1) | 1;
+    slotlist_push(a, x);
+    slotlist_push(b, x);
+  }
+  slotlist_expand(out, n);
+
+  printf("n = %u\n%-8s %12s %12s\n", n, "", "kernel ms", "plain ms");
+  t = now(); r1 = slotlist_find_u32(a, SLOTLIST_EQ, missing); t = now() - t;
+  double t2 = now(); r2 = scalar_find(slotlist_array(a), n, missing); t2 = now() - t2;
+  printf("%-8s %12.2f %12.2f%s\n", "find", t * 1e3, t2 * 1e3, r1 == r2 ? "" : "  MISMATCH");
+
+  t = now(); r1 = slotlist_count_u32(a, SLOTLIST_GE, key); t = now() - t;
+  t2 = now(); r2 = scalar_count(slotlist_array(a), n, key); t2 = now() - t2;
+  printf("%-8s %12.2f %12.2f%s\n", "count", t * 1e3, t2 * 1e3, r1 == r2 ? "" : "  MISMATCH");
+
+  slotlist_clear(out);
+  t = now(); r1 = slotlist_filter_u32(a, SLOTLIST_GE, key, out); t = now() - t;
+  t2 = now(); r2 = scalar_filter(slotlist_array(a), n, key, slotlist_array(out)); t2 = now() - t2;
+  printf("%-8s %12.2f %12.2f%s\n", "filter", t * 1e3, t2 * 1e3, r1 == r2 ? "" : "  MISMATCH");
+
+  t = now(); slotlist_sort_u32(a); t = now() - t;
+  t2 = now(); qsort(slotlist_array(b), n, sizeof(uint32_t), cmp_u32); t2 = now() - t2;
+  printf("%-8s %12.2f %12.2f%s\n", "sort", t * 1e3, t2 * 1e3,
+    memcmp(slotlist_array(a), slotlist_array(b), sizeof(uint32_t) * n) ? "  MISMATCH" : "");
+
+  slotlist_free(a);
+  slotlist_free(b);
+  slotlist_free(out);
+  return 0;
+}
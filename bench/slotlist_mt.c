@@ -0,0 +1,158 @@
+//
+// slotlist_mt.c
+//
+// Scaling benchmark for slotlist_mt.h. Each thread appends 'per_thread' events to one
+// shared list: one at a time with slotlist_mt_push, and a batch at a time with
+// slotlist_mt_claim. For comparison, the same events go into a list per thread that's
+// merged into one at the end (counting the merge), and into one list with a mutex around
+// each push. This runs from one thread up to 'max_threads' and prints events per second.
+//
+//   cc -std=gnu99 -O2 -I.. slotlist_mt.c -o slotlist_mt -lpthread
+//   ./slotlist_mt [max_threads] [per_thread]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "slotlist_mt.h"
+
+#define BATCH 64
+#define MAX_THREADS 64
+
+typedef struct {
+  uint32_t thread;
+  uint32_t seq;
+  uint64_t stamp;
+} Event;
+
+static Event *shared;
+static Ch_SlotListMT mt;
+static Event *own[MAX_THREADS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t per_thread = 1000000;
+
+static void *
+run_push(void *arg)
+{
+  uint32_t t = (uint32_t)(uintptr_t)arg;
+  for (uint32_t i = 0; i < per_thread; i++)
+    slotlist_mt_push(shared, &mt, ((Event){t, i, i}));
+  return NULL;
+}
+
+static void *
+run_claim(void *arg)
+{
+  uint32_t t = (uint32_t)(uintptr_t)arg, got;
+  for (uint32_t i = 0; i < per_thread; i += got) {
+    Event *e = slotlist_mt_claim(shared, &mt, per_thread - i < BATCH ? per_thread - i : BATCH,
+      got);
+    if (!e)
+      break;
+    for (uint32_t k = 0; k < got; k++)
+      e[k] = (Event){t, i + k, i + k};
+    slotlist_mt_commit(&mt, got);
+  }
+  return NULL;
+}
+
+static void *
+run_own(void *arg)
+{
+  uint32_t t = (uint32_t)(uintptr_t)arg;
+  for (uint32_t i = 0; i < per_thread; i++)
+    slotlist_push(own[t], ((Event){t, i, i}));
+  return NULL;
+}
+
+static void *
+run_locked(void *arg)
+{
+  uint32_t t = (uint32_t)(uintptr_t)arg;
+  for (uint32_t i = 0; i < per_thread; i++) {
+    pthread_mutex_lock(&lock);
+    slotlist_push(shared, ((Event){t, i, i}));
+    pthread_mutex_unlock(&lock);
+  }
+  return NULL;
+}
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static double
+timed(int nthreads, void *(*fn)(void *))
+{
+  pthread_t t[MAX_THREADS];
+  double a = now();
+  for (int i = 0; i < nthreads; i++)
+    pthread_create(&t[i], NULL, fn, (void *)(uintptr_t)i);
+  for (int i = 0; i < nthreads; i++)
+    pthread_join(t[i], NULL);
+  return now() - a;
+}
+
+//
+// Runs 'fn' on a freshly reserved shared list and checks that every event made it in.
+//
+static double
+shared_run(int nthreads, void *(*fn)(void *))
+{
+  uint32_t n = per_thread * nthreads;
+  double t;
+  shared = NULL;
+  slotlist_reserve(shared, n);
+  slotlist_mt_begin(shared, &mt);
+  t = timed(nthreads, fn);
+  if (slotlist_mt_end(shared, &mt) || slotlist_count(shared) != n ||
+      slotlist_mt_ready(shared, &mt) != n)
+    fprintf(stderr, "lost events with %d threads\n", nthreads);
+  slotlist_free(shared);
+  return t;
+}
+
+int
+main(int argc, char **argv)
+{
+  int max = argc > 1 ? atoi(argv[1]) : 16;
+  if (argc > 2)
+    per_thread = atoi(argv[2]);
+  if (max > MAX_THREADS)
+    max = MAX_THREADS;
+
+  printf("%8s %14s %14s %14s %14s\n", "threads", "mt_push ev/s", "mt_claim ev/s",
+    "merge ev/s", "mutex ev/s");
+  for (int n = 1; n <= max; n *= 2) {
+    double events = (double)per_thread * n, push, claim, merge, mx;
+    push = shared_run(n, run_push);
+    claim = shared_run(n, run_claim);
+
+    merge = now();
+    timed(n, run_own);
+    shared = NULL;
+    slotlist_reserve(shared, per_thread * n);
+    for (int t = 0; t < n; t++) {
+      memcpy(slotlist_add(shared, slotlist_count(own[t])), slotlist_array(own[t]),
+        sizeof(Event) * slotlist_count(own[t]));
+      slotlist_free(own[t]);
+      own[t] = NULL;
+    }
+    merge = now() - merge;
+    slotlist_free(shared);
+
+    shared = NULL;
+    mx = timed(n, run_locked);
+    slotlist_free(shared);
+
+    printf("%8d %14.0f %14.0f %14.0f %14.0f\n", n, events / push, events / claim,
+      events / merge, events / mx);
+  }
+  return 0;
+}
@@ -0,0 +1,198 @@
+//
+// slotmap64.c
+//
+// Fills a paged slotmap64.h and a single-block slotmap.h with the same number of
+// elements, and reports the total time to add them and the worst single add. Growing
+// the single block can copy everything that's there (unless the allocator remaps big
+// blocks in place), which shows up as the worst add climbing with N. Pages don't copy,
+// so slotmap64's worst add stays flat.
+// Lookups and removes are timed for both as well.
+//
+// First it checks slotmap64 across page boundaries: removed IDs have to stop working,
+// IDs past the last page have to be turned away, and removed slots have to be handed
+// out again before a new page is added. Then that slotmap64_id gives back each element's ID,
+// for pages that are and aren't a power of two in size. It exits with 1 if a check fails.
+//
+//   cc -std=gnu99 -O2 -I.. slotmap64.c -o slotmap64
+//   ./slotmap64 [n]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "slotmap.h"
+#include "slotmap64.h"
+
+typedef struct {
+  uint32_t version;
+  uint32_t pad;
+  double value;
+} Big;
+
+typedef struct {
+  uint32_t version : 8;
+  uint32_t pad : 24;
+  double value;
+} Small;
+
+typedef struct {
+  uint32_t version;
+  uint32_t pad;
+  double value[2];
+} Odd;
+
+static int failed;
+
+#define check(cond, ...) \
+  ((cond) ? 0 : (fprintf(stderr, "FAIL: " __VA_ARGS__), fputc('\n', stderr), failed = 1))
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//
+// Fills two and a half pages, then removes the slots on either side of each page
+// boundary and checks the old IDs, IDs past the end and the reuse of those slots.
+//
+static void
+check_pages(void)
+{
+  uint32_t n = SLOTMAP64_PAGE_ITEMS * 2 + SLOTMAP64_PAGE_ITEMS / 2, i, pages;
+  uint32_t edge[] = {SLOTMAP64_PAGE_ITEMS - 1, SLOTMAP64_PAGE_ITEMS,
+    SLOTMAP64_PAGE_ITEMS * 2 - 1, SLOTMAP64_PAGE_ITEMS * 2, n - 1};
+  SLOTMAP64_ID *ids = malloc(sizeof(SLOTMAP64_ID) * n), id;
+  Big *m = NULL, *e;
+
+  for (i = 0; i < n; i++)
+    slotmap64_add(m, ids[i])->value = i;
+  pages = slotmap64_pages(m);
+  check(pages == 3, "%u items took %u pages", n, pages);
+
+  for (i = 0; i < sizeof(edge) / sizeof(edge[0]); i++) {
+    e = slotmap64_at(m, ids[edge[i]]);
+    check(e && e->value == edge[i], "item %u not found", edge[i]);
+    check(slotmap64_remove(m, ids[edge[i]]) != NULL, "item %u not removed", edge[i]);
+    check(!slotmap64_at(m, ids[edge[i]]), "item %u found after remove", edge[i]);
+    check(!slotmap64_remove(m, ids[edge[i]]), "item %u removed twice", edge[i]);
+  }
+
+  for (i = 0; i < 3; i++) {
+    id = slotmap64__id(n + i * SLOTMAP64_PAGE_ITEMS, 0);
+    check(!slotmap64_at(m, id), "id %u past the end found", id.index);
+    check(!slotmap64_remove(m, id), "id %u past the end removed", id.index);
+  }
+  id = slotmap64__id(SLOTMAP64_MAX_INDEX - 1, 0);
+  check(!slotmap64_at(m, id), "id %u past the directory found", id.index);
+
+  for (i = 0; i < sizeof(edge) / sizeof(edge[0]); i++) {
+    uint32_t k;
+    e = slotmap64_add(m, id);
+    check(e != NULL, "no item added");
+    if (!e)
+      break;
+    e->value = -1.0;
+    for (k = 0; k < sizeof(edge) / sizeof(edge[0]) && id.index != edge[k]; k++);
+    check(k < sizeof(edge) / sizeof(edge[0]), "slot %u added where %u were free",
+      id.index, (uint32_t)(sizeof(edge) / sizeof(edge[0])));
+    if (k < sizeof(edge) / sizeof(edge[0]))
+      check(!slotmap64_at(m, ids[edge[k]]) && id.version != ids[edge[k]].version,
+        "old id for slot %u works again", id.index);
+  }
+  check(slotmap64_used(m) == n && slotmap64_pages(m) == pages,
+    "grew to %u items on %u pages instead of reusing slots", slotmap64_used(m),
+    slotmap64_pages(m));
+  check(slotmap64_count(m) == n, "%u items counted, not %u", slotmap64_count(m), n);
+
+  slotmap64_free(m);
+  free(ids);
+}
+
+//
+// Every element's address leads back to its ID.
+//
+#define check_ids(T) ({ \
+  uint32_t n = SLOTMAP64_PAGE_ITEMS * 3, i; \
+  SLOTMAP64_ID *ids = malloc(sizeof(SLOTMAP64_ID) * n), id; \
+  T *m = NULL, *e; \
+  for (i = 0; i < n; i++) \
+    slotmap64_add(m, ids[i]); \
+  for (i = 0; i < n; i += 5) \
+    slotmap64_remove(m, ids[i]); \
+  for (i = 0; i < n; i += 5) \
+    slotmap64_add(m, ids[i]); \
+  for (i = 0; i < n; i++) { \
+    e = slotmap64_at(m, ids[i]); \
+    id = slotmap64_id(m, e); \
+    check(id.index == ids[i].index && id.version == ids[i].version, \
+      "%s item %u has id %u:%u", #T, i, id.index, id.version); \
+  } \
+  slotmap64_free(m); \
+  free(ids); \
+})
+
+int
+main(int argc, char **argv)
+{
+  uint32_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000, i;
+  SLOTMAP64_ID *ids64 = malloc(sizeof(SLOTMAP64_ID) * n);
+  SLOT_ID *ids = malloc(sizeof(SLOT_ID) * n);
+  double t, t0, worst64 = 0, worst = 0, add64, add, at64, at, rm64, rm, sum = 0;
+  Big *m64 = NULL;
+  Small *m = NULL;
+
+  check_pages();
+  check_ids(Big);
+  check_ids(Odd);
+  if (failed)
+    return 1;
+  if (n > SLOTMAP_MAX_ID)
+    n = SLOTMAP_MAX_ID;
+
+  t0 = now();
+  for (i = 0; i < n; i++) {
+    t = now();
+    slotmap64_add(m64, ids64[i])->value = i;
+    if (now() - t > worst64)
+      worst64 = now() - t;
+  }
+  add64 = now() - t0;
+  t0 = now();
+  for (i = 0; i < n; i++)
+    sum += slotmap64_at(m64, ids64[(i * 7919ULL) % n])->value;
+  at64 = now() - t0;
+  t0 = now();
+  for (i = 0; i < n; i++)
+    slotmap64_remove(m64, ids64[i]);
+  rm64 = now() - t0;
+
+  t0 = now();
+  for (i = 0; i < n; i++) {
+    t = now();
+    slotmap_add(m, ids[i])->value = i;
+    if (now() - t > worst)
+      worst = now() - t;
+  }
+  add = now() - t0;
+  t0 = now();
+  for (i = 0; i < n; i++)
+    sum += slotmap_at(m, ids[(i * 7919ULL) % n])->value;
+  at = now() - t0;
+  t0 = now();
+  for (i = 0; i < n; i++)
+    slotmap_remove(m, ids[i]);
+  rm = now() - t0;
+
+  printf("n = %u (checksum %.0f)\n", n, sum);
+  printf("%-10s %10s %14s %10s %10s\n", "", "add s", "worst add ms", "at s", "remove s");
+  printf("%-10s %10.3f %14.3f %10.3f %10.3f\n", "slotmap64", add64, worst64 * 1e3, at64, rm64);
+  printf("%-10s %10.3f %14.3f %10.3f %10.3f\n", "slotmap", add, worst * 1e3, at, rm);
+  slotmap64_free(m64);
+  slotmap_free(m);
+  free(ids64);
+  free(ids);
+  return 0;
+}
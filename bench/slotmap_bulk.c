@@ -0,0 +1,119 @@
+//
+// slotmap_bulk.c
+//
+// Compares spawning and despawning waves of entities one at a time (slotmap_add and
+// slotmap_remove) against the bulk calls (slotmap_reserve, slotmap_add_n and
+// slotmap_remove_n.) Each wave starts from an empty map, so the one-at-a-time path has
+// to climb the SLOT_FLEX_SIZE ladder again.
+//
+// First it checks that slotmap_add_n hands out IDs that work, from the freelist as well
+// as the end, for an item with a whole word for its version. It exits with 1 if they don't.
+//
+//   cc -std=gnu99 -O2 -I.. slotmap_bulk.c -o slotmap_bulk
+//   ./slotmap_bulk [wave_size] [waves]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "slotmap.h"
+
+typedef struct {
+  uint32_t version : 8;
+  uint32_t pad : 24;
+  float pos[4];
+  float vel[4];
+} Entity;
+
+typedef struct {
+  uint32_t version;
+  int value;
+} Wide;
+
+static int failed;
+
+#define check(cond, ...) \
+  ((cond) ? 0 : (fprintf(stderr, "FAIL: " __VA_ARGS__), fputc('\n', stderr), failed = 1))
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//
+// Removes a few items (so the freelist links sit in their version words), then adds them
+// back with slotmap_add_n along with some from the end, and looks up every ID.
+//
+static void
+check_freelist(void)
+{
+  Wide *m = NULL;
+  SLOT_ID ids[8], fresh[6];
+  for (int i = 0; i < 8; i++)
+    slotmap_add(m, ids[i])->value = i;
+  slotmap_remove(m, ids[1]);
+  slotmap_remove(m, ids[2]);
+  slotmap_remove(m, ids[5]);
+  check(slotmap_add_n(m, 6, fresh) == 6, "slotmap_add_n added nothing");
+  for (int i = 0; i < 6; i++) {
+    Wide *w = slotmap_at(m, fresh[i]);
+    check(w != NULL, "id %08x from slotmap_add_n not found", fresh[i]);
+    if (w)
+      w->value = 100 + i;
+  }
+  for (int i = 0; i < 8; i++) {
+    Wide *w = slotmap_at(m, ids[i]);
+    if (i == 1 || i == 2 || i == 5)
+      check(!w, "stale id %08x found", ids[i]);
+    else
+      check(w && w->value == i, "id %08x lost", ids[i]);
+  }
+  slotmap_free(m);
+}
+
+int
+main(int argc, char **argv)
+{
+  int n = argc > 1 ? atoi(argv[1]) : 50000, waves = argc > 2 ? atoi(argv[2]) : 100;
+  SLOT_ID *ids = malloc(sizeof(SLOT_ID) * n);
+  double t, single[2] = {0}, bulk[2] = {0};
+
+  check_freelist();
+  if (failed)
+    return 1;
+
+  for (int w = 0; w < waves; w++) {
+    Entity *m = NULL;
+    t = now();
+    for (int i = 0; i < n; i++)
+      slotmap_add(m, ids[i])->pos[0] = i;
+    single[0] += now() - t;
+    t = now();
+    for (int i = 0; i < n; i++)
+      slotmap_remove(m, ids[i]);
+    single[1] += now() - t;
+    slotmap_free(m);
+
+    m = NULL;
+    t = now();
+    slotmap_add_n(m, n, ids);
+    for (int i = 0; i < n; i++)
+      slotmap_array(m)[slotmap_index(ids[i])].pos[0] = i;
+    bulk[0] += now() - t;
+    t = now();
+    slotmap_remove_n(m, ids, n);
+    bulk[1] += now() - t;
+    slotmap_free(m);
+  }
+
+  printf("%-12s %12s %12s\n", "", "add ns/op", "remove ns/op");
+  printf("%-12s %12.2f %12.2f\n", "one-by-one",
+    single[0] * 1e9 / ((double)n * waves), single[1] * 1e9 / ((double)n * waves));
+  printf("%-12s %12.2f %12.2f\n", "bulk",
+    bulk[0] * 1e9 / ((double)n * waves), bulk[1] * 1e9 / ((double)n * waves));
+  free(ids);
+  return 0;
+}
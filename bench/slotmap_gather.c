@@ -0,0 +1,97 @@
+//
+// slotmap_gather.c
+//
+// Compares resolving a shuffled array of IDs one at a time (slotmap_at, then reading a
+// field) against slotmap_at_many and slotmap_gather_field. A tenth of the IDs are stale,
+// so the found/not-found branch can't be learned. Run it with a map that fits in cache
+// and one that doesn't.
+//
+//   cc -std=gnu99 -O2 -I.. slotmap_gather.c -o slotmap_gather
+//   ./slotmap_gather [map_size] [lookups] [rounds]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "slotmap.h"
+
+typedef struct {
+  uint32_t version : 8;
+  uint32_t pad : 24;
+  float pos[4];
+  float vel[4];
+  uint32_t flags;
+} Body;
+
+// slotmap_at_many is run this many IDs at a time, so the elements are still in cache when
+// the pointers are used.
+#define CHUNK 256
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+  uint32_t size = argc > 1 ? atoi(argv[1]) : 1000000, n = argc > 2 ? atoi(argv[2]) : 100000;
+  int rounds = argc > 3 ? atoi(argv[3]) : 100;
+  SLOT_ID *ids = malloc(sizeof(SLOT_ID) * size), *q = malloc(sizeof(SLOT_ID) * n);
+  Body **ptrs = malloc(sizeof(Body *) * CHUNK);
+  float *out = malloc(sizeof(float) * n);
+  uint64_t *invalid = malloc(sizeof(uint64_t) * ((n + 63) / 64));
+  double t, times[3] = {0};
+  uint64_t sum = 0;
+  Body *m = NULL;
+
+  slotmap_add_n(m, size, ids);
+  for (uint32_t i = 0; i < size; i++)
+    slotmap_array(m)[slotmap_index(ids[i])].pos[0] = i;
+  srand(1);
+  for (uint32_t i = 0; i < n; i++) {
+    q[i] = ids[(((uint32_t)rand() << 16) ^ (uint32_t)rand()) % size];
+    if (rand() % 10 == 0)
+      q[i] += 1U << 24;
+  }
+
+  for (int r = 0; r < rounds; r++) {
+    t = now();
+    for (uint32_t i = 0; i < n; i++) {
+      Body *b = slotmap_at(m, q[i]);
+      out[i] = b ? b->pos[0] : 0;
+    }
+    times[0] += now() - t;
+    sum += out[r % n];
+
+    t = now();
+    for (uint32_t i = 0; i < n; i += CHUNK) {
+      uint32_t k = n - i < CHUNK ? n - i : CHUNK;
+      slotmap_at_many(m, q + i, k, ptrs, invalid + i / 64);
+      for (uint32_t j = 0; j < k; j++)
+        out[i + j] = ptrs[j] ? ptrs[j]->pos[0] : 0;
+    }
+    times[1] += now() - t;
+    sum += out[r % n] + invalid[0];
+
+    t = now();
+    slotmap_gather_field(m, q, n, pos[0], out, invalid);
+    times[2] += now() - t;
+    sum += out[r % n] + invalid[0];
+  }
+
+  printf("%u bodies, %u lookups: at %.2f ns/id, at_many %.2f ns/id, gather %.2f ns/id\n",
+    size, n, times[0] * 1e9 / ((double)n * rounds), times[1] * 1e9 / ((double)n * rounds),
+    times[2] * 1e9 / ((double)n * rounds));
+  fprintf(stderr, "(checksum %llu)\n", (unsigned long long)sum);
+  slotmap_free(m);
+  free(ids);
+  free(q);
+  free(ptrs);
+  free(out);
+  free(invalid);
+  return 0;
+}
@@ -0,0 +1,136 @@
+//
+// slotmap_mt.c
+//
+// Contention benchmark for slotmap_mt.h. Each thread adds a batch of elements and then
+// removes them again, over and over. This runs from one thread up to 'max_threads' and
+// prints the total adds and removes per second. The same work is then done on a plain
+// slotmap.h with a mutex around each call, for comparison. It first checks that IDs of
+// slots that were never handed out, or that sit free in a cache, don't validate.
+//
+//   cc -std=gnu99 -O2 -I.. slotmap_mt.c -o slotmap_mt -lpthread
+//   ./slotmap_mt [max_threads] [rounds]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "slotmap_mt.h"
+
+#define BATCH 256
+
+typedef struct {
+  uint32_t version : 8;
+  uint32_t pad : 24;
+  uint32_t value;
+} Entity;
+
+static Ch_SlotMapMT *shared;
+static Entity *locked;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int rounds = 2000;
+static int failed;
+
+#define check(cond, ...) \
+  ((cond) ? 0 : (fprintf(stderr, "FAIL: " __VA_ARGS__), fputc('\n', stderr), failed = 1))
+
+static void *
+run_mt(void *arg)
+{
+  Ch_SlotMapCache cache = {0};
+  SLOT_ID ids[BATCH];
+  (void)arg;
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < BATCH; i++)
+      slotmap_mt_add(shared, Entity, &cache, ids[i])->value = i;
+    for (int i = 0; i < BATCH; i++)
+      slotmap_mt_remove(shared, &cache, ids[i]);
+  }
+  slotmap_mt_flush(shared, &cache);
+  return NULL;
+}
+
+static void *
+run_locked(void *arg)
+{
+  SLOT_ID ids[BATCH];
+  (void)arg;
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < BATCH; i++) {
+      pthread_mutex_lock(&lock);
+      slotmap_add(locked, ids[i])->value = i;
+      pthread_mutex_unlock(&lock);
+    }
+    for (int i = 0; i < BATCH; i++) {
+      pthread_mutex_lock(&lock);
+      slotmap_remove(locked, ids[i]);
+      pthread_mutex_unlock(&lock);
+    }
+  }
+  return NULL;
+}
+
+//
+// IDs only find slots that hold an element.
+//
+static void
+check_live(void)
+{
+  Ch_SlotMapMT *m = slotmap_mt_new(Entity, 16);
+  Ch_SlotMapCache cache = {0};
+  SLOT_ID a, b;
+  check(slotmap_mt_at(m, Entity, 0) == NULL, "id 0 found in an empty map");
+  check(!slotmap_mt_remove(m, &cache, 0), "id 0 removed from an empty map");
+  slotmap_mt_add(m, Entity, &cache, a);
+  check(slotmap_mt_at(m, Entity, a) != NULL, "id %08x not found", a);
+  check(cache.count > 0 && slotmap_mt_at(m, Entity, cache.slot[cache.count - 1]) == NULL,
+    "cached slot found");
+  check(slotmap_mt_at(m, Entity, 5) == NULL, "unclaimed slot 5 found");
+  check(!slotmap_mt_remove(m, &cache, 5), "unclaimed slot 5 removed");
+  check(slotmap_mt_remove(m, &cache, a), "id %08x not removed", a);
+  check(!slotmap_mt_remove(m, &cache, a), "id %08x removed twice", a);
+  check(slotmap_mt_at(m, Entity, slotmap_index(a) | (((a >> 24) + 1) << 24)) == NULL,
+    "removed slot found by its next version");
+  slotmap_mt_add(m, Entity, &cache, b);
+  check(b != a && slotmap_mt_at(m, Entity, a) == NULL, "stale id %08x found", a);
+  slotmap_mt_free(m);
+}
+
+static double
+timed(int nthreads, void *(*fn)(void *))
+{
+  pthread_t t[nthreads];
+  struct timespec a, b;
+  clock_gettime(CLOCK_MONOTONIC, &a);
+  for (int i = 0; i < nthreads; i++)
+    pthread_create(&t[i], NULL, fn, NULL);
+  for (int i = 0; i < nthreads; i++)
+    pthread_join(t[i], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &b);
+  return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+  int max = argc > 1 ? atoi(argv[1]) : 16;
+  if (argc > 2)
+    rounds = atoi(argv[2]);
+
+  check_live();
+  if (failed)
+    return 1;
+
+  printf("%8s %16s %16s\n", "threads", "slotmap_mt op/s", "mutex op/s");
+  for (int n = 1; n <= max; n *= 2) {
+    double ops = 2.0 * BATCH * rounds * n, mt, mx;
+    shared = slotmap_mt_new(Entity, n * (BATCH + SLOTMAP_MT_MAGAZINE * 2));
+    mt = timed(n, run_mt);
+    slotmap_mt_free(shared);
+    mx = timed(n, run_locked);
+    slotmap_free(locked);
+    locked = NULL;
+    printf("%8d %16.0f %16.0f\n", n, ops / mt, ops / mx);
+  }
+  return 0;
+}
@@ -0,0 +1,198 @@
+//
+// slotmap_trim.c
+//
+// Drains a burst of entities back down and times slotmap_trim giving the memory back,
+// after checking that trimming never lets a stale ID back in: IDs removed before a trim
+// have to keep failing slotmap_at once their slots are handed out again - across
+// repeated trims, and where the version byte wraps around. Then that, with
+// SLOTMAP_SHOULD_TRIM, removals inside slotmap_each wait for the loop to finish before
+// trimming. It exits with 1 if a check fails.
+//
+//   cc -std=gnu99 -O2 -I.. slotmap_trim.c -o slotmap_trim
+//   ./slotmap_trim [burst] [keep]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Only check_each turns on trimming as elements are removed.
+static int autotrim;
+#define SLOTMAP_SHOULD_TRIM(count, used) (autotrim && (count) < (used) / 4)
+#include "slotmap.h"
+
+typedef struct {
+  uint32_t version : 8;
+  uint32_t pad : 24;
+  uint32_t serial;
+  float pos[4];
+} Entity;
+
+static int failed;
+
+#define check(cond, ...) \
+  ((cond) ? 0 : (fprintf(stderr, "FAIL: " __VA_ARGS__), fputc('\n', stderr), failed = 1))
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//
+// Empties a map down to its first 'keep' entries (and a few holes among them), trims it
+// and fills it back up, checking every removed ID before and after the refill.
+//
+static void
+check_refill(uint32_t n, uint32_t keep)
+{
+  Entity *m = NULL;
+  SLOT_ID *ids = malloc(sizeof(SLOT_ID) * n), *fresh = malloc(sizeof(SLOT_ID) * n);
+  for (uint32_t i = 0; i < n; i++)
+    slotmap_add(m, ids[i])->serial = i;
+  for (uint32_t i = 0; i < n; i++)
+    if (i >= keep || i % 7 == 3)
+      slotmap_remove(m, ids[i]);
+  check(slotmap_trim(m) == n - keep, "trim released %u of %u", n - slotmap_used(m), n - keep);
+  for (uint32_t i = 0; i < n; i++) {
+    Entity *e = slotmap_at(m, ids[i]);
+    if (i >= keep || i % 7 == 3)
+      check(!e, "stale id %08x found after trim", ids[i]);
+    else
+      check(e && e->serial == i, "live id %08x lost in trim", ids[i]);
+  }
+  for (uint32_t i = 0; i < n; i++)
+    slotmap_add(m, fresh[i])->serial = n + i;
+  for (uint32_t i = 0; i < n; i++) {
+    Entity *e = slotmap_at(m, ids[i]);
+    if (i >= keep || i % 7 == 3)
+      check(!e, "stale id %08x found after refill", ids[i]);
+    e = slotmap_at(m, fresh[i]);
+    check(e && e->serial == n + i, "new id %08x not found", fresh[i]);
+  }
+  slotmap_free(m);
+  free(fresh);
+  free(ids);
+}
+
+//
+// Hands out a slot at every version, trimming it away each time, so the fresh version
+// has to wrap around past 255.
+//
+static void
+check_wrap(void)
+{
+  Entity *m = NULL;
+  SLOT_ID first, id, old[256];
+  slotmap_add(m, first);
+  for (int i = 0; i < 600; i++) {
+    slotmap_add(m, id);
+    check(slotmap_index(id) == 1, "slot %u handed out", slotmap_index(id));
+    for (int k = 1; k < 256 && k <= i; k++)
+      check(id != old[(i - k) % 256], "id %08x handed out again after %d trims", id, k);
+    old[i % 256] = id;
+    slotmap_remove(m, id);
+    check(slotmap_trim(m) == 1, "slot not trimmed");
+    check(!slotmap_at(m, id), "stale id %08x found after trim", id);
+  }
+  check(slotmap_at(m, first) != NULL, "live id %08x lost", first);
+  slotmap_free(m);
+}
+
+//
+// Reuses a slot through the freelist until its version wraps, then trims it, mixed with
+// slots that were trimmed earlier and are still waiting past the end.
+//
+static void
+check_mixed(void)
+{
+  Entity *m = NULL;
+  SLOT_ID ids[4], id, last[300];
+  for (int i = 0; i < 4; i++)
+    slotmap_add(m, ids[i]);
+  slotmap_remove(m, ids[3]);
+  slotmap_remove(m, ids[2]);
+  slotmap_trim(m);
+  for (int i = 0; i < 300; i++) {
+    slotmap_remove(m, ids[1]);
+    slotmap_add(m, ids[1]);
+    last[i] = ids[1];
+  }
+  slotmap_remove(m, ids[1]);
+  slotmap_trim(m);
+  for (int i = 0; i < 3; i++) {
+    slotmap_add(m, id);
+    for (int k = 300 - 255; k < 300; k++)
+      check(id != last[k], "id %08x of a wrapped slot handed out again", id);
+    check(id != ids[2] && id != ids[3], "id %08x handed out again", id);
+  }
+  slotmap_free(m);
+}
+
+//
+// Removes most of a map from inside slotmap_each, which has to visit every element once
+// (a trim in the middle would pull the block out from under it) and trim after.
+//
+static void
+check_each(uint32_t n, uint32_t keep)
+{
+  Entity *m = NULL;
+  SLOT_ID *ids = malloc(sizeof(SLOT_ID) * n);
+  uint32_t seen = 0;
+  autotrim = 1;
+  for (uint32_t i = 0; i < n; i++)
+    slotmap_add(m, ids[i])->serial = i;
+  slotmap_each(m, e, {
+    seen++;
+    if (e->serial >= keep)
+      check(slotmap_remove(m, ids[e->serial]) == 1, "id %08x not removed", ids[e->serial]);
+  });
+  check(seen == n, "%u of %u entities visited", seen, n);
+  check(slotmap_used(m) == keep, "%u slots used after the loop, not %u", slotmap_used(m), keep);
+  for (uint32_t i = 0; i < n; i++) {
+    Entity *e = slotmap_at(m, ids[i]);
+    check(i < keep ? e && e->serial == i : !e, "id %08x wrong after the loop", ids[i]);
+  }
+  for (uint32_t i = keep; i-- > 1; )
+    check(slotmap_remove(m, ids[i]) == 1, "id %08x not removed", ids[i]);
+  check(slotmap_remove(m, ids[keep - 1]) == 0, "id %08x removed twice", ids[keep - 1]);
+  check(slotmap_used(m) < keep, "no trim outside the loop");
+  slotmap_free(m);
+  free(ids);
+  autotrim = 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  uint32_t n = argc > 1 ? atoi(argv[1]) : 10000000, keep = argc > 2 ? atoi(argv[2]) : 100000;
+  SLOT_ID *ids;
+  Entity *m = NULL;
+  size_t before;
+  double t;
+
+  check_refill(100000, 1000);
+  check_refill(1000, 0);
+  check_wrap();
+  check_mixed();
+  check_each(10000, 100);
+  if (failed)
+    return 1;
+
+  ids = malloc(sizeof(SLOT_ID) * n);
+  for (uint32_t i = 0; i < n; i++)
+    slotmap_add(m, ids[i])->serial = i;
+  for (uint32_t i = keep; i < n; i++)
+    slotmap_remove(m, ids[i]);
+  before = slotmap_allocated(m) * sizeof(Entity);
+  t = now();
+  slotmap_trim(m);
+  t = now() - t;
+  printf("%u -> %u entities: %.1f MB -> %.1f MB, trimmed in %.2f ms\n", n, keep,
+    before / 1e6, slotmap_allocated(m) * sizeof(Entity) / 1e6, t * 1e3);
+  slotmap_free(m);
+  free(ids);
+  return 0;
+}
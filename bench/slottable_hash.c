@@ -0,0 +1,158 @@
+//
+// slottable_hash.c
+//
+// Compares the byte-at-a-time string hash (slottable_strnhash) with the word-at-a-time
+// ones (slottable_strn_fasthash and slottable_strn_seedhash) on a slottable: for each key
+// set it times the hash alone, fills a table and prints the slottable_histogram of how
+// far finds have to go, then times the finds. Integer keys spaced a power of two apart
+// are run the same way, unhashed and through slottable_u32_hash. The times are ns per key;
+// the histogram columns count keys by the number of items a find passes first.
+//
+//   cc -std=gnu99 -O2 -I.. slottable_hash.c -o slottable_hash
+//   ./slottable_hash [keys] [rounds]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "slottable.h"
+
+typedef struct {
+  const char *key;
+  uint32_t len;
+  uint32_t value;
+} Entry;
+
+#define HIST 8
+
+typedef uint32_t (*Hash)(const char *, size_t);
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static uint32_t
+seeded(const char *s, size_t len)
+{
+  return slottable_strn_seedhash(s, len, 0x5EED5EED5EED5EEDULL);
+}
+
+static uint32_t
+unhashed(const char *s, size_t len)
+{
+  uint32_t v;
+  memcpy(&v, s, sizeof(v));
+  (void)len;
+  return v;
+}
+
+static uint32_t
+mixed(const char *s, size_t len)
+{
+  return slottable_u32_hash(unhashed(s, len));
+}
+
+#define entry_cmp(k, e) ((k)->len != (e)->len || memcmp((k)->key, (e)->key, (k)->len))
+
+//
+// Times 'hash' on every key, then fills a table, prints its histogram and times finding
+// every key in it.
+//
+static void
+run(const char *name, Hash hash, Entry *keys, uint32_t n, int rounds)
+{
+  uint32_t *hashes = malloc(sizeof(uint32_t) * n), hist[HIST], longest, found = 0;
+  Entry *t = NULL;
+  double th, tf;
+
+  th = now();
+  for (int r = 0; r < rounds; r++)
+    for (uint32_t i = 0; i < n; i++)
+      hashes[i] = hash(keys[i].key, keys[i].len);
+  th = now() - th;
+
+  for (uint32_t i = 0; i < n; i++)
+    *slottable_add(t, hashes[i], 0) = keys[i];
+  longest = slottable_histogram(t, hist, HIST);
+
+  tf = now();
+  for (int r = 0; r < rounds; r++)
+    for (uint32_t i = 0; i < n; i++)
+      found += slottable_find(t, hash(keys[i].key, keys[i].len), entry_cmp, &keys[i]) != NULL;
+  tf = now() - tf;
+  if (found != n * (uint32_t)rounds)
+    fprintf(stderr, "%s: %u of %u found\n", name, found, n * rounds);
+
+  printf("%-12s %8.2f %8.2f ", name, th * 1e9 / ((double)n * rounds),
+    tf * 1e9 / ((double)n * rounds));
+  for (int i = 0; i < HIST; i++)
+    printf(" %7u", hist[i]);
+  printf(" %7u\n", longest);
+  slottable_free(t);
+  free(hashes);
+}
+
+static void
+header(const char *keys, uint32_t n)
+{
+  printf("\n%u %s\n%-12s %8s %8s ", n, keys, "", "hash ns", "find ns");
+  for (int i = 0; i < HIST; i++)
+    printf(" %6d%s", i, i == HIST - 1 ? "+" : " ");
+  printf(" %7s\n", "longest");
+}
+
+int
+main(int argc, char **argv)
+{
+  uint32_t n = argc > 1 ? atoi(argv[1]) : 200000;
+  int rounds = argc > 2 ? atoi(argv[2]) : 10;
+  Entry *keys = malloc(sizeof(Entry) * n);
+  char *text = malloc((size_t)n * 224), *p = text;
+  uint32_t *ints = malloc(sizeof(uint32_t) * n);
+
+  //
+  // Paths 40 to 200 bytes long, sharing long prefixes the way real ones do.
+  //
+  srand(1);
+  for (uint32_t i = 0; i < n; i++) {
+    int len = sprintf(p, "/srv/data/tenants/%04u/users/%08u/", rand() % 100, i);
+    int want = 40 + rand() % 161;
+    while (len < want)
+      len += sprintf(p + len, "%s", "segment/");
+    keys[i] = (Entry){p, (uint32_t)want, i};
+    p += want;
+  }
+  header("path keys, 40-200 bytes", n);
+  run("strnhash", slottable_strnhash, keys, n, rounds);
+  run("fasthash", slottable_strn_fasthash, keys, n, rounds);
+  run("seedhash", seeded, keys, n, rounds);
+
+  p = text;
+  for (uint32_t i = 0; i < n; i++) {
+    int len = sprintf(p, "key%u", i);
+    keys[i] = (Entry){p, (uint32_t)len, i};
+    p += len;
+  }
+  header("short keys", n);
+  run("strnhash", slottable_strnhash, keys, n, rounds);
+  run("fasthash", slottable_strn_fasthash, keys, n, rounds);
+  run("seedhash", seeded, keys, n, rounds);
+
+  for (uint32_t i = 0; i < n; i++) {
+    ints[i] = i * 1024;
+    keys[i] = (Entry){(const char *)&ints[i], sizeof(uint32_t), i};
+  }
+  header("integer keys, 1024 apart", n);
+  run("unhashed", unhashed, keys, n, 1);      // its chains are hundreds long
+  run("u32_hash", mixed, keys, n, rounds);
+
+  free(ints);
+  free(text);
+  free(keys);
+  return 0;
+}
@@ -0,0 +1,206 @@
+//
+// slottable_mt.c
+//
+// Scaling benchmark for slottable_mt.h. Reader threads look up keys that are always in
+// the table while one writer keeps adding new ones and removing them again a little later,
+// so the table grows (and rehashes) and has items taken out underneath them. This runs from one reader up to 'max_threads' and prints the total
+// finds per second and the slowest run of 256 finds any reader saw - which is where a
+// reader held up behind a rehash would show. The same work is then done on a plain
+// slottable.h with a mutex around each call, for comparison. It exits with 1 if a find
+// misses or gets the wrong item.
+//
+//   cc -std=gnu99 -O2 -I.. slottable_mt.c -o slottable_mt -lpthread
+//   ./slottable_mt [max_threads] [finds] [keys]
+//
+// Build it with -DSLOTTABLE_CTRL as well ('make bench' does, as slottable_mt-ctrl), since
+// readers probe control bytes differently from chains.
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "slottable_mt.h"
+
+#define RUN 256
+
+// How many keys behind the newest one the writer removes.
+#define LAG 64
+
+typedef struct {
+  uint32_t key;
+  uint32_t value;
+} Entry;
+
+#define entry_cmp(k, e) ((k) != (e)->key)
+
+static Ch_SlotTableMT shared;
+static Entry *locked;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t finds = 1000000, keys = 100000, writes = 1000000;
+static int stop, failed;
+static double worst;
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void
+note_worst(double t)
+{
+  pthread_mutex_lock(&lock);
+  if (t > worst)
+    worst = t;
+  pthread_mutex_unlock(&lock);
+}
+
+static void *
+read_mt(void *arg)
+{
+  int r = slottable_mt_reader(&shared);
+  uint32_t seed = (uint32_t)(uintptr_t)arg * 2654435761U + 1, bad = 0;
+  double slowest = 0;
+  for (uint32_t i = 0; i < finds; i += RUN) {
+    double t = now();
+    for (uint32_t j = 0; j < RUN; j++) {
+      Entry e;
+      uint32_t k = (seed = seed * 1664525U + 1013904223U) % keys;
+      if (!slottable_mt_find(&shared, r, Entry, slottable_u32_hash(k), entry_cmp, k, &e) ||
+          e.value != k * 3)
+        bad++;
+    }
+    if ((t = now() - t) > slowest)
+      slowest = t;
+  }
+  note_worst(slowest);
+  if (bad)
+    failed = 1;
+  return NULL;
+}
+
+static void *
+write_mt(void *arg)
+{
+  (void)arg;
+  for (uint32_t k = keys; k < keys + writes && !__atomic_load_n(&stop, __ATOMIC_RELAXED); k++)
+    slottable_mt_write(&shared, Entry, t, {
+      Entry *e = slottable_add(t, slottable_u32_hash(k), 0);
+      e->key = k;
+      e->value = k * 3;
+      if (k >= keys + LAG)
+        slottable_remove(t, slottable_u32_hash(k - LAG), entry_cmp, k - LAG);
+    });
+  return NULL;
+}
+
+static void *
+read_locked(void *arg)
+{
+  uint32_t seed = (uint32_t)(uintptr_t)arg * 2654435761U + 1, bad = 0;
+  double slowest = 0;
+  for (uint32_t i = 0; i < finds; i += RUN) {
+    double t = now();
+    for (uint32_t j = 0; j < RUN; j++) {
+      uint32_t k = (seed = seed * 1664525U + 1013904223U) % keys;
+      pthread_mutex_lock(&lock);
+      Entry *e = slottable_find(locked, slottable_u32_hash(k), entry_cmp, k);
+      if (!e || e->value != k * 3)
+        bad++;
+      pthread_mutex_unlock(&lock);
+    }
+    if ((t = now() - t) > slowest)
+      slowest = t;
+  }
+  note_worst(slowest);
+  if (bad)
+    failed = 1;
+  return NULL;
+}
+
+static void *
+write_locked(void *arg)
+{
+  (void)arg;
+  for (uint32_t k = keys; k < keys + writes && !__atomic_load_n(&stop, __ATOMIC_RELAXED); k++) {
+    pthread_mutex_lock(&lock);
+    Entry *e = slottable_add(locked, slottable_u32_hash(k), 0);
+    e->key = k;
+    e->value = k * 3;
+    if (k >= keys + LAG)
+      slottable_remove(locked, slottable_u32_hash(k - LAG), entry_cmp, k - LAG);
+    pthread_mutex_unlock(&lock);
+  }
+  return NULL;
+}
+
+//
+// Runs 'nthreads' readers beside one writer until the readers are done.
+// Returns: The time the readers took, in seconds.
+//
+static double
+timed(int nthreads, void *(*reader)(void *), void *(*writer)(void *))
+{
+  pthread_t t[nthreads], w;
+  double a;
+  stop = 0;
+  worst = 0;
+  a = now();
+  pthread_create(&w, NULL, writer, NULL);
+  for (int i = 0; i < nthreads; i++)
+    pthread_create(&t[i], NULL, reader, (void *)(uintptr_t)i);
+  for (int i = 0; i < nthreads; i++)
+    pthread_join(t[i], NULL);
+  a = now() - a;
+  __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+  pthread_join(w, NULL);
+  return a;
+}
+
+int
+main(int argc, char **argv)
+{
+  int max = argc > 1 ? atoi(argv[1]) : 16;
+  if (argc > 2)
+    finds = atoi(argv[2]);
+  if (argc > 3)
+    keys = atoi(argv[3]);
+  if (max > SLOTTABLE_MT_READERS)
+    max = SLOTTABLE_MT_READERS;
+
+  printf("%8s %16s %12s %16s %12s\n", "threads", "slottable_mt f/s", "worst us",
+    "mutex f/s", "worst us");
+  for (int n = 1; n <= max; n *= 2) {
+    double total = (double)finds * n, mt, mx, mt_worst;
+
+    slottable_mt_init(&shared);
+    slottable_mt_write_n(&shared, Entry, t, keys, {
+      for (uint32_t k = 0; k < keys; k++) {
+        Entry *e = slottable_add(t, slottable_u32_hash(k), 0);
+        e->key = k;
+        e->value = k * 3;
+      }
+    });
+    mt = timed(n, read_mt, write_mt);
+    mt_worst = worst;
+    slottable_mt_free(&shared);
+
+    locked = NULL;
+    for (uint32_t k = 0; k < keys; k++) {
+      Entry *e = slottable_add(locked, slottable_u32_hash(k), 0);
+      e->key = k;
+      e->value = k * 3;
+    }
+    mx = timed(n, read_locked, write_locked);
+    slottable_free(locked);
+
+    printf("%8d %16.0f %12.1f %16.0f %12.1f\n", n, total / mt, mt_worst * 1e6,
+      total / mx, worst * 1e6);
+  }
+  if (failed)
+    fprintf(stderr, "FAIL: a find missed or got the wrong item\n");
+  return failed;
+}
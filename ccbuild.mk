@@ -40,6 +40,43 @@
 #   	@mkdir -p $(OUTDIR)/source
 #   	@mkdir -p $(OUTDIR)/lib
 #
+# ** PROFILES **
+#
+# PROFILE sets how a non-debug build is optimized:
+#
+#   PROFILE=size     -Os (the default)
+#   PROFILE=speed    -O3
+#   PROFILE=native   -O3 -march=native (only for the machine it's built on)
+#   PROFILE=lto      -O3 -flto, linking with -flto too and archiving with gcc-ar
+#
+# A profile-guided build is done in two stages. 'make pgo-gen' builds PGO_BUILD (the
+# default target, if not set) with -fprofile-generate and runs PGO_TRAIN to write out
+# profiles into PGO_DIR. 'make pgo-use' then rebuilds with -fprofile-use. 'make pgo' does
+# both. For example, to train on the benchmark suite:
+#
+#   make pgo PROFILE=speed PGO_BUILD=$(OUTDIR)/bench/slotbench-16 \
+#     PGO_TRAIN="$(OUTDIR)/bench/slotbench-16 6 2"
+#
+# (With clang, merge the raw profiles in PGO_DIR with llvm-profdata before pgo-use.)
+#
+# Whatever flags are chosen show up in CFLAGS in the 'config' output.
+#
+# ** BENCHMARKS **
+#
+# 'make bench' builds every source in BENCH (bench/*.c, by default) into $(OUTDIR)/bench,
+# runs each one and keeps its output beside it, as <name>.out. The first one that exits
+# with an error (a failed check) stops the run and fails the target. Sources in BENCH_CXX
+# (bench/*.cc) are built the same way with $(CXX), as C++17.
+#
+# Sources listed in BENCH_SIZED are built once for each item size in BENCH_ITEM_SIZES
+# (passing -DITEM_SIZE=n and naming the binary <name>-n) and are run with BENCH_ARGS.
+# bench/slotbench.c is the suite for the slot containers; its output is CSV.
+#
+#   make bench BENCH_ARGS="8 2"
+#
+# Sources listed in BENCH_CTRL are also built with -DSLOTTABLE_CTRL, as <name>-ctrl, and
+# run along with the rest.
+#
 # This is all the documentation for now. This Makefile is quite brief - individual variables
 # and build tasks can be found below.
 #
@@ -110,11 +147,14 @@ endif
 TOOLCHAIN ?=
 AR ?= $(TOOLCHAIN)ar
 CC ?= $(TOOLCHAIN)gcc
+CXX ?= $(TOOLCHAIN)g++
 CACHESIZE ?= 16384
 DEBUG ?= 0
 ECHO = /bin/echo
 MAKE_S = $(MAKE) --no-print-directory -s
 MEMCHECK ?= 0
+PROFILE ?= size
+PGO ?=
 OPENGL ?= 0
 STRIP ?= $(TOOLCHAIN)strip -x
 
@@ -136,11 +176,27 @@ REVISION := $(shell git rev-list HEAD | wc -l | sed "s/ //g")
 COMMIT := $(shell git rev-list HEAD -1 --abbrev=7 --abbrev-commit)
 RELEASE ?= $(VERSION).$(REVISION)
 OUTDIR ?= build/$(TARGET)
+PGO_DIR ?= build/pgo-$(TARGET)
+PGO_BUILD ?=
+PGO_TRAIN ?= $(OUTDIR)/bin/$(OUTBIN)
 
 CFLAGS = -std=gnu99 -Wall -Wformat
 LDFLAGS = -L.
 LIBS ?= -lm
 
+BENCH_SIZED ?= $(wildcard bench/slotbench.c)
+BENCH ?= $(filter-out $(BENCH_SIZED),$(wildcard bench/*.c))
+BENCH_CXX ?= $(wildcard bench/*.cc)
+BENCH_CTRL ?= $(wildcard bench/slottable_mt.c)
+BENCH_ITEM_SIZES ?= 16 64
+BENCH_ARGS ?= 6 2
+BENCH_CFLAGS ?= -D_GNU_SOURCE -I.
+BENCH_LIBS ?= -lpthread -lm
+BENCH_BIN = $(patsubst bench/%.c,$(OUTDIR)/bench/%,$(BENCH)) \
+  $(patsubst bench/%.cc,$(OUTDIR)/bench/%,$(BENCH_CXX)) \
+  $(patsubst bench/%.c,$(OUTDIR)/bench/%-ctrl,$(BENCH_CTRL))
+BENCH_SIZED_BIN = $(foreach s,$(BENCH_ITEM_SIZES),$(patsubst bench/%.c,$(OUTDIR)/bench/%-$(s),$(BENCH_SIZED)))
+
 VALGRIND = valgrind --tool=memcheck --leak-check=full --show-reachable=yes --num-callers=20 --track-fds=yes
 MEMCHECK_CMD := $(shell $(ECHO) "$(MEMCHECK)" | sed "s/0//; s/1/$(VALGRIND)/")
 
@@ -190,10 +246,24 @@ endif
 
 ifeq ($(DEBUG), 1)
 	CFLAGS += -g -DDEBUG
+else ifeq ($(PROFILE), speed)
+	CFLAGS += -O3
+else ifeq ($(PROFILE), native)
+	CFLAGS += -O3 -march=native -mtune=native
+else ifeq ($(PROFILE), lto)
+	CFLAGS += -O3 -flto
+	LDFLAGS += -flto
+	AR = $(TOOLCHAIN)gcc-ar
 else
 	CFLAGS += -Os
 endif
 
+ifeq ($(PGO), gen)
+	CFLAGS += -fprofile-generate=$(abspath $(PGO_DIR)) -fprofile-update=atomic
+else ifeq ($(PGO), use)
+	CFLAGS += -fprofile-use=$(abspath $(PGO_DIR)) -fprofile-correction -Wno-missing-profile
+endif
+
 OUTLIB ?= lib$(NAME).a
 OUTBIN ?= $(NAME)
 OUTBINGLOB ?= $(OUTBIN)
@@ -233,6 +303,8 @@ config:
 	@$(ECHO) "#define $(DEFPREFIX)_CC        \"$(CC)\""
 	@$(ECHO) "#define $(DEFPREFIX)_CFLAGS    \"$(CFLAGS)\""
 	@$(ECHO) "#define $(DEFPREFIX)_DEBUG     $(DEBUG)"
+	@$(ECHO) "#define $(DEFPREFIX)_PROFILE   \"$(PROFILE)\""
+	@$(ECHO) "#define $(DEFPREFIX)_PGO       \"$(PGO)\""
 	@$(ECHO) "#define $(DEFPREFIX)_MAKE      \"$(MAKE)\""
 	@$(ECHO) "#define $(DEFPREFIX)_PREFIX    \"$(PREFIX)\""
 	@$(ECHO) "#define $(DEFPREFIX)_LIB       \"$(LIB)\""
@@ -318,6 +390,53 @@ $(OUTDIR)/lib/lib$(NAME)-ios.a: setup
 		cp -r platforms/$(PLATFORM)/include/* $(OUTDIR)/include; \
 	fi
 
+$(OUTDIR)/bench/%: bench/%.c
+	@mkdir -p $(OUTDIR)/bench
+	@$(ECHO) CC $<
+	@$(CC) $(CFLAGS) $(BENCH_CFLAGS) -o $@ $< $(BENCH_LIBS)
+
+$(OUTDIR)/bench/%: bench/%.cc
+	@mkdir -p $(OUTDIR)/bench
+	@$(ECHO) CXX $<
+	@$(CXX) $(filter-out -std=%,$(CFLAGS)) -std=gnu++17 $(BENCH_CFLAGS) -o $@ $< $(BENCH_LIBS)
+
+$(OUTDIR)/bench/%-ctrl: bench/%.c
+	@mkdir -p $(OUTDIR)/bench
+	@$(ECHO) CC $< "(SLOTTABLE_CTRL)"
+	@$(CC) $(CFLAGS) $(BENCH_CFLAGS) -DSLOTTABLE_CTRL -o $@ $< $(BENCH_LIBS)
+
+define BENCH_SIZED_RULE
+$(OUTDIR)/bench/%-$(1): bench/%.c
+	@mkdir -p $(OUTDIR)/bench
+	@$(ECHO) CC $$< "(ITEM_SIZE=$(1))"
+	@$(CC) $(CFLAGS) $(BENCH_CFLAGS) -DITEM_SIZE=$(1) -o $$@ $$< $(BENCH_LIBS)
+endef
+$(foreach s,$(BENCH_ITEM_SIZES),$(eval $(call BENCH_SIZED_RULE,$(s))))
+
+bench: $(BENCH_BIN) $(BENCH_SIZED_BIN)
+	@set -o pipefail; for b in $(BENCH_BIN); do \
+		$(ECHO) BENCH $$b; \
+		$$b | tee $$b.out || exit 1; \
+	done
+	@set -o pipefail; for b in $(BENCH_SIZED_BIN); do \
+		$(ECHO) BENCH $$b; \
+		$$b $(BENCH_ARGS) | tee $$b.out || exit 1; \
+	done
+
+pgo-gen:
+	@rm -rf $(OUTDIR) $(PGO_DIR)
+	@mkdir -p $(PGO_DIR)
+	@$(MAKE_S) PGO=gen $(PGO_BUILD)
+	@$(ECHO) TRAIN $(PGO_TRAIN)
+	@$(PGO_TRAIN) > /dev/null
+
+pgo-use:
+	@rm -rf $(OUTDIR)
+	@$(MAKE_S) PGO=use $(PGO_BUILD)
+
+pgo: pgo-gen
+	@$(MAKE_S) pgo-use
+
 todo:
 	@grep -rInso 'TODO: \(.\+\)' core include platforms test
 
@@ -338,4 +457,4 @@ clean:
 	@$(ECHO) cleaning
 	@rm -rf $(OUTDIR)
 
-.PHONY: clean cloc config todo version
+.PHONY: bench clean cloc config pgo pgo-gen pgo-use todo version
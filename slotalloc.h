@@ -0,0 +1,446 @@
+//
+// slotalloc.h
+//
+// A few allocators to hand to slotlist_init, slotdeque_init, slotmap_init, slotmap64_init,
+// slotpack_init and slottable_init. Each one embeds a Ch_SlotAlloc as 'alloc', so:
+//
+//   Ch_SlotArena arena;
+//   slotalloc_arena_init(&arena, 0);
+//
+//   Entity *ents;
+//   slotmap_init(ents, &arena.alloc);
+//   ...
+//   slotalloc_arena_reset(&arena);      // everything from the arena is gone at once
+//
+// * Ch_SlotArena: a bump allocator. Growing the newest allocation happens in place while
+//   the chunk has room. Nothing is given back until slotalloc_arena_reset or
+//   slotalloc_arena_free - so it's for containers that live and die together (one frame,
+//   one request.) There's no need to free the containers themselves.
+// * Ch_SlotPool: power-of-two size classes, each with its own freelist. Blocks freed by
+//   one container are handed to the next one that wants that size. Good for many small,
+//   short-lived containers of about the same size.
+// * Ch_SlotHuge: each block is its own mapping, rounded up to SLOTALLOC_HUGE_PAGE and
+//   marked for transparent huge pages. For a big table under random access, this cuts
+//   TLB misses. Growth uses mremap on Linux (with _GNU_SOURCE), so the pages aren't copied.
+// * Ch_SlotVM: gives each block its own range of reserved address space
+//   (SLOTALLOC_VM_RESERVE bytes, by default) and opens up pages at the start of it as the
+//   block grows. A block never moves, so growing copies nothing and pointers to elements
+//   stay good across adds. Shrinking (slotmap_trim, slotlist_trim) and freeing hand the
+//   pages back to the system. Growth past the reservation fails rather than moving the
+//   block. Any number of blocks can be out at once, so slotmap64 (a directory and its
+//   pages) and slottable (which builds the grown table beside the old one) work too - but
+//   each block takes a whole reservation, so for slotmap64's many pages, pick one to fit
+//   the directory rather than the default.
+//
+// None of these are thread-safe. Use one per thread (or lock around them.)
+//
+// LICENSE
+//
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+//
+#ifndef SLOTALLOC_H
+#define SLOTALLOC_H
+
+#include "slotbase.h"
+#include <string.h>
+
+// The default size of an arena chunk, in bytes. (Bigger allocations get a chunk to fit.)
+#ifndef SLOTALLOC_ARENA_CHUNK
+#define SLOTALLOC_ARENA_CHUNK   (1 << 20)
+#endif
+
+// The smallest and largest pool size classes, as powers of two. Bigger blocks go straight
+// to SLOT_REALLOC and SLOT_FREE.
+#ifndef SLOTALLOC_POOL_MIN
+#define SLOTALLOC_POOL_MIN      5
+#endif
+#ifndef SLOTALLOC_POOL_MAX
+#define SLOTALLOC_POOL_MAX      24
+#endif
+
+// The size that huge-page mappings are rounded up to.
+#ifndef SLOTALLOC_HUGE_PAGE
+#define SLOTALLOC_HUGE_PAGE     (2 << 20)
+#endif
+
+// The default amount of address space for a Ch_SlotVM to reserve for each block, in
+// bytes. Only what's used is ever backed by memory.
+#ifndef SLOTALLOC_VM_RESERVE
+#define SLOTALLOC_VM_RESERVE    ((size_t)1 << 34)
+#endif
+
+// Every block starts with a 16-byte header (so that the block itself is 16-byte aligned.)
+#define SLOTALLOC__HDR          16
+#define slotalloc__size(p)      (((size_t *)(p))[-2])
+#define slotalloc__round(n,d)   (((n) + (d) - 1) & ~(size_t)((d) - 1))
+
+typedef struct Ch_SlotArenaChunk {
+  struct Ch_SlotArenaChunk *next;
+  size_t size, used;
+  size_t pad;
+  uint8_t data[];
+} Ch_SlotArenaChunk;
+
+typedef struct {
+  Ch_SlotAlloc alloc;
+  Ch_SlotArenaChunk *chunk;          // the newest chunk, linked to the older ones
+  size_t chunksize;
+  void *last;                        // the newest allocation, which can grow in place
+} Ch_SlotArena;
+
+typedef struct {
+  Ch_SlotAlloc alloc;
+  void *freelist[SLOTALLOC_POOL_MAX + 1];
+} Ch_SlotPool;
+
+typedef struct {
+  Ch_SlotAlloc alloc;
+} Ch_SlotHuge;
+
+typedef struct {
+  Ch_SlotAlloc alloc;
+  uint8_t *spare;                    // a reservation that no block has yet
+  size_t reserved;                   // the size of each block's reservation
+  size_t page;
+} Ch_SlotVM;
+
+//
+// arena
+//
+static inline void *
+slotalloc__arena_realloc(void *ctx, void *p, size_t n)
+{
+  Ch_SlotArena *arena = (Ch_SlotArena *)ctx;
+  Ch_SlotArenaChunk *c = arena->chunk;
+  size_t need = slotalloc__round(n, SLOTALLOC__HDR);
+  uint8_t *q;
+
+  //
+  // The newest allocation can just take more of its chunk.
+  //
+  if (p && p == arena->last) {
+    size_t at = (uint8_t *)p - c->data;
+    if (at + need <= c->size) {
+      c->used = at + need;
+      slotalloc__size(p) = n;
+      return p;
+    }
+  }
+
+  //
+  // Otherwise, bump - starting a new chunk if this one is full.
+  //
+  if (!c || c->used + SLOTALLOC__HDR + need > c->size) {
+    size_t size = arena->chunksize;
+    if (size < SLOTALLOC__HDR + need)
+      size = SLOTALLOC__HDR + need;
+    Ch_SlotArenaChunk *nc = (Ch_SlotArenaChunk *)SLOT_REALLOC(NULL, sizeof(Ch_SlotArenaChunk) + size);
+    if (!nc)
+      return NULL;
+    nc->next = c;
+    nc->size = size;
+    nc->used = 0;
+    arena->chunk = c = nc;
+  }
+  q = c->data + c->used + SLOTALLOC__HDR;
+  c->used += SLOTALLOC__HDR + need;
+  slotalloc__size(q) = n;
+  if (p)
+    memcpy(q, p, slotalloc__size(p) < n ? slotalloc__size(p) : n);
+  return arena->last = q;
+}
+
+static inline void
+slotalloc__arena_free(void *ctx, void *p)
+{
+  (void)ctx;
+  (void)p;
+}
+
+// Set up the arena 'arena' to allocate in chunks of 'chunksize' bytes (or
+// SLOTALLOC_ARENA_CHUNK, if zero.)
+static inline void
+slotalloc_arena_init(Ch_SlotArena *arena, size_t chunksize)
+{
+  arena->alloc = (Ch_SlotAlloc){slotalloc__arena_realloc, slotalloc__arena_free, arena};
+  arena->chunk = NULL;
+  arena->chunksize = chunksize ? chunksize : SLOTALLOC_ARENA_CHUNK;
+  arena->last = NULL;
+}
+
+// Throw away everything allocated from 'arena', keeping its newest chunk for reuse.
+static inline void
+slotalloc_arena_reset(Ch_SlotArena *arena)
+{
+  Ch_SlotArenaChunk *c = arena->chunk;
+  if (c) {
+    while (c->next) {
+      Ch_SlotArenaChunk *old = c->next;
+      c->next = old->next;
+      SLOT_FREE(old);
+    }
+    c->used = 0;
+  }
+  arena->last = NULL;
+}
+
+// Free all of the memory held by 'arena'.
+static inline void
+slotalloc_arena_free(Ch_SlotArena *arena)
+{
+  while (arena->chunk) {
+    Ch_SlotArenaChunk *c = arena->chunk;
+    arena->chunk = c->next;
+    SLOT_FREE(c);
+  }
+  arena->last = NULL;
+}
+
+//
+// pool
+//
+// The header keeps the size class (past SLOTALLOC_POOL_MAX for a big block) and the usable size.
+//
+static inline unsigned
+slotalloc__pool_class(size_t n)
+{
+  unsigned k = SLOTALLOC_POOL_MIN;
+  n += SLOTALLOC__HDR;
+  while (k <= SLOTALLOC_POOL_MAX && ((size_t)1 << k) < n)
+    k++;
+  return k;
+}
+
+static inline void *
+slotalloc__pool_realloc(void *ctx, void *p, size_t n)
+{
+  Ch_SlotPool *pool = (Ch_SlotPool *)ctx;
+  unsigned k = slotalloc__pool_class(n), old = 0;
+  uint8_t *q;
+
+  if (p) {
+    old = slotalloc__size(p);
+    if (old <= SLOTALLOC_POOL_MAX && k == old)
+      return p;
+    if (old > SLOTALLOC_POOL_MAX && k > SLOTALLOC_POOL_MAX) {
+      q = (uint8_t *)SLOT_REALLOC((uint8_t *)p - SLOTALLOC__HDR, n + SLOTALLOC__HDR);
+      if (!q)
+        return NULL;
+      q += SLOTALLOC__HDR;
+      slotalloc__size(q) = k;
+      ((size_t *)q)[-1] = n;
+      return q;
+    }
+  }
+
+  if (k <= SLOTALLOC_POOL_MAX && pool->freelist[k]) {
+    q = (uint8_t *)pool->freelist[k];
+    pool->freelist[k] = *(void **)q;
+  } else {
+    q = (uint8_t *)SLOT_REALLOC(NULL,
+      k <= SLOTALLOC_POOL_MAX ? (size_t)1 << k : n + SLOTALLOC__HDR);
+    if (!q)
+      return NULL;
+    q += SLOTALLOC__HDR;
+  }
+  slotalloc__size(q) = k;
+  ((size_t *)q)[-1] = k <= SLOTALLOC_POOL_MAX ? ((size_t)1 << k) - SLOTALLOC__HDR : n;
+
+  if (p) {
+    size_t have = ((size_t *)p)[-1];
+    memcpy(q, p, have < n ? have : n);
+    pool->alloc.free(pool, p);
+  }
+  return q;
+}
+
+static inline void
+slotalloc__pool_free(void *ctx, void *p)
+{
+  Ch_SlotPool *pool = (Ch_SlotPool *)ctx;
+  size_t k = slotalloc__size(p);
+  if (k > SLOTALLOC_POOL_MAX) {
+    SLOT_FREE((uint8_t *)p - SLOTALLOC__HDR);
+  } else {
+    *(void **)p = pool->freelist[k];
+    pool->freelist[k] = p;
+  }
+}
+
+// Set up the pool 'pool'.
+static inline void
+slotalloc_pool_init(Ch_SlotPool *pool)
+{
+  memset(pool, 0, sizeof(Ch_SlotPool));
+  pool->alloc = (Ch_SlotAlloc){slotalloc__pool_realloc, slotalloc__pool_free, pool};
+}
+
+// Free the blocks sitting in the freelists of 'pool'. (Free the containers first.)
+static inline void
+slotalloc_pool_free(Ch_SlotPool *pool)
+{
+  unsigned k;
+  for (k = 0; k <= SLOTALLOC_POOL_MAX; k++) {
+    while (pool->freelist[k]) {
+      uint8_t *q = (uint8_t *)pool->freelist[k];
+      pool->freelist[k] = *(void **)q;
+      SLOT_FREE(q - SLOTALLOC__HDR);
+    }
+  }
+}
+
+//
+// huge pages
+//
+// The header keeps the length of the mapping.
+//
+#include <sys/mman.h>
+
+static inline void *
+slotalloc__huge_realloc(void *ctx, void *p, size_t n)
+{
+  size_t len = slotalloc__round(n + SLOTALLOC__HDR, SLOTALLOC_HUGE_PAGE), old = 0;
+  uint8_t *m = NULL;
+  (void)ctx;
+
+  if (p) {
+    old = slotalloc__size(p);
+    if (len == old)
+      return p;
+#ifdef MREMAP_MAYMOVE
+    m = (uint8_t *)mremap((uint8_t *)p - SLOTALLOC__HDR, old, len, MREMAP_MAYMOVE);
+    if (m == MAP_FAILED)
+      return NULL;
+#endif
+  }
+  if (!m) {
+    m = (uint8_t *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED)
+      return NULL;
+    if (p) {
+      memcpy(m + SLOTALLOC__HDR, p, (old < len ? old : len) - SLOTALLOC__HDR);
+      munmap((uint8_t *)p - SLOTALLOC__HDR, old);
+    }
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(m, len, MADV_HUGEPAGE);
+#endif
+  m += SLOTALLOC__HDR;
+  slotalloc__size(m) = len;
+  return m;
+}
+
+static inline void
+slotalloc__huge_free(void *ctx, void *p)
+{
+  (void)ctx;
+  munmap((uint8_t *)p - SLOTALLOC__HDR, slotalloc__size(p));
+}
+
+// Set up the huge-page allocator 'huge'. (It holds no memory itself, so there's nothing to free.)
+static inline void
+slotalloc_huge_init(Ch_SlotHuge *huge)
+{
+  huge->alloc = (Ch_SlotAlloc){slotalloc__huge_realloc, slotalloc__huge_free, huge};
+}
+
+//
+// reserved virtual memory
+//
+// Each block sits SLOTALLOC__HDR bytes into its own reservation, which is mapped
+// PROT_NONE; the header keeps how many bytes of it (header included) are open. Growing
+// opens up pages with mprotect; shrinking drops them with MADV_DONTNEED and closes them
+// again, so that a stray pointer past the end faults instead of reading zeroes.
+//
+#include <unistd.h>
+
+static inline uint8_t *
+slotalloc__vm_reserve(Ch_SlotVM *vm)
+{
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  uint8_t *m = vm->spare;
+#ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE;
+#endif
+  if (m) {
+    vm->spare = NULL;
+    return m;
+  }
+  m = (uint8_t *)mmap(NULL, vm->reserved, PROT_NONE, flags, -1, 0);
+  return m == MAP_FAILED ? NULL : m;
+}
+
+static inline void
+slotalloc__vm_release(uint8_t *m, size_t committed, size_t keep)
+{
+  if (keep < committed) {
+#ifdef MADV_DONTNEED
+    madvise(m + keep, committed - keep, MADV_DONTNEED);
+#endif
+    mprotect(m + keep, committed - keep, PROT_NONE);
+  }
+}
+
+static inline void *
+slotalloc__vm_realloc(void *ctx, void *p, size_t n)
+{
+  Ch_SlotVM *vm = (Ch_SlotVM *)ctx;
+  size_t len = slotalloc__round(n + SLOTALLOC__HDR, vm->page), committed = 0;
+  uint8_t *m;
+
+  if (len > vm->reserved)
+    return NULL;
+  if (p) {
+    m = (uint8_t *)p - SLOTALLOC__HDR;
+    committed = slotalloc__size(p);
+  } else if (!(m = slotalloc__vm_reserve(vm))) {
+    return NULL;
+  }
+  if (len > committed) {
+    if (mprotect(m + committed, len - committed, PROT_READ | PROT_WRITE)) {
+      if (!p)
+        munmap(m, vm->reserved);
+      return NULL;
+    }
+  } else {
+    slotalloc__vm_release(m, committed, len);
+  }
+  m += SLOTALLOC__HDR;
+  slotalloc__size(m) = len;
+  return m;
+}
+
+static inline void
+slotalloc__vm_free(void *ctx, void *p)
+{
+  Ch_SlotVM *vm = (Ch_SlotVM *)ctx;
+  munmap((uint8_t *)p - SLOTALLOC__HDR, vm->reserved);
+}
+
+// Set up 'vm' to reserve 'reserve' bytes of address space (or SLOTALLOC_VM_RESERVE, if
+// zero) for each block. Nothing is backed by memory until it's used.
+// Returns: 1 if the space could be reserved, 0 if not.
+static inline int
+slotalloc_vm_init(Ch_SlotVM *vm, size_t reserve)
+{
+  memset(vm, 0, sizeof(Ch_SlotVM));
+  vm->alloc = (Ch_SlotAlloc){slotalloc__vm_realloc, slotalloc__vm_free, vm};
+  vm->page = (size_t)sysconf(_SC_PAGESIZE);
+  vm->reserved = slotalloc__round(reserve ? reserve : SLOTALLOC_VM_RESERVE, vm->page);
+  vm->spare = slotalloc__vm_reserve(vm);
+  return vm->spare != NULL;
+}
+
+// Give back the spare reservation of 'vm'. (Blocks are given back as they're freed, so
+// free the containers too.)
+static inline void
+slotalloc_vm_free(Ch_SlotVM *vm)
+{
+  if (vm->spare)
+    munmap(vm->spare, vm->reserved);
+  vm->spare = NULL;
+}
+
+#endif
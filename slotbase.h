@@ -13,6 +13,10 @@
 #ifndef SLOTBASE_H
 #define SLOTBASE_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
 #define SLOT_DIV_ALIGN(n, d)   ((((n) - 1) / (d)) + 1)
 #define SLOT_ALIGN(n, d)       (((n) + (d)) & ~((d) - 1))
 
@@ -21,6 +25,27 @@
 #define SLOT_REALLOC(p, n) realloc(p, n)
 #endif
 
+// The free function to use (to match SLOT_REALLOC.)
+#ifndef SLOT_FREE
+#define SLOT_FREE(p) free(p)
+#endif
+
+// An allocator for a single list, map or table, in place of SLOT_REALLOC and SLOT_FREE.
+// Pass one to slotlist_init, slotdeque_init, slotmap_init, slotmap64_init, slotpack_init
+// or slottable_init and that container will get all of its memory from it. (See
+// slotalloc.h for some.)
+// 'ctx' is handed back to both functions.
+typedef struct Ch_SlotAlloc {
+  void *(*realloc)(void *ctx, void *p, size_t n);
+  void (*free)(void *ctx, void *p);
+  void *ctx;
+} Ch_SlotAlloc;
+
+#define SLOT_ALLOC_REALLOC(al, p, n) \
+  ((al) ? (al)->realloc((al)->ctx, p, n) : SLOT_REALLOC(p, n))
+#define SLOT_ALLOC_FREE(al, p) \
+  ((al) ? (al)->free((al)->ctx, p) : SLOT_FREE(p))
+
 // The standard growth pattern for slot lists and slot maps. So, for example,
 // this means "start with space for 10 items, then allocate enough for 100, etc."
 // The needed 'n' entries IS entries - not bytes.
@@ -47,4 +72,71 @@
 // IDs in slot lists and slot maps are 32-bit unsigned integers.
 typedef uint32_t SLOT_ID;
 
+// STATISTICS
+//
+// Define SLOT_STATS to have slot lists, slot maps and slot tables count what they do in
+// the global 'slot_stats' - growth, freelist use, rehashes and how far finds have to look.
+// slot_stats_dump prints them (and slottable_stats_dump looks over a single table.)
+// Without SLOT_STATS, none of this is compiled in.
+//
+// Define SLOT_USDT (with <sys/sdt.h> around) to also get static tracepoints that perf,
+// bpftrace or SystemTap can attach to: chelp:grow (old bytes, new bytes), chelp:rehash
+// (old slots, new slots) and chelp:compact (used, live.)
+#ifdef SLOT_STATS
+#include <stdio.h>
+
+// The number of buckets in the find histogram. Longer finds go in the last one.
+#ifndef SLOT_STATS_PROBES
+#define SLOT_STATS_PROBES 16
+#endif
+
+typedef struct {
+  uint64_t grows;                    // blocks reallocated to make room (or trimmed)
+  uint64_t grow_bytes;               // bytes in those blocks before growing (at most copied)
+  uint64_t freelist_hits;            // adds that reused a removed slot
+  uint64_t freelist_misses;          // adds that took a fresh slot from the end
+  uint64_t rehashes;                 // slot table indexes rebuilt
+  uint64_t rehash_bytes;             // bytes of items copied by slot table growth
+  uint64_t compacts;                 // slot tables squeezed of holes
+  uint64_t finds, find_misses;
+  uint64_t probes[SLOT_STATS_PROBES]; // finds by items (or groups) visited past the first
+} Ch_SlotStats;
+
+// One for the whole program, no matter how many files include this.
+__attribute__((weak)) Ch_SlotStats slot_stats;
+
+#define SLOT_STAT(field, n)  __atomic_fetch_add(&slot_stats.field, (n), __ATOMIC_RELAXED)
+
+// Print the counters in 'slot_stats' to the FILE 'f'.
+static inline void
+slot_stats_dump(FILE *f)
+{
+  Ch_SlotStats s = slot_stats;
+  uint64_t adds = s.freelist_hits + s.freelist_misses;
+  fprintf(f, "grows %llu (%llu bytes)\n", (unsigned long long)s.grows,
+    (unsigned long long)s.grow_bytes);
+  fprintf(f, "freelist %llu hits / %llu misses (%.1f%%)\n", (unsigned long long)s.freelist_hits,
+    (unsigned long long)s.freelist_misses, adds ? 100.0 * s.freelist_hits / adds : 0.0);
+  fprintf(f, "rehashes %llu (%llu bytes), compacts %llu\n", (unsigned long long)s.rehashes,
+    (unsigned long long)s.rehash_bytes, (unsigned long long)s.compacts);
+  fprintf(f, "finds %llu (%llu missed), probes:", (unsigned long long)s.finds,
+    (unsigned long long)s.find_misses);
+  for (int i = 0; i < SLOT_STATS_PROBES; i++)
+    fprintf(f, " %llu", (unsigned long long)s.probes[i]);
+  fprintf(f, "\n");
+}
+#else
+#define SLOT_STAT(field, n)  ((void)(n))
+#endif
+
+#if defined(SLOT_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SLOT_TRACE(name, a, b) DTRACE_PROBE2(chelp, name, a, b)
+#endif
+#endif
+#ifndef SLOT_TRACE
+#define SLOT_TRACE(name, a, b) ((void)(a), (void)(b))
+#endif
+
 #endif
@@ -0,0 +1,664 @@
+//
+// slotcpp.h
+//
+// C++17 templates over the slot containers: SlotList<T>, SlotMap<T> and
+// SlotTable<K, V, Hash, Eq>. Each one owns the very same block that slotlist.h, slotmap.h
+// or slottable.h would build - raw() hands back the pointer that the C macros take - but
+// the item size is a template constant, items can have constructors and destructors, and
+// range-for only visits live items.
+//
+//   chelp::SlotMap<std::string> names;
+//   SLOT_ID id = names.emplace("alice");
+//   for (std::string &s : names)
+//     puts(s.c_str());
+//   names.remove(id);
+//
+//   chelp::SlotTable<uint32_t, double> prices;
+//   *prices.emplace(12) = 1.5;
+//   double *p = prices.find(12);
+//
+// Types that are std::is_trivially_copyable take the same paths as the C macros: blocks
+// grow with realloc and items are copied with memcpy. Other types are moved across to a
+// fresh block one at a time and destroyed on the way out. (So a SlotMap of one of those
+// can't be trimmed, and a SlotTable of one squeezes out its holes as it grows.)
+//
+// Errors are handled as in C. A failed allocation gives back NULL or SLOT_NONE_ID -
+// nothing here throws, apart from the items' own constructors. Containers are move-only,
+// and an item passed to emplace mustn't live in the container it's being added to, since
+// the block may move first.
+//
+// A SlotMap item can carry its own 'uint32_t version' (or 'uint32_t version : 8') as its
+// first field, just as it would for slotmap.h, and then the slot is the item itself.
+// Otherwise a version is put in front of each item.
+//
+// The SlotMap iterator keeps its own copy of the live bitmap (unless SLOTMAP_BITMAP is
+// defined), so it can't be copied - it's meant for range-for. Removing the current item
+// in the loop is fine; adding isn't.
+//
+// LICENSE
+//
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+//
+#ifndef SLOTCPP_H
+#define SLOTCPP_H
+
+#include "slotlist.h"
+#include "slotmap.h"
+#include "slottable.h"
+#include <functional>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace chelp {
+
+//
+// SlotList<T> - a growable array, on a slotlist block.
+//
+template <typename T>
+class SlotList {
+  static_assert(alignof(T) <= 16, "SlotList items can't be aligned past 16 bytes");
+  static constexpr bool trivial = std::is_trivially_copyable<T>::value;
+
+  T *a_ = nullptr;
+
+  //
+  // Makes room for 'n' more items.
+  // Returns: false if the block couldn't be grown.
+  //
+  bool grow(SLOT_ID n)
+  {
+    if (!slotlist__sbneedgrow(a_, n))
+      return true;
+    if (trivial || !a_) {
+      T *p = (T *)slotlist__sbgrowf(a_, n, sizeof(T));
+      if (p)
+        a_ = p;
+      return p != nullptr;
+    }
+
+    T *p = nullptr, *q;
+    if (!slotlist__init((void **)&p, sizeof(T), slotlist__sbal(a_)))
+      return false;
+    if (!(q = (T *)slotlist__sbgrowf(p, slotlist__sbn(a_) + n, sizeof(T)))) {
+      slotlist_free(p);
+      return false;
+    }
+    T *from = slotlist_array(a_), *to = slotlist_array(q);
+    for (SLOT_ID i = 0; i < slotlist__sbn(a_); i++) {
+      new (to + i) T(std::move(from[i]));
+      from[i].~T();
+    }
+    slotlist__sbn(q) = slotlist__sbn(a_);
+    slotlist_free(a_);
+    a_ = q;
+    return true;
+  }
+
+public:
+  SlotList() = default;
+
+  // An empty list that gets all of its memory from the Ch_SlotAlloc 'al'.
+  explicit SlotList(Ch_SlotAlloc *al) { slotlist__init((void **)&a_, sizeof(T), al); }
+
+  SlotList(const SlotList &) = delete;
+  SlotList &operator=(const SlotList &) = delete;
+  SlotList(SlotList &&o) noexcept : a_(o.a_) { o.a_ = nullptr; }
+  SlotList &operator=(SlotList &&o) noexcept
+  {
+    std::swap(a_, o.a_);
+    return *this;
+  }
+  ~SlotList()
+  {
+    clear();
+    slotlist_free(a_);
+  }
+
+  SLOT_ID size() const { return slotlist_count(a_); }
+  SLOT_ID capacity() const { return slotlist_allocated(a_); }
+  bool empty() const { return size() == 0; }
+
+  T *data() { return a_ ? slotlist_array(a_) : nullptr; }
+  const T *data() const { return a_ ? slotlist_array(a_) : nullptr; }
+  T &operator[](SLOT_ID i) { return data()[i]; }
+  const T &operator[](SLOT_ID i) const { return data()[i]; }
+  T &back() { return data()[size() - 1]; }
+
+  T *begin() { return data(); }
+  T *end() { return data() + size(); }
+  const T *begin() const { return data(); }
+  const T *end() const { return data() + size(); }
+
+  // Make room for 'n' items in all, so that adds up to there won't grow the list.
+  // Returns: false if the list couldn't be grown.
+  bool reserve(SLOT_ID n) { return n <= size() || grow(n - size()); }
+
+  // Construct a new item at the end of the list from 'args'.
+  // Returns: A pointer to the new item or NULL if the list couldn't be grown.
+  template <typename... A>
+  T *emplace_back(A &&...args)
+  {
+    if (!grow(1))
+      return nullptr;
+    T *p = new (slotlist_array(a_) + slotlist__sbn(a_)) T(std::forward<A>(args)...);
+    slotlist__sbn(a_)++;
+    return p;
+  }
+
+  T *push_back(const T &v) { return emplace_back(v); }
+  T *push_back(T &&v) { return emplace_back(std::move(v)); }
+
+  void pop_back()
+  {
+    if constexpr (!trivial)
+      back().~T();
+    slotlist__sbn(a_)--;
+  }
+
+  // Empty the list, keeping its allocation.
+  void clear()
+  {
+    if constexpr (!trivial)
+      for (T &v : *this)
+        v.~T();
+    slotlist_clear(a_);
+  }
+
+  // The slotlist block, for use with the slotlist macros.
+  T *raw() { return a_; }
+};
+
+//
+// The slot for a SlotMap item. An item that starts with its own version is its own slot;
+// any other item gets one put in front of it.
+//
+template <typename T, typename = void>
+struct SlotMapSlot {
+  struct type {
+    uint32_t version;
+    T value;
+  };
+  static T *value(type *s) { return &s->value; }
+};
+
+template <typename T>
+struct SlotMapSlot<T, std::void_t<decltype(std::declval<T &>().version)>> {
+  typedef T type;
+  static T *value(type *s) { return s; }
+};
+
+//
+// SlotMap<T> - items addressed by versioned SLOT_IDs, on a slotmap block.
+//
+template <typename T>
+class SlotMap {
+  typedef SlotMapSlot<T> S;
+  typedef typename S::type Slot;
+  static_assert(alignof(Slot) <= 16, "SlotMap items can't be aligned past 16 bytes");
+  static constexpr bool trivial = std::is_trivially_copyable<T>::value;
+
+  Slot *a_ = nullptr;
+
+  Slot *slot(SLOT_ID id) const
+  {
+    Slot *a = a_;
+    return slotmap_at(a, id);
+  }
+
+  //
+  // Moves everything over to a new block with room for 'n' slots. Free slots keep their
+  // place in the freelist, so IDs don't change.
+  // Returns: false if the new block couldn't be allocated.
+  //
+  bool relocate(SLOT_ID n)
+  {
+    Slot *p = nullptr;
+    uint64_t *live;
+    if (!slotmap__init((uint8_t **)&p, sizeof(Slot), slotmap__al(a_)))
+      return false;
+    if (!slotmap__resize((uint8_t **)&p, sizeof(Slot), n) ||
+        !(live = slotmap__live((uint8_t *)a_, sizeof(Slot)))) {
+      slotmap_free(p);
+      return false;
+    }
+
+    SLOT_ID used = slotmap__use(a_);
+    Slot *from = slotmap_array(a_), *to = slotmap_array(p);
+    memcpy((SLOT_ID *)p + 1, (SLOT_ID *)a_ + 1, 4 * sizeof(SLOT_ID));
+    for (SLOT_ID i = 0; i < used; i++) {
+      memcpy((void *)(to + i), (void *)(from + i), sizeof(SLOT_ID));
+      if ((live[i / 64] >> (i % 64)) & 1) {
+        new (S::value(to + i)) T(std::move(*S::value(from + i)));
+        S::value(from + i)->~T();
+      }
+    }
+#ifdef SLOTMAP_BITMAP
+    memcpy(slotmap__bits(p, sizeof(Slot)), live, ((used + 63) / 64) * sizeof(uint64_t));
+#endif
+    slotmap__live_done(a_, live);
+    slotmap_free(a_);
+    a_ = p;
+    return true;
+  }
+
+public:
+  struct Sentinel {};
+
+  template <typename U>
+  class Iterator {
+    Slot *map_, *items_;
+    uint64_t *live_;
+    SLOT_ID n_, w_ = 0;
+    uint64_t bits_ = 0;
+    Slot *cur_ = nullptr;
+
+  public:
+    explicit Iterator(Slot *a) : map_(a), items_(a ? slotmap_array(a) : nullptr),
+      live_(a ? slotmap__live((uint8_t *)a, sizeof(Slot)) : nullptr),
+      n_(live_ ? (slotmap__use(a) + 63) / 64 : 0) { ++*this; }
+    Iterator(const Iterator &) = delete;
+    Iterator(Iterator &&o) noexcept : map_(o.map_), items_(o.items_), live_(o.live_),
+      n_(o.n_), w_(o.w_), bits_(o.bits_), cur_(o.cur_) { o.live_ = nullptr; }
+    ~Iterator()
+    {
+      if (live_)
+        slotmap__live_done(map_, live_);
+    }
+
+    U &operator*() const { return *S::value(cur_); }
+    U *operator->() const { return S::value(cur_); }
+    bool operator!=(Sentinel) const { return cur_ != nullptr; }
+
+    // The SLOT_ID of the current item.
+    SLOT_ID id() const { return slotmap__id(cur_ - items_, cur_->version); }
+
+    Iterator &operator++()
+    {
+      if (!bits_) {
+        if ((w_ = slotmap__next_word(live_, w_, n_)) >= n_) {
+          cur_ = nullptr;
+          return *this;
+        }
+        bits_ = live_[w_++];
+      }
+      cur_ = items_ + ((w_ - 1) * 64 + __builtin_ctzll(bits_));
+      bits_ &= bits_ - 1;
+      return *this;
+    }
+  };
+
+  SlotMap() = default;
+
+  // An empty map that gets all of its memory from the Ch_SlotAlloc 'al'.
+  explicit SlotMap(Ch_SlotAlloc *al) { slotmap__init((uint8_t **)&a_, sizeof(Slot), al); }
+
+  SlotMap(const SlotMap &) = delete;
+  SlotMap &operator=(const SlotMap &) = delete;
+  SlotMap(SlotMap &&o) noexcept : a_(o.a_) { o.a_ = nullptr; }
+  SlotMap &operator=(SlotMap &&o) noexcept
+  {
+    std::swap(a_, o.a_);
+    return *this;
+  }
+  ~SlotMap()
+  {
+    if constexpr (!trivial)
+      for (T &v : *this)
+        v.~T();
+    slotmap_free(a_);
+  }
+
+  SLOT_ID size() const { return slotmap_count(a_); }
+  SLOT_ID used() const { return slotmap_used(a_); }
+  SLOT_ID capacity() const { return slotmap_allocated(a_); }
+  bool empty() const { return size() == 0; }
+
+  Iterator<T> begin() { return Iterator<T>(a_); }
+  Iterator<const T> begin() const { return Iterator<const T>(a_); }
+  Sentinel end() const { return Sentinel(); }
+
+  // Make room for 'n' more items, so that the next 'n' emplaces won't grow the map.
+  // Returns: false if the map couldn't be grown.
+  bool reserve(SLOT_ID n)
+  {
+    if (trivial || !a_)
+      return slotmap__reserve((uint8_t **)&a_, sizeof(Slot), n);
+    SLOT_ID frc = slotmap__frc(a_), siz = slotmap__siz(a_), grow = siz;
+    uint64_t need = slotmap__use(a_) + (n > frc ? n - frc : 0);
+    if (need > SLOTMAP_MAX_ID)
+      return false;
+    if (need <= siz)
+      return true;
+    while (grow < need)
+      grow = SLOT_FLEX_SIZE(grow);
+    return relocate(grow);
+  }
+
+  // Construct a new item from 'args'.
+  // Returns: The SLOT_ID of the new item or SLOT_NONE_ID if the map is full.
+  template <typename... A>
+  SLOT_ID emplace(A &&...args)
+  {
+    SLOT_ID id;
+    if constexpr (!trivial)
+      if (a_ && slotmap_index(slotmap__frl(a_)) == SLOTMAP_MAX_ID &&
+          slotmap__use(a_) == slotmap__siz(a_) &&
+          !relocate(SLOT_FLEX_SIZE(slotmap__siz(a_))))
+        return SLOT_NONE_ID;
+    //
+    // Taking the next slot off the end is done here, so that the ID stays in a register;
+    // anything else (the freelist, growing) goes through slotmap__make.
+    //
+    Slot *s;
+    if (a_ && slotmap_index(slotmap__frl(a_)) == SLOTMAP_MAX_ID &&
+        slotmap__use(a_) < slotmap__siz(a_)) {
+      SLOT_ID x = slotmap__use(a_)++;
+      SLOT_STAT(freelist_misses, 1);
+      id = slotmap__id(x, slotmap__gen(a_));
+      slotmap__set_live(a_, sizeof(Slot), x);
+      s = slotmap_array(a_) + x;
+    } else {
+      s = (Slot *)slotmap__make((uint8_t **)&a_, sizeof(Slot), &id);
+    }
+    if (!s)
+      return SLOT_NONE_ID;
+    new (S::value(s)) T(std::forward<A>(args)...);
+    s->version = id >> 24;
+    return id;
+  }
+
+  // Returns: A pointer to the item with SLOT_ID 'id' or NULL if it isn't there.
+  T *at(SLOT_ID id)
+  {
+    Slot *s = slot(id);
+    return s ? S::value(s) : nullptr;
+  }
+  const T *at(SLOT_ID id) const { return const_cast<SlotMap *>(this)->at(id); }
+
+  // Returns: The SLOT_ID of the item at 'v', which must be in this map.
+  SLOT_ID id_of(const T *v) const
+  {
+    Slot *items = slotmap_array(a_);
+    SLOT_ID i = ((const char *)v - (const char *)S::value(items)) / sizeof(Slot);
+    return slotmap__id(i, items[i].version);
+  }
+
+  // Destroy the item with SLOT_ID 'id'.
+  // Returns: false if it wasn't there.
+  bool remove(SLOT_ID id)
+  {
+    Slot *s = slot(id);
+    if (!s)
+      return false;
+    if constexpr (!trivial)
+      S::value(s)->~T();
+    SLOTMAP_FREE f;
+    f.version = s->version + 1;
+    f.next_free = slotmap__frl(a_);
+    memcpy((void *)s, &f, sizeof(f));
+    slotmap__frl(a_) = slotmap_index(id);
+    slotmap__frc(a_)++;
+    slotmap__set_dead(a_, sizeof(Slot), slotmap_index(id));
+    if constexpr (trivial)
+      slotmap__autotrim(a_, id);
+    return true;
+  }
+
+  // Give back the free slots at the end of the map (see slotmap_trim.)
+  // Returns: The number of slots released.
+  SLOT_ID trim()
+  {
+    static_assert(trivial, "only trivially copyable items can be trimmed");
+    return slotmap_trim(a_);
+  }
+
+  // The slotmap block, for use with the slotmap macros.
+  Slot *raw() { return a_; }
+};
+
+//
+// The hash used by SlotTable unless another is given: the integer mixers for numbers,
+// slottable_strn_fasthash for strings and std::hash (mixed again) for anything else.
+//
+template <typename K>
+struct SlotHash {
+  uint32_t operator()(const K &k) const
+  {
+    if constexpr ((std::is_integral<K>::value || std::is_enum<K>::value) && sizeof(K) <= 4)
+      return slottable_u32_hash((uint32_t)k);
+    else if constexpr (std::is_integral<K>::value || std::is_enum<K>::value)
+      return slottable_u64_hash((uint64_t)k);
+    else
+      return slottable_u64_hash((uint64_t)std::hash<K>()(k));
+  }
+};
+
+template <>
+struct SlotHash<std::string_view> {
+  uint32_t operator()(std::string_view k) const
+  {
+    return slottable_strn_fasthash(k.data(), k.size());
+  }
+};
+
+template <>
+struct SlotHash<std::string> : SlotHash<std::string_view> {};
+
+//
+// SlotTable<K, V, Hash, Eq> - a hash table of Entry {key, value} items, on a slottable
+// block. Items are kept in insertion order, holes aside; range-for visits them in that
+// order.
+//
+template <typename K, typename V, typename Hash = SlotHash<K>, typename Eq = std::equal_to<K>>
+class SlotTable {
+public:
+  struct Entry {
+    K key;
+    V value;
+  };
+
+private:
+  static_assert(alignof(Entry) <= 8, "SlotTable items can't be aligned past 8 bytes");
+  static constexpr bool trivial = std::is_trivially_copyable<Entry>::value;
+
+  Entry *a_ = nullptr;
+  Hash hash_;
+  Eq eq_;
+
+  //
+  // Finds 'k' (with hash 'h') in a table that's there. Callers check for an empty table
+  // before working out the hash, so that the check can be hoisted out of their loops.
+  //
+  Entry *lookup(const K &k, uint32_t h, SLOT_ID *&idref) const
+  {
+    Entry *a = a_;
+    auto cmp = [this](const K *key, const Entry *e) { return !eq_(*key, e->key); };
+    return slottable_find_and_id(a, h, cmp, &k, idref);
+  }
+
+  //
+  // Moves the live items over to a new block of 'n' items, in order and without holes.
+  // Returns: false if the new block couldn't be allocated.
+  //
+  bool relocate(uint32_t n)
+  {
+    Ch_SlotTable *t = (Ch_SlotTable *)a_, *p = slottable__new(sizeof(Entry), n, t->alloc);
+    if (!p)
+      return false;
+    uint8_t *to = slottable__data(p);
+    for (SLOT_ID i = 0; i < t->used; i++) {
+      Ch_SlotTableItem *from = slottable__item(t, i, sizeof(Entry)), *dst;
+      if (from->hash == SLOT_NONE_ID)
+        continue;
+      dst = slottable__data_item(to, p->used, sizeof(Entry));
+      dst->hash = from->hash;
+      new (dst->data) Entry(std::move(*(Entry *)from->data));
+      ((Entry *)from->data)->~Entry();
+      slottable__add_hash(p, p->used, dst);
+      p->used++;
+    }
+    p->active = p->used;
+    SLOT_STAT(rehashes, 1);
+    SLOT_STAT(rehash_bytes, (uint64_t)p->used * (sizeof(Entry) + sizeof(Ch_SlotTableItem)));
+    slottable__release(t);
+    a_ = (Entry *)p;
+    return true;
+  }
+
+  template <typename KK, typename... A>
+  V *add(KK &&k, A &&...args)
+  {
+    SLOT_ID *idref = nullptr, id;
+    uint32_t h = hash_(k);
+    Entry *e = a_ ? lookup(k, h, idref) : nullptr;
+    if (e)
+      return &e->value;
+
+    //
+    // A full table would be grown (or compacted) by slottable__insert with memcpy. Items
+    // that can't be copied that way are moved across here first.
+    //
+    if constexpr (!trivial) {
+      Ch_SlotTable *t = (Ch_SlotTable *)a_;
+      if (t && t->used == t->allocated && !relocate(
+          SLOTTABLE_SHOULD_COMPACT(t->used - t->active, t->used) ? t->allocated :
+            SLOT_DOUBLE_SIZE(t->allocated)))
+        return nullptr;
+    }
+    Ch_SlotTableItem *item = slottable__insert((uint8_t **)&a_, sizeof(Entry), &id, 0);
+    if (!item)
+      return nullptr;
+    item->hash = slottable__fix_hash(h);
+    slottable__add_hash((Ch_SlotTable *)a_, id, item);
+    e = (Entry *)item->data;
+    new (&e->key) K(std::forward<KK>(k));
+    new (&e->value) V(std::forward<A>(args)...);
+    return &e->value;
+  }
+
+public:
+  template <typename U>
+  class Iterator {
+    Entry *a_;
+    SLOT_ID i_, n_;
+
+    void skip()
+    {
+      while (i_ < n_ && slottable__item(a_, i_, sizeof(Entry))->hash == SLOT_NONE_ID)
+        i_++;
+    }
+
+  public:
+    Iterator(Entry *a, SLOT_ID i) : a_(a), i_(i), n_(slottable_used(a)) { skip(); }
+
+    U &operator*() const { return *(U *)slottable__item(a_, i_, sizeof(Entry))->data; }
+    U *operator->() const { return &**this; }
+    bool operator!=(const Iterator &o) const { return i_ != o.i_; }
+
+    // The SLOT_ID of the current item.
+    SLOT_ID id() const { return i_; }
+
+    Iterator &operator++()
+    {
+      i_++;
+      skip();
+      return *this;
+    }
+  };
+
+  // An empty table that gets all of its memory from the Ch_SlotAlloc 'al'.
+  explicit SlotTable(Ch_SlotAlloc *al = nullptr, Hash hash = Hash(), Eq eq = Eq()) :
+    hash_(hash), eq_(eq)
+  {
+    if (al)
+      slottable__init((uint8_t **)&a_, sizeof(Entry), al);
+  }
+
+  SlotTable(const SlotTable &) = delete;
+  SlotTable &operator=(const SlotTable &) = delete;
+  SlotTable(SlotTable &&o) noexcept : a_(o.a_), hash_(std::move(o.hash_)),
+    eq_(std::move(o.eq_)) { o.a_ = nullptr; }
+  SlotTable &operator=(SlotTable &&o) noexcept
+  {
+    std::swap(a_, o.a_);
+    std::swap(hash_, o.hash_);
+    std::swap(eq_, o.eq_);
+    return *this;
+  }
+  ~SlotTable()
+  {
+    if constexpr (!trivial)
+      for (Entry &e : *this)
+        e.~Entry();
+    slottable_free(a_);
+  }
+
+  SLOT_ID size() const { return slottable_count(a_); }
+  SLOT_ID capacity() const { return slottable_allocated(a_); }
+  bool empty() const { return size() == 0; }
+
+  Iterator<Entry> begin() { return Iterator<Entry>(a_, 0); }
+  Iterator<Entry> end() { return Iterator<Entry>(a_, slottable_used(a_)); }
+  Iterator<const Entry> begin() const { return Iterator<const Entry>(a_, 0); }
+  Iterator<const Entry> end() const { return Iterator<const Entry>(a_, slottable_used(a_)); }
+
+  // Returns: A pointer to the value for 'k' or NULL if it isn't there.
+  V *find(const K &k)
+  {
+    SLOT_ID *idref = nullptr;
+    if (!a_)
+      return nullptr;
+    Entry *e = lookup(k, hash_(k), idref);
+    return e ? &e->value : nullptr;
+  }
+  const V *find(const K &k) const { return const_cast<SlotTable *>(this)->find(k); }
+
+  // Add 'k' with a value constructed from 'args' - unless 'k' is already there, in which
+  // case it's left alone.
+  // Returns: A pointer to the value for 'k' or NULL if the table couldn't be grown.
+  template <typename... A>
+  V *emplace(const K &k, A &&...args) { return add(k, std::forward<A>(args)...); }
+  template <typename... A>
+  V *emplace(K &&k, A &&...args) { return add(std::move(k), std::forward<A>(args)...); }
+
+  // Remove and destroy the item for 'k'.
+  // Returns: false if it wasn't there.
+  bool erase(const K &k)
+  {
+    Entry *a = a_;
+    auto cmp = [this](const K *key, const Entry *e) { return !eq_(*key, e->key); };
+    Entry *e = slottable_remove(a, hash_(k), cmp, &k);
+    if constexpr (!trivial)
+      if (e)
+        e->~Entry();
+    return e != nullptr;
+  }
+
+  // Reclaim the holes left by removed items, sizing the table down too if 'shrink' is set.
+  void compact(bool shrink = false)
+  {
+    if constexpr (trivial) {
+      slottable_compact(a_, shrink ? SLOTTABLE_SHRINK : 0);
+    } else if (a_) {
+      uint32_t n = ((Ch_SlotTable *)a_)->allocated;
+      if (shrink) {
+        n = SLOT_DOUBLE_SIZE(0);
+        while (n < size())
+          n = SLOT_DOUBLE_SIZE(n);
+      }
+      relocate(n);
+    }
+  }
+
+  // The slottable block, for use with the slottable macros.
+  Entry *raw() { return a_; }
+};
+
+}
+
+#endif
@@ -0,0 +1,218 @@
+//
+// slotdeque.h
+//
+// A double-ended queue in a single block, like a slotlist, except that elements can be
+// added and taken off at both ends. The elements sit in a ring, so popping from the
+// front doesn't move anything.
+//
+//   Job *q = NULL;
+//   slotdeque_push_back(q, job);
+//   ...
+//   while (slotdeque_count(q)) {
+//     Job j = slotdeque_pop_front(q);
+//     ...
+//   }
+//
+// A consumer that works in batches can take a run of elements at a time:
+//
+//   uint32_t n;
+//   Job *run = slotdeque_span(q, n);      // the front 'n' elements, in one piece
+//   ...
+//   slotdeque_drop_front(q, n);
+//
+// INTERNALS
+//
+// The layout looks like this:
+//
+//   uint32_t allocated                  (always a power of two)
+//   uint32_t head
+//   uint32_t tail
+//   uint32_t reserved[3]
+//   Ch_SlotAlloc *alloc                 (two fields - set by slotdeque_init)
+//   user_type[allocated] items
+//
+// 'head' and 'tail' only ever count up (or, for the head, down) and wrap around at
+// 2^32; an element's place in the ring is its index masked by 'allocated - 1'. The count
+// is 'tail - head'.
+//
+// Growing doubles the block. The elements from the head to the end of the old block stay
+// put, and those that had wrapped around to its start are moved up past them - or, when
+// there are fewer of them, the head's run is moved up to the end of the new block. Either
+// way, that's one copy of the smaller part.
+//
+// LICENSE
+//
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+//
+#ifndef SLOTDEQUE_H
+#define SLOTDEQUE_H
+
+#include "slotbase.h"
+
+// The size of a new deque. It has to be a power of two.
+#ifndef SLOTDEQUE_MIN
+#define SLOTDEQUE_MIN            16
+#endif
+
+// Free the deque 'a' and all of its elements.
+// Returns: NULL.
+#define slotdeque_free(a)        ((a) ? SLOT_ALLOC_FREE(slotdeque__al(a), a),0 : 0)
+
+// Create an empty deque 'a' that gets all of its memory from the Ch_SlotAlloc 'al'.
+// Returns: 1 if the deque was created, 0 if not.
+#define slotdeque_init(a,al)     slotdeque__init((void **)&(a), sizeof(*(a)), al)
+
+// A count of the elements in the deque 'a'.
+// Returns: A uint32_t.
+#define slotdeque_count(a)       ((a) ? slotdeque__tail(a) - slotdeque__head(a) : 0)
+
+// A count of how many elements the deque 'a' has room for.
+// Returns: A uint32_t.
+#define slotdeque_allocated(a)   ((a) ? slotdeque__siz(a) : 0)
+
+// Add 'v' to the back (or the front) of the deque 'a'.
+#define slotdeque_push_back(a,v)  \
+  (slotdeque__maybegrow(a,1), slotdeque__slot(a, slotdeque__tail(a)++) = (v))
+#define slotdeque_push_front(a,v) \
+  (slotdeque__maybegrow(a,1), slotdeque__slot(a, --slotdeque__head(a)) = (v))
+
+// Take the element off the front (or the back) of the deque 'a', which mustn't be empty.
+// Returns: The element.
+#define slotdeque_pop_front(a)   ({ \
+  __typeof__(*(a)) __v__ = slotdeque_front(a); \
+  slotdeque__head(a)++; \
+  __v__; \
+})
+#define slotdeque_pop_back(a)    ({ \
+  __typeof__(*(a)) __v__ = slotdeque_back(a); \
+  slotdeque__tail(a)--; \
+  __v__; \
+})
+
+// The element at the front (or the back) of the deque 'a', which mustn't be empty.
+#define slotdeque_front(a)       slotdeque__slot(a, slotdeque__head(a))
+#define slotdeque_back(a)        slotdeque__slot(a, slotdeque__tail(a) - 1)
+
+// The element 'n' places from the front of the deque 'a'.
+#define slotdeque_at(a,n)        slotdeque__slot(a, slotdeque__head(a) + (n))
+
+// Get the elements at the front of the deque 'a' that are in one piece in memory - all of
+// them, unless the ring wraps around - setting the uint32_t 'n' to how many there are.
+// Returns: A pointer to the front element (or NULL, with 'n' set to zero, if empty.)
+#define slotdeque_span(a,n)      ({ \
+  uint32_t __c__ = slotdeque_count(a), __r__ = 0; \
+  __typeof__(a) __p__ = NULL; \
+  if (__c__) { \
+    __p__ = &slotdeque_front(a); \
+    __r__ = slotdeque__siz(a) - (slotdeque__head(a) & (slotdeque__siz(a) - 1)); \
+  } \
+  (n) = __c__ < __r__ ? __c__ : __r__; \
+  __p__; \
+})
+
+// Take 'n' elements off the front (or the back) of the deque 'a' without looking at them.
+#define slotdeque_drop_front(a,n) ((a) ? (slotdeque__head(a) += (n)) : 0)
+#define slotdeque_drop_back(a,n)  ((a) ? (slotdeque__tail(a) -= (n)) : 0)
+
+// Empty the deque 'a', keeping its memory.
+#define slotdeque_clear(a)       ((a) ? (slotdeque__head(a) = slotdeque__tail(a) = 0) : 0)
+
+// Make room for 'n' more elements in the deque 'a'.
+// Returns: 1 if there's room, 0 if the deque couldn't be grown.
+#define slotdeque_reserve(a,n)   ({ slotdeque__maybegrow(a,n); (a) != NULL; })
+
+//
+// internal macros
+//
+#define SLOTDEQUE__HDR           8
+#define slotdeque__raw(a)        ((SLOT_ID *)(a))
+#define slotdeque__siz(a)        slotdeque__raw(a)[0]
+#define slotdeque__head(a)       slotdeque__raw(a)[1]
+#define slotdeque__tail(a)       slotdeque__raw(a)[2]
+#define slotdeque__al(a)         (*(Ch_SlotAlloc **)(slotdeque__raw(a) + 6))
+#define slotdeque__array(a)      ((__typeof__(a))(slotdeque__raw(a) + SLOTDEQUE__HDR))
+#define slotdeque__slot(a,x)     slotdeque__array(a)[(x) & (slotdeque__siz(a) - 1)]
+
+#define slotdeque__needgrow(a,n) \
+  ((a) == 0 || (uint64_t)slotdeque_count(a) + (n) > slotdeque__siz(a))
+#define slotdeque__maybegrow(a,n) \
+  (slotdeque__needgrow(a,(n)) ? \
+    ((a) = (__typeof__(a))slotdeque__growf((a), (n), sizeof(*(a)))) : 0)
+
+#include <string.h>
+
+//
+// Reallocates the block to hold 'siz' elements, moving the wrapped part of the ring so
+// that it's still in order under the new mask. A new block gets a fresh header.
+// Returns: The block or NULL if it couldn't be resized.
+//
+static inline void *
+slotdeque__resize(void *arr, size_t itemsize, uint32_t siz)
+{
+  SLOT_ID old = arr ? slotdeque__siz(arr) : 0, *p;
+  size_t hdr = sizeof(SLOT_ID) * SLOTDEQUE__HDR;
+  p = (SLOT_ID *)SLOT_ALLOC_REALLOC(arr ? slotdeque__al(arr) : NULL, arr,
+    hdr + (size_t)siz * itemsize);
+  if (!p)
+    return NULL;
+  SLOT_STAT(grows, 1);
+  SLOT_STAT(grow_bytes, old ? hdr + (size_t)old * itemsize : 0);
+  SLOT_TRACE(grow, old ? hdr + (size_t)old * itemsize : 0, hdr + (size_t)siz * itemsize);
+  if (!arr) {
+    memset(p, 0, hdr);
+  } else {
+    uint8_t *items = (uint8_t *)(p + SLOTDEQUE__HDR);
+    uint32_t count = p[2] - p[1], h = p[1] & (old - 1);
+    uint32_t run = old - h, wrapped = count > run ? count - run : 0;
+    if (wrapped <= run) {
+      memcpy(items + (size_t)old * itemsize, items, (size_t)wrapped * itemsize);
+      p[1] = h;
+    } else {
+      memcpy(items + (size_t)(siz - run) * itemsize, items + (size_t)h * itemsize,
+        (size_t)run * itemsize);
+      p[1] = siz - run;
+    }
+    p[2] = p[1] + count;
+  }
+  p[0] = siz;
+  return p;
+}
+
+//
+// Grows the block by doubling until 'increment' more elements fit.
+// Returns: The block or NULL if it couldn't be grown.
+//
+static inline void *
+slotdeque__growf(void *arr, uint32_t increment, size_t itemsize)
+{
+  uint64_t need = (uint64_t)slotdeque_count(arr) + increment, siz = slotdeque_allocated(arr);
+  if (!siz)
+    siz = SLOTDEQUE_MIN;
+  while (siz < need)
+    siz *= 2;
+  if (siz > ((uint64_t)1 << 31))
+    return NULL;
+  return slotdeque__resize(arr, itemsize, (uint32_t)siz);
+}
+
+//
+// Creates an empty deque that gets its memory from 'al'.
+// Returns: 1 if the deque was created, 0 if not.
+//
+static inline int
+slotdeque__init(void **ary, size_t itemsize, Ch_SlotAlloc *al)
+{
+  size_t hdr = sizeof(SLOT_ID) * SLOTDEQUE__HDR;
+  SLOT_ID *p = (SLOT_ID *)SLOT_ALLOC_REALLOC(al, NULL, hdr + SLOTDEQUE_MIN * itemsize);
+  if (p) {
+    memset(p, 0, hdr);
+    p[0] = SLOTDEQUE_MIN;
+    slotdeque__al(p) = al;
+  }
+  *ary = p;
+  return p != NULL;
+}
+
+#endif
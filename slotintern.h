@@ -0,0 +1,168 @@
+//
+// slotintern.h
+//
+// Interned string keys for slot tables. Each distinct string is stored once, in a slotstr
+// region, with its length and full hash in front of it:
+//
+//   uint32_t hash
+//   uint32_t len
+//   char str[len + 1]          <- the SLOT_ID points here, so slotstr_at still works
+//   (padding to four bytes)
+//
+// A table keyed on interned strings keeps the SLOT_ID instead of a char pointer. Keys are
+// all in one block rather than a malloc apiece, and a lookup compares lengths and hashes
+// before it ever touches the bytes:
+//
+//   Ch_SlotIntern in = {0};
+//   typedef struct { SLOT_ID name; int value; } Entry;
+//   #define CMP(k, e) slotintern_cmp(&in, k, (e)->name)
+//
+//   SLOT_ID name = slotintern_add(&in, "foo");
+//   Entry *e = slottable_add(tbl, slotintern_hash(&in, name), 0);
+//   e->name = name;
+//   ...
+//   Ch_SlotInternKey k = slotintern_key("foo");
+//   e = slottable_find(tbl, k.hash, CMP, &k);
+//
+// Two interned strings are the same string only if their SLOT_IDs are the same, so a key
+// that's already interned can be looked up with a plain compare (see slotintern_same.)
+//
+// The region is a plain slotstr region, so it can be written out with
+// slottable_save_with_strings and loaded back with slottable_load_with_strings. Only the
+// index used to find duplicates is left behind - call slotintern_rebuild after loading to
+// intern more strings. (A region loaded SLOTTABLE_LOAD_READONLY can be looked up in, but
+// not added to.) Don't mix slotstr_add into an intern region.
+//
+// LICENSE
+//
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+//
+#ifndef SLOTINTERN_H
+#define SLOTINTERN_H
+
+#include "slotstr.h"
+#include "slottable.h"
+
+typedef struct {
+  char *strs;                        // the slotstr region
+  SLOT_ID *index;                    // a slot table of the SLOT_IDs in 'strs'
+} Ch_SlotIntern;
+
+// A string that hasn't been interned, with its length and hash worked out up front.
+typedef struct {
+  const char *str;
+  uint32_t len;
+  uint32_t hash;
+} Ch_SlotInternKey;
+
+// Make a Ch_SlotInternKey for the NUL-terminated string 'str'.
+#define slotintern_key(str)         slotintern__key(str, strlen(str))
+
+// Make a Ch_SlotInternKey for 'len' bytes of 'str'.
+#define slotintern_keyn(str, len)   slotintern__key(str, len)
+
+// Intern the NUL-terminated string 'str' in the Ch_SlotIntern 'in'.
+// Returns: The SLOT_ID of the string, which is the same for every add of the same string.
+#define slotintern_add(in, str)     slotintern__add(in, slotintern_key(str))
+
+// Intern 'len' bytes of 'str' in the Ch_SlotIntern 'in'.
+// Returns: The SLOT_ID of the string.
+#define slotintern_addn(in, str, len) slotintern__add(in, slotintern_keyn(str, len))
+
+// Look for the NUL-terminated string 'str' in the Ch_SlotIntern 'in', without adding it.
+// Returns: The SLOT_ID of the string or SLOT_NONE_ID if it hasn't been interned.
+#define slotintern_find(in, str)    slotintern__find(in, slotintern_key(str))
+
+// Get the interned string 'id' from the Ch_SlotIntern 'in'.
+// Returns: A NUL-terminated char pointer.
+#define slotintern_at(in, id)       slotstr_at((in)->strs, id)
+
+// The length of the interned string 'id'.
+// Returns: A uint32_t.
+#define slotintern_len(in, id)      slotintern__head(in, id)[1]
+
+// The full hash of the interned string 'id' (as slottable_strn_fasthash gives.)
+// Returns: A uint32_t.
+#define slotintern_hash(in, id)     slotintern__head(in, id)[0]
+
+// Compare the Ch_SlotInternKey pointer 'k' with the interned string 'id' - by length,
+// then by hash and only then by the bytes. For use as a slottable 'cmp'.
+// Returns: 0 if they're the same string.
+#define slotintern_cmp(in, k, id)   \
+  ((k)->len != slotintern_len(in, id) || (k)->hash != slotintern_hash(in, id) || \
+    memcmp((k)->str, slotintern_at(in, id), (k)->len) != 0)
+
+// Compare two interned strings.
+// Returns: 0 if they're the same string.
+#define slotintern_same(a, b)       ((a) != (b))
+
+// Free the string region and the index of the Ch_SlotIntern 'in'.
+#define slotintern_free(in)         \
+  (slotstr_free((in)->strs), slottable_free((in)->index), (in)->strs = NULL, (in)->index = NULL)
+
+//
+// internal functions
+//
+#define slotintern__head(in, id)    ((uint32_t *)(slotintern_at(in, id)) - 2)
+#define slotintern__cmp(k, e)       slotintern_cmp(in, k, *(e))
+
+static inline Ch_SlotInternKey
+slotintern__key(const char *str, size_t len)
+{
+  Ch_SlotInternKey k = {str, (uint32_t)len, slottable_strn_fasthash(str, len)};
+  return k;
+}
+
+static inline SLOT_ID
+slotintern__find(Ch_SlotIntern *in, Ch_SlotInternKey k)
+{
+  SLOT_ID *id = slottable_find(in->index, k.hash, slotintern__cmp, &k);
+  return id ? *id : SLOT_NONE_ID;
+}
+
+//
+// Appends the header, string and padding for 'k' to the region.
+// Returns: The SLOT_ID of the string.
+//
+static inline SLOT_ID
+slotintern__append(char **s, Ch_SlotInternKey k)
+{
+  uint32_t head[2] = {k.hash, k.len};
+  size_t size = sizeof(head) + ((k.len + 4) & ~(size_t)3);
+  char *p = slotlist_add(*s, size);
+  memcpy(p, head, sizeof(head));
+  memcpy(p + sizeof(head), k.str, k.len);
+  memset(p + sizeof(head) + k.len, 0, size - sizeof(head) - k.len);
+  return (p + sizeof(head)) - slotlist_array(*s);
+}
+
+static inline SLOT_ID
+slotintern__add(Ch_SlotIntern *in, Ch_SlotInternKey k)
+{
+  SLOT_ID id = slotintern__find(in, k);
+  if (id == SLOT_NONE_ID) {
+    id = slotintern__append(&in->strs, k);
+    *slottable_add(in->index, k.hash, 0) = id;
+  }
+  return id;
+}
+
+// Build the index of the Ch_SlotIntern 'in' from its string region - after the region
+// has been loaded from a snapshot, for instance.
+static inline void
+slotintern_rebuild(Ch_SlotIntern *in)
+{
+  SLOT_ID off = 0, end = slotstr_size(in->strs);
+  slottable_free(in->index);
+  in->index = NULL;
+  while (off + 2 * sizeof(uint32_t) <= end) {
+    SLOT_ID str = off + 2 * sizeof(uint32_t);
+    uint32_t hash = slotintern_hash(in, str);
+    *slottable_add(in->index, hash, 0) = str;
+    off = str + ((slotintern_len(in, str) + 4) & ~(SLOT_ID)3);
+  }
+}
+
+#endif
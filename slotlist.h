@@ -3,7 +3,12 @@
 //
 // A derivative of Sean Barrett's stretchy_buffer which allows one to specific a larger
 // minimum size, a growth pattern and adds two extra fields for data. (Two fields to make
-// room for a 64-bit pointer, if need be.)
+// room for a 64-bit pointer, if need be.) The header is:
+//
+//   uint32_t allocated
+//   uint32_t count
+//   Ch_SlotAlloc *alloc                (two more fields - NULL unless slotlist_init set it)
+//   user_type[allocated] items
 //
 // LICENSE
 //
@@ -19,7 +24,8 @@
 #define SLOTLIST_MAX             UINT32_MAX
 
 #define slotlist_id(a,v)         (v - slotlist_array(a))
-#define slotlist_free(a)         ((a) ? free(a),0 : 0)
+#define slotlist_free(a)         ((a) ? SLOT_ALLOC_FREE(slotlist__sbal(a), a),0 : 0)
+#define slotlist_init(a,al)      slotlist__init((void **)&(a), sizeof(*(a)), al)
 #define slotlist_push(a,v)       (slotlist__sbmaybegrow(a,1), slotlist_at(a, slotlist__sbn(a)++) = (v))
 #define slotlist_allocated(a)    ((a) ? slotlist__sbm(a) : 0)
 #define slotlist_count(a)        ((a) ? slotlist__sbn(a) : 0)
@@ -27,19 +33,23 @@
 #define slotlist_add(a,n)        (slotlist_expand(a,n), &slotlist_at(a, slotlist__sbn(a)-(n)))
 #define slotlist_truncate(a,n)   ((a) ? (slotlist__sbn(a)-=(n),1) : 0)
 #define slotlist_clear(a)        ((a) ? (slotlist__sbn(a)=0) : 0)
+#define slotlist_reserve(a,n)    ({ slotlist__sbmaybegrow(a,n); (a) != NULL; })
+#define slotlist_trim(a)         ((a) ? slotlist__trim((void **)&(a), sizeof(*(a))) : 0)
 #define slotlist_last(a)         slotlist_at(a, slotlist__sbn(a)-1)
 
-#define slotlist_array(a)        ((__typeof__(a))((SLOT_ID *) (a) + 2))
+#define slotlist_array(a)        ((__typeof__(a))((SLOT_ID *) (a) + SLOTLIST__HDR))
 #define slotlist_at(a,n)         slotlist_array(a)[n]
-#define slotlist_ptr(a)          ((SLOT_ID *) (a) - 2)
+#define slotlist_ptr(a)          ((SLOT_ID *) (a) - SLOTLIST__HDR)
 
+#define SLOTLIST__HDR      4
 #define slotlist__sbraw(a) ((SLOT_ID *) (a))
 #define slotlist__sbm(a)   slotlist__sbraw(a)[0]
 #define slotlist__sbn(a)   slotlist__sbraw(a)[1]
+#define slotlist__sbal(a)  (*(Ch_SlotAlloc **)(slotlist__sbraw(a) + 2))
 
 #define slotlist__sbneedgrow(a,n)  ((a)==0 || slotlist__sbn(a)+(n) > slotlist__sbm(a))
 #define slotlist__sbmaybegrow(a,n) (slotlist__sbneedgrow(a,(n)) ? slotlist__sbgrow(a,n) : 0)
-#define slotlist__sbgrow(a,n)      ((a) = slotlist__sbgrowf((a), (n), sizeof(*(a))))
+#define slotlist__sbgrow(a,n)      ((a) = (__typeof__(a))slotlist__sbgrowf((a), (n), sizeof(*(a))))
 
 #ifndef SLOTLIST_MACROS_ONLY
 #include <stdlib.h>
@@ -49,7 +59,7 @@ slotlist__sbgrowf(void *arr, SLOT_ID increment, size_t itemsize)
 {
   size_t newsize = 0,
          newitems = slotlist_allocated(arr),
-         extsize = sizeof(SLOT_ID) * 2,
+         extsize = sizeof(SLOT_ID) * SLOTLIST__HDR,
          needed = slotlist_count(arr) + increment + SLOT_DIV_ALIGN(extsize, itemsize);
   while (newitems < needed)
     newitems = SLOT_FLEX_SIZE(newitems);
@@ -57,10 +67,16 @@ slotlist__sbgrowf(void *arr, SLOT_ID increment, size_t itemsize)
   newsize = SLOT_ALIGN(newitems * itemsize, SLOT_ALIGN_SIZE);
   newitems = (newsize - extsize) / itemsize;
   if (newitems < SLOTLIST_MAX) {
-    SLOT_ID *p = (SLOT_ID *)SLOT_REALLOC(arr, newsize);
+    size_t oldsize = arr ? extsize + slotlist__sbm(arr) * itemsize : 0;
+    SLOT_ID *p = (SLOT_ID *)SLOT_ALLOC_REALLOC(arr ? slotlist__sbal(arr) : NULL, arr, newsize);
     if (p) {
-      if (!arr)
+      SLOT_STAT(grows, 1);
+      SLOT_STAT(grow_bytes, oldsize);
+      SLOT_TRACE(grow, oldsize, newsize);
+      if (!arr) {
         p[1] = 0;
+        slotlist__sbal(p) = NULL;
+      }
       p[0] = newitems;
       return p;
     }
@@ -68,6 +84,45 @@ slotlist__sbgrowf(void *arr, SLOT_ID increment, size_t itemsize)
 
   return NULL;
 }
+
+//
+// Sizes the block down to fit the list's count - after a truncate or clear, say.
+// Returns: The number of items of room given back.
+//
+static inline SLOT_ID
+slotlist__trim(void **ary, size_t itemsize)
+{
+  SLOT_ID *arr = (SLOT_ID *)*ary, *p;
+  size_t extsize = sizeof(SLOT_ID) * SLOTLIST__HDR,
+         newsize = SLOT_ALIGN(extsize + arr[1] * itemsize, SLOT_ALIGN_SIZE);
+  SLOT_ID newitems = (newsize - extsize) / itemsize, old = arr[0];
+  if (newitems >= old)
+    return 0;
+  p = (SLOT_ID *)SLOT_ALLOC_REALLOC(slotlist__sbal(arr), arr, newsize);
+  if (!p)
+    return 0;
+  p[0] = newitems;
+  *ary = p;
+  return old - newitems;
+}
+
+//
+// Creates an empty list that gets its memory from 'al'.
+// Returns: 1 if the list was created, 0 if not.
+//
+static inline int
+slotlist__init(void **ary, size_t itemsize, Ch_SlotAlloc *al)
+{
+  size_t newsize = SLOT_ALIGN(sizeof(SLOT_ID) * SLOTLIST__HDR, SLOT_ALIGN_SIZE);
+  SLOT_ID *p = (SLOT_ID *)SLOT_ALLOC_REALLOC(al, NULL, newsize);
+  if (p) {
+    p[0] = (newsize - sizeof(SLOT_ID) * SLOTLIST__HDR) / itemsize;
+    p[1] = 0;
+    slotlist__sbal(p) = al;
+  }
+  *ary = p;
+  return p != NULL;
+}
 #endif
 
 #endif
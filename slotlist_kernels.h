@@ -0,0 +1,464 @@
+//
+// slotlist_kernels.h
+//
+// Search, filter and sort over whole slotlists. The search and filter kernels work on
+// slotlists of uint32_t or uint64_t and compare every element against a key with one of
+// the SLOTLIST_EQ..SLOTLIST_GE operations. The radix sort works on those too, or on a
+// struct's integer field.
+//
+//   uint32_t *ages = NULL, *old = NULL;
+//   ...
+//   uint32_t i = slotlist_find_u32(ages, SLOTLIST_EQ, 42);      // SLOTLIST_MAX if none
+//   uint32_t n = slotlist_count_u32(ages, SLOTLIST_GE, 65);
+//   slotlist_filter_u32(ages, SLOTLIST_GE, 65, old);            // appends to 'old'
+//   slotlist_sort_u32(ages);
+//
+//   Person *people = NULL;
+//   slotlist_sort_by(people, age);
+//
+// Comparisons are unsigned. The sort is stable and also treats keys as unsigned.
+//
+// On x86, the kernels use AVX2 if the CPU has it (checked once, at run time) and SSE2
+// otherwise. Elsewhere they're plain loops. Define SLOTLIST_KERNELS_SCALAR to always use
+// the plain loops.
+//
+// LICENSE
+//
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+//
+#ifndef SLOTLIST_KERNELS_H
+#define SLOTLIST_KERNELS_H
+
+#include "slotlist.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && \
+    !defined(SLOTLIST_KERNELS_SCALAR)
+#define SLOTLIST__X86 1
+#include <immintrin.h>
+#endif
+
+// The comparisons, as 'element OP key'.
+#define SLOTLIST_EQ 0
+#define SLOTLIST_NE 1
+#define SLOTLIST_LT 2
+#define SLOTLIST_LE 3
+#define SLOTLIST_GT 4
+#define SLOTLIST_GE 5
+
+// Find the first element of the uint32_t slotlist 'a' where 'element op key' holds.
+// Returns: Its index, or SLOTLIST_MAX if there isn't one.
+#define slotlist_find_u32(a,op,key)   \
+  ((a) ? slotlist__find_u32(slotlist_array(a), slotlist__sbn(a), op, key) : SLOTLIST_MAX)
+#define slotlist_find_u64(a,op,key)   \
+  ((a) ? slotlist__find_u64(slotlist_array(a), slotlist__sbn(a), op, key) : SLOTLIST_MAX)
+
+// Count the elements of the uint32_t slotlist 'a' where 'element op key' holds.
+// Returns: A uint32_t.
+#define slotlist_count_u32(a,op,key)  \
+  ((a) ? slotlist__count_u32(slotlist_array(a), slotlist__sbn(a), op, key) : 0)
+#define slotlist_count_u64(a,op,key)  \
+  ((a) ? slotlist__count_u64(slotlist_array(a), slotlist__sbn(a), op, key) : 0)
+
+// Append each element of the uint32_t slotlist 'a' where 'element op key' holds to the
+// slotlist 'out', in order.
+// Returns: The number of elements appended.
+#define slotlist_filter_u32(a,op,key,out) ({ \
+  uint32_t __n__ = slotlist_count(a), __k__ = 0; \
+  if (__n__) { \
+    uint32_t *__o__ = slotlist_add(out, __n__); \
+    __k__ = slotlist__filter_u32(slotlist_array(a), __n__, op, key, __o__); \
+    slotlist_truncate(out, __n__ - __k__); \
+  } \
+  __k__; \
+})
+#define slotlist_filter_u64(a,op,key,out) ({ \
+  uint32_t __n__ = slotlist_count(a), __k__ = 0; \
+  if (__n__) { \
+    uint64_t *__o__ = slotlist_add(out, __n__); \
+    __k__ = slotlist__filter_u64(slotlist_array(a), __n__, op, key, __o__); \
+    slotlist_truncate(out, __n__ - __k__); \
+  } \
+  __k__; \
+})
+
+// Sort the uint32_t (or uint64_t) slotlist 'a' in place with an LSD radix sort.
+// Returns: 1 if sorted, 0 if the scratch space couldn't be allocated.
+#define slotlist_sort_u32(a)          slotlist_sort_by_key(a, 0, 4)
+#define slotlist_sort_u64(a)          slotlist_sort_by_key(a, 0, 8)
+
+// Sort the slotlist 'a' of structs in place by the unsigned integer 'field' - which
+// must be 1, 2, 4 or 8 bytes - with a stable LSD radix sort.
+// Returns: 1 if sorted, 0 if the scratch space couldn't be allocated.
+#define slotlist_sort_by(a,field)     \
+  slotlist_sort_by_key(a, offsetof(__typeof__(*(a)), field), sizeof((a)->field))
+#define slotlist_sort_by_key(a,off,size) \
+  ((a) ? slotlist__radix(slotlist__sbal(a), slotlist_array(a), slotlist__sbn(a), sizeof(*(a)), \
+    off, size) : 1)
+
+//
+// internal functions
+//
+#define SLOTLIST__CMP(x,op,key) \
+  ((op) == SLOTLIST_EQ ? (x) == (key) : (op) == SLOTLIST_NE ? (x) != (key) : \
+   (op) == SLOTLIST_LT ? (x) < (key) : (op) == SLOTLIST_LE ? (x) <= (key) : \
+   (op) == SLOTLIST_GT ? (x) > (key) : (x) >= (key))
+
+#ifdef SLOTLIST__X86
+static inline int
+slotlist__avx2(void)
+{
+  static int has = -1;
+  if (has < 0) {
+    __builtin_cpu_init();
+    has = __builtin_cpu_supports("avx2") ? 1 : 0;
+  }
+  return has;
+}
+
+//
+// Each of these turns a vector compare into a bitmask with a bit per element. Unsigned
+// order comes from flipping the sign bits and comparing signed. The 'ge' and 'le' cases
+// are the inverse of 'lt' and 'gt', so they're handled by flipping the mask.
+//
+static inline uint32_t
+slotlist__mask_sse2_u32(__m128i x, __m128i key, int op)
+{
+  const __m128i sign = _mm_set1_epi32((int)0x80000000);
+  __m128i m;
+  switch (op) {
+    case SLOTLIST_EQ: case SLOTLIST_NE: m = _mm_cmpeq_epi32(x, key); break;
+    case SLOTLIST_LT: case SLOTLIST_GE:
+      m = _mm_cmplt_epi32(_mm_xor_si128(x, sign), _mm_xor_si128(key, sign)); break;
+    default:
+      m = _mm_cmpgt_epi32(_mm_xor_si128(x, sign), _mm_xor_si128(key, sign)); break;
+  }
+  uint32_t bits = _mm_movemask_ps(_mm_castsi128_ps(m));
+  return (op == SLOTLIST_NE || op == SLOTLIST_GE || op == SLOTLIST_LE) ? bits ^ 0xF : bits;
+}
+
+__attribute__((target("avx2"))) static inline uint32_t
+slotlist__mask_avx2_u32(__m256i x, __m256i key, int op)
+{
+  const __m256i sign = _mm256_set1_epi32((int)0x80000000);
+  __m256i m;
+  switch (op) {
+    case SLOTLIST_EQ: case SLOTLIST_NE: m = _mm256_cmpeq_epi32(x, key); break;
+    case SLOTLIST_LT: case SLOTLIST_GE:
+      m = _mm256_cmpgt_epi32(_mm256_xor_si256(key, sign), _mm256_xor_si256(x, sign)); break;
+    default:
+      m = _mm256_cmpgt_epi32(_mm256_xor_si256(x, sign), _mm256_xor_si256(key, sign)); break;
+  }
+  uint32_t bits = _mm256_movemask_ps(_mm256_castsi256_ps(m));
+  return (op == SLOTLIST_NE || op == SLOTLIST_GE || op == SLOTLIST_LE) ? bits ^ 0xFF : bits;
+}
+
+__attribute__((target("avx2"))) static inline uint32_t
+slotlist__mask_avx2_u64(__m256i x, __m256i key, int op)
+{
+  const __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+  __m256i m;
+  switch (op) {
+    case SLOTLIST_EQ: case SLOTLIST_NE: m = _mm256_cmpeq_epi64(x, key); break;
+    case SLOTLIST_LT: case SLOTLIST_GE:
+      m = _mm256_cmpgt_epi64(_mm256_xor_si256(key, sign), _mm256_xor_si256(x, sign)); break;
+    default:
+      m = _mm256_cmpgt_epi64(_mm256_xor_si256(x, sign), _mm256_xor_si256(key, sign)); break;
+  }
+  uint32_t bits = _mm256_movemask_pd(_mm256_castsi256_pd(m));
+  return (op == SLOTLIST_NE || op == SLOTLIST_GE || op == SLOTLIST_LE) ? bits ^ 0xF : bits;
+}
+
+__attribute__((target("avx2"))) static inline uint32_t
+slotlist__find_avx2_u32(const uint32_t *a, uint32_t n, int op, uint32_t key)
+{
+  __m256i k = _mm256_set1_epi32((int)key);
+  uint32_t i = 0, m;
+  for (; i + 8 <= n; i += 8)
+    if ((m = slotlist__mask_avx2_u32(_mm256_loadu_si256((const __m256i *)(a + i)), k, op)))
+      return i + __builtin_ctz(m);
+  for (; i < n; i++)
+    if (SLOTLIST__CMP(a[i], op, key))
+      return i;
+  return SLOTLIST_MAX;
+}
+
+__attribute__((target("avx2"))) static inline uint32_t
+slotlist__find_avx2_u64(const uint64_t *a, uint32_t n, int op, uint64_t key)
+{
+  __m256i k = _mm256_set1_epi64x((long long)key);
+  uint32_t i = 0, m;
+  for (; i + 4 <= n; i += 4)
+    if ((m = slotlist__mask_avx2_u64(_mm256_loadu_si256((const __m256i *)(a + i)), k, op)))
+      return i + __builtin_ctz(m);
+  for (; i < n; i++)
+    if (SLOTLIST__CMP(a[i], op, key))
+      return i;
+  return SLOTLIST_MAX;
+}
+
+__attribute__((target("avx2"))) static inline uint32_t
+slotlist__count_avx2_u32(const uint32_t *a, uint32_t n, int op, uint32_t key)
+{
+  __m256i k = _mm256_set1_epi32((int)key);
+  uint32_t i = 0, c = 0;
+  for (; i + 8 <= n; i += 8)
+    c += __builtin_popcount(slotlist__mask_avx2_u32(
+      _mm256_loadu_si256((const __m256i *)(a + i)), k, op));
+  for (; i < n; i++)
+    c += SLOTLIST__CMP(a[i], op, key);
+  return c;
+}
+
+__attribute__((target("avx2"))) static inline uint32_t
+slotlist__count_avx2_u64(const uint64_t *a, uint32_t n, int op, uint64_t key)
+{
+  __m256i k = _mm256_set1_epi64x((long long)key);
+  uint32_t i = 0, c = 0;
+  for (; i + 4 <= n; i += 4)
+    c += __builtin_popcount(slotlist__mask_avx2_u64(
+      _mm256_loadu_si256((const __m256i *)(a + i)), k, op));
+  for (; i < n; i++)
+    c += SLOTLIST__CMP(a[i], op, key);
+  return c;
+}
+
+//
+// For each 8-bit mask, the lanes to pull (in order) to pack the kept 32-bit elements
+// to the front of a vector.
+//
+static inline const uint32_t *
+slotlist__pack_table(void)
+{
+  static uint32_t table[256][8];
+  static int ready = 0;
+  if (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE)) {
+    for (uint32_t m = 0; m < 256; m++) {
+      uint32_t k = 0;
+      for (uint32_t b = 0; b < 8; b++)
+        if (m & (1U << b))
+          table[m][k++] = b;
+      while (k < 8)
+        table[m][k++] = 0;
+    }
+    __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+  }
+  return &table[0][0];
+}
+
+__attribute__((target("avx2"))) static inline uint32_t
+slotlist__filter_avx2_u32(const uint32_t *a, uint32_t n, int op, uint32_t key, uint32_t *out)
+{
+  const uint32_t *table = slotlist__pack_table();
+  __m256i k = _mm256_set1_epi32((int)key);
+  uint32_t i = 0, o = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+    uint32_t m = slotlist__mask_avx2_u32(x, k, op);
+    __m256i lanes = _mm256_loadu_si256((const __m256i *)(table + m * 8));
+    _mm256_storeu_si256((__m256i *)(out + o), _mm256_permutevar8x32_epi32(x, lanes));
+    o += __builtin_popcount(m);
+  }
+  for (; i < n; i++)
+    if (SLOTLIST__CMP(a[i], op, key))
+      out[o++] = a[i];
+  return o;
+}
+
+__attribute__((target("avx2"))) static inline uint32_t
+slotlist__filter_avx2_u64(const uint64_t *a, uint32_t n, int op, uint64_t key, uint64_t *out)
+{
+  const uint32_t *table = slotlist__pack_table();
+  __m256i k = _mm256_set1_epi64x((long long)key);
+  uint32_t i = 0, o = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+    uint32_t m = slotlist__mask_avx2_u64(x, k, op), w = 0;
+    //
+    // Widen the 4-bit mask to one bit per 32-bit half, and pack the halves.
+    //
+    for (uint32_t b = 0; b < 4; b++)
+      if (m & (1U << b))
+        w |= 3U << (b * 2);
+    __m256i lanes = _mm256_loadu_si256((const __m256i *)(table + w * 8));
+    _mm256_storeu_si256((__m256i *)(out + o), _mm256_permutevar8x32_epi32(x, lanes));
+    o += __builtin_popcount(m);
+  }
+  for (; i < n; i++)
+    if (SLOTLIST__CMP(a[i], op, key))
+      out[o++] = a[i];
+  return o;
+}
+#endif
+
+static inline uint32_t
+slotlist__find_u32(const uint32_t *a, uint32_t n, int op, uint32_t key)
+{
+  uint32_t i = 0;
+#ifdef SLOTLIST__X86
+  if (slotlist__avx2())
+    return slotlist__find_avx2_u32(a, n, op, key);
+  __m128i k = _mm_set1_epi32((int)key);
+  for (uint32_t m; i + 4 <= n; i += 4)
+    if ((m = slotlist__mask_sse2_u32(_mm_loadu_si128((const __m128i *)(a + i)), k, op)))
+      return i + __builtin_ctz(m);
+#endif
+  for (; i < n; i++)
+    if (SLOTLIST__CMP(a[i], op, key))
+      return i;
+  return SLOTLIST_MAX;
+}
+
+static inline uint32_t
+slotlist__find_u64(const uint64_t *a, uint32_t n, int op, uint64_t key)
+{
+  uint32_t i;
+#ifdef SLOTLIST__X86
+  if (slotlist__avx2())
+    return slotlist__find_avx2_u64(a, n, op, key);
+#endif
+  for (i = 0; i < n; i++)
+    if (SLOTLIST__CMP(a[i], op, key))
+      return i;
+  return SLOTLIST_MAX;
+}
+
+static inline uint32_t
+slotlist__count_u32(const uint32_t *a, uint32_t n, int op, uint32_t key)
+{
+  uint32_t i = 0, c = 0;
+#ifdef SLOTLIST__X86
+  if (slotlist__avx2())
+    return slotlist__count_avx2_u32(a, n, op, key);
+  __m128i k = _mm_set1_epi32((int)key);
+  for (; i + 4 <= n; i += 4)
+    c += __builtin_popcount(slotlist__mask_sse2_u32(
+      _mm_loadu_si128((const __m128i *)(a + i)), k, op));
+#endif
+  for (; i < n; i++)
+    c += SLOTLIST__CMP(a[i], op, key);
+  return c;
+}
+
+static inline uint32_t
+slotlist__count_u64(const uint64_t *a, uint32_t n, int op, uint64_t key)
+{
+  uint32_t i, c = 0;
+#ifdef SLOTLIST__X86
+  if (slotlist__avx2())
+    return slotlist__count_avx2_u64(a, n, op, key);
+#endif
+  for (i = 0; i < n; i++)
+    c += SLOTLIST__CMP(a[i], op, key);
+  return c;
+}
+
+//
+// 'out' must have room for 'n' elements, since the vector paths store whole vectors.
+//
+static inline uint32_t
+slotlist__filter_u32(const uint32_t *a, uint32_t n, int op, uint32_t key, uint32_t *out)
+{
+  uint32_t i = 0, o = 0;
+#ifdef SLOTLIST__X86
+  if (slotlist__avx2())
+    return slotlist__filter_avx2_u32(a, n, op, key, out);
+  __m128i k = _mm_set1_epi32((int)key);
+  for (; i + 4 <= n; i += 4) {
+    uint32_t m = slotlist__mask_sse2_u32(_mm_loadu_si128((const __m128i *)(a + i)), k, op);
+    while (m) {
+      out[o++] = a[i + __builtin_ctz(m)];
+      m &= m - 1;
+    }
+  }
+#endif
+  for (; i < n; i++)
+    if (SLOTLIST__CMP(a[i], op, key))
+      out[o++] = a[i];
+  return o;
+}
+
+static inline uint32_t
+slotlist__filter_u64(const uint64_t *a, uint32_t n, int op, uint64_t key, uint64_t *out)
+{
+  uint32_t i, o = 0;
+#ifdef SLOTLIST__X86
+  if (slotlist__avx2())
+    return slotlist__filter_avx2_u64(a, n, op, key, out);
+#endif
+  for (i = 0; i < n; i++)
+    if (SLOTLIST__CMP(a[i], op, key))
+      out[o++] = a[i];
+  return o;
+}
+
+//
+// Reads the 'size'-byte unsigned key at 'p'.
+//
+static inline uint64_t
+slotlist__key(const uint8_t *p, size_t size)
+{
+  switch (size) {
+    case 1: return *p;
+    case 2: { uint16_t k; memcpy(&k, p, 2); return k; }
+    case 4: { uint32_t k; memcpy(&k, p, 4); return k; }
+    default: { uint64_t k; memcpy(&k, p, 8); return k; }
+  }
+}
+
+//
+// A stable LSD radix sort, eight bits at a time. All of the histograms are counted in
+// one pass up front, and a byte where every key is the same is skipped. The scratch space
+// comes from the list's allocator 'al'.
+// Returns: 1 if sorted, 0 if the scratch space couldn't be allocated.
+//
+static inline int
+slotlist__radix(Ch_SlotAlloc *al, void *arr, uint32_t n, size_t itemsize, size_t off,
+  size_t size)
+{
+  uint8_t *src = (uint8_t *)arr, *dst, *tmp;
+  uint32_t (*hist)[256];
+  uint32_t i, b;
+  if (n < 2)
+    return 1;
+  if (!(tmp = (uint8_t *)SLOT_ALLOC_REALLOC(al, NULL,
+      sizeof(uint32_t) * 256 * size + (size_t)n * itemsize)))
+    return 0;
+  hist = (uint32_t (*)[256])tmp;
+  memset(hist, 0, sizeof(uint32_t) * 256 * size);
+
+  for (i = 0; i < n; i++) {
+    uint64_t k = slotlist__key(src + i * itemsize + off, size);
+    for (b = 0; b < size; b++, k >>= 8)
+      hist[b][k & 0xFF]++;
+  }
+
+  dst = tmp + sizeof(uint32_t) * 256 * size;
+  for (b = 0; b < size; b++) {
+    uint32_t sum = 0, d;
+    if (hist[b][slotlist__key(src + off, size) >> (b * 8) & 0xFF] == n)
+      continue;
+    for (d = 0; d < 256; d++) {
+      uint32_t c = hist[b][d];
+      hist[b][d] = sum;
+      sum += c;
+    }
+    for (i = 0; i < n; i++) {
+      uint8_t *item = src + i * itemsize;
+      d = slotlist__key(item + off, size) >> (b * 8) & 0xFF;
+      memcpy(dst + (size_t)hist[b][d]++ * itemsize, item, itemsize);
+    }
+    uint8_t *swap = src; src = dst; dst = swap;
+  }
+
+  if (src != (uint8_t *)arr)
+    memcpy(arr, src, (size_t)n * itemsize);
+  SLOT_ALLOC_FREE(al, tmp);
+  return 1;
+}
+
+#endif
@@ -0,0 +1,164 @@
+//
+// slotlist_mt.h
+//
+// Appending to one slotlist from many threads at once, without a lock. The list is an
+// ordinary slotlist - reserve room in it first, since appends here never grow it - and a
+// Ch_SlotListMT beside it keeps count of what's been written:
+//
+//   Event *events = NULL;
+//   Ch_SlotListMT mt;
+//   slotlist_reserve(events, 100000);
+//   slotlist_mt_begin(events, &mt);
+//
+//   // on any thread
+//   slotlist_mt_push(events, &mt, ev);                 // 0 if the list is full
+//
+//   uint32_t got;
+//   Event *e = slotlist_mt_claim(events, &mt, 64, got); // room for up to 64
+//   ...                                                 // fill in 'got' of them
+//   slotlist_mt_commit(&mt, got);
+//
+//   // on the consumer, while the producers run
+//   uint32_t n = slotlist_mt_ready(events, &mt);        // events[0..n) are complete
+//
+//   // once the producers are done
+//   slotlist_mt_end(events, &mt);
+//
+// After slotlist_mt_end the list is a plain slotlist again, so there's nothing to merge.
+//
+// INTERNALS
+//
+// Space is claimed with an atomic add on the list's count, so every claim gets its own
+// range and a batch costs the same as a single element. Once a claimant has written its
+// range, it adds the range's length to 'committed'. Claims and commits are one atomic add
+// apiece - no thread ever waits on another.
+//
+// Ranges are committed in whatever order their writers finish, so 'committed' alone
+// doesn't say which ranges are done. But every commit follows its claim, so if
+// 'committed' and the count are ever seen to be equal, every range claimed up to that
+// point has been written. slotlist_mt_ready checks for that and remembers the last time
+// it held, so what it hands back only ever grows. It's exact whenever the producers
+// pause, and it can fall behind while they're busy.
+//
+// OVERFLOW
+//
+// A claim that doesn't fit in what's left is cut short - 'got' says how much of it was
+// granted - and a claim on a full list gets nothing (slotlist_mt_claim gives NULL and
+// slotlist_mt_push gives 0.) Nothing is overwritten and the list is never grown. The
+// count of elements that didn't fit is kept in 'dropped' and given back by
+// slotlist_mt_end. While appends are going on, slotlist_count can run past the allocated
+// size; slotlist_mt_end sets it back.
+//
+// LICENSE
+//
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+//
+#ifndef SLOTLIST_MT_H
+#define SLOTLIST_MT_H
+
+#include "slotlist.h"
+
+typedef struct {
+  uint32_t committed;                // elements written, including those before begin
+  uint8_t pad0[60];
+  uint32_t dropped;                  // elements that didn't fit
+  uint32_t ready;                    // the longest complete run slotlist_mt_ready has seen
+  uint8_t pad1[56];
+} Ch_SlotListMT;
+
+// Start appending to the slotlist 'a' from many threads, with 'mt' keeping track. The
+// elements already in the list count as written. Don't grow or shrink the list (or use
+// the plain slotlist calls that could) until slotlist_mt_end.
+#define slotlist_mt_begin(a,mt)  slotlist_mt__begin(slotlist__sbraw(a), mt)
+
+// Claim room for 'n' elements at the end of the slotlist 'a', setting the uint32_t 'got'
+// to the number granted - 'n', or fewer if the list is nearly full. Every element
+// granted has to be written and then committed with slotlist_mt_commit.
+// Returns: A pointer to the first element claimed, or NULL if the list is full.
+#define slotlist_mt_claim(a,mt,n,got) ({ \
+  SLOT_ID __at__ = slotlist_mt__claim(slotlist__sbraw(a), mt, n, &(got)); \
+  __at__ == SLOTLIST_MAX ? (__typeof__(a))NULL : slotlist_array(a) + __at__; \
+})
+
+// Publish 'n' elements written after a claim.
+#define slotlist_mt_commit(mt,n) \
+  ((void)__atomic_fetch_add(&(mt)->committed, (n), __ATOMIC_RELEASE))
+
+// Append 'v' to the slotlist 'a' (claim, write and commit, in one.)
+// Returns: 1 if it was appended, 0 if the list is full.
+#define slotlist_mt_push(a,mt,v) ({ \
+  uint32_t __got__; \
+  __typeof__(a) __p__ = slotlist_mt_claim(a, mt, 1, __got__); \
+  if (__p__) { \
+    *__p__ = (v); \
+    slotlist_mt_commit(mt, 1); \
+  } \
+  __p__ != NULL; \
+})
+
+// The number of elements at the start of the slotlist 'a' that are completely written
+// and safe to read. It may lag behind while producers are appending.
+// Returns: A uint32_t.
+#define slotlist_mt_ready(a,mt)  slotlist_mt__ready(slotlist__sbraw(a), mt)
+
+// Finish appending to the slotlist 'a'. Every producer has to be done (and their
+// commits seen by this thread) first.
+// Returns: The number of elements that didn't fit.
+#define slotlist_mt_end(a,mt)    slotlist_mt__end(slotlist__sbraw(a), mt)
+
+//
+// internal functions
+//
+#include <string.h>
+
+static inline void
+slotlist_mt__begin(SLOT_ID *raw, Ch_SlotListMT *mt)
+{
+  memset(mt, 0, sizeof(Ch_SlotListMT));
+  mt->committed = mt->ready = raw ? raw[1] : 0;
+}
+
+//
+// Claims up to 'n' elements. A list that's already full is left alone, so the count
+// can only run past the end by what the claims in flight asked for.
+// Returns: The index of the first element, or SLOTLIST_MAX if nothing was granted.
+//
+static inline SLOT_ID
+slotlist_mt__claim(SLOT_ID *raw, Ch_SlotListMT *mt, uint32_t n, uint32_t *got)
+{
+  SLOT_ID m = raw ? raw[0] : 0, at = m;
+  if (raw && n && __atomic_load_n(&raw[1], __ATOMIC_RELAXED) < m)
+    at = __atomic_fetch_add(&raw[1], n, __ATOMIC_RELAXED);
+  *got = at < m ? (n < m - at ? n : m - at) : 0;
+  if (*got < n)
+    __atomic_fetch_add(&mt->dropped, n - *got, __ATOMIC_RELAXED);
+  return *got ? at : SLOTLIST_MAX;
+}
+
+static inline uint32_t
+slotlist_mt__ready(SLOT_ID *raw, Ch_SlotListMT *mt)
+{
+  uint32_t c, n;
+  if (!raw)
+    return 0;
+  c = __atomic_load_n(&mt->committed, __ATOMIC_ACQUIRE);
+  n = __atomic_load_n(&raw[1], __ATOMIC_RELAXED);
+  if (n > raw[0])
+    n = raw[0];
+  if (c == n && c > __atomic_load_n(&mt->ready, __ATOMIC_RELAXED))
+    __atomic_store_n(&mt->ready, c, __ATOMIC_RELAXED);
+  return __atomic_load_n(&mt->ready, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t
+slotlist_mt__end(SLOT_ID *raw, Ch_SlotListMT *mt)
+{
+  if (raw && raw[1] > raw[0])
+    raw[1] = raw[0];
+  mt->ready = raw ? raw[1] : 0;
+  return mt->dropped;
+}
+
+#endif
@@ -18,7 +18,23 @@
 //   uint32_t filled_entries
 //   uint32_t next_free_entry
 //   uint32_t total_free_entries
+//   uint32_t fresh_version
+//   uint32_t trimmed_end
+//   Ch_SlotAlloc *alloc                                (two fields - set by slotmap_init)
 //   user_struct[allocated_entries] items
+//   uint64_t live[(allocated_entries + 63) / 64]      (with SLOTMAP_BITMAP)
+//
+// The 'fresh_version' is the version given to slots as they're first handed out. It starts
+// at zero and only moves when slotmap_trim gives slots back - so that a slot handed out
+// again later can't be mistaken for the one trimmed away. 'trimmed_end' is the end of the
+// slots that have ever been handed out, as of the last trim: the slots between the used
+// count and there have been trimmed away and remember nothing but 'fresh_version'.
+//
+// Versions are a byte and wrap around, as they do in any slot, so the trim can't just
+// take the largest. It marks the next version of each slot it trims (and 'fresh_version',
+// if trimmed slots are still waiting past the end) on the ring of 256 and picks the end of
+// the shortest arc that covers them all. Each of those slots then skips ahead (by no more
+// than it has to) rather than stepping back onto a version it has just handed out.
 //
 // You can't 'push' on to the slot map. Everything is kept unordered.
 // (So you'll need to used linked-list strategies or an external list to order this.)
@@ -34,10 +50,42 @@
 //   vertex arrays. Good for the CPU cache.
 // * Keep memory low? I don't know - there's a 1 byte overhead on each entry.
 //
-// TODO: Size down the slotmap. What I want to do with this is to make the freelist
-// only as big as the difference between the last allocation size and the new
-// allocation size. And once the freelist fills completely, then I'll size the
-// entire list down.
+// ITERATING
+//
+// Free slots hold freelist links rather than elements, so looping from zero to
+// slotmap_used() will run into garbage. slotmap_each only visits live elements. Define
+// SLOTMAP_BITMAP to keep a bit per slot at the end of the block (updated on add and
+// remove) and slotmap_each skips dead slots 64 at a time, or more with SSE2. Without it,
+// slotmap_each builds the same bitmap from the freelist before it starts - with the
+// map's allocator - and if that can't be allocated, it visits nothing and says so.
+//
+// LOOKING UP MANY
+//
+// slotmap_at_many looks up a whole array of IDs at once, writing an element pointer (or
+// NULL) for each, and slotmap_gather copies one field out of each element into a flat
+// array. Both can also set a bit for each ID that wasn't found. On x86-64 with AVX2
+// (checked once, at run time) they check eight IDs at a time - the index against the
+// used count and the version against the top byte - and slotmap_gather loads a 4 or 8
+// byte field along with the versions. Define SLOTMAP_SCALAR to always check them one at
+// a time.
+//
+// The pointers are only worth having while the elements are still in cache, so for a
+// big array of IDs, look up a few hundred at a time and use those before going on
+// (slotmap_gather does this, for other field sizes.) The one-at-a-time loop prefetches
+// the element SLOTMAP_PREFETCH_DISTANCE IDs ahead (0 turns this off.) Without it, that
+// loop was slower than calling slotmap_at - 9.3 against 7.6 ns an ID, with a million
+// elements - and at 32 it's faster: 6.7 ns in cache, 16.2 against 16.9 ns out of it.
+// The AVX2 loop doesn't prefetch, as it only came out slower there.
+//
+// SIZING DOWN
+//
+// A slot map can't move live elements (their IDs are their indexes) but it can let go of
+// the free slots at the end. slotmap_trim does this and sizes the block down to fit. To
+// have removals do it for you, define SLOTMAP_SHOULD_TRIM(count, used) - say, as
+// ((count) < (used) / 4) - and a removal from past the first 'count' slots, while the map
+// is below that mark, will trim it. (Note that the block may then move, as it would on an
+// add.) Removals written inside a slotmap_each block wait, and the map is trimmed once
+// the loop is done.
 //
 // LICENSE
 //
@@ -66,7 +114,11 @@ typedef struct {
 // Free an entire slot map 'a' from memory. This doesn't just free the slot map metadata -
 // everything is freed. Elements are part of the contiguous block of the slot map.
 // Returns: NULL.
-#define slotmap_free(a)       ((a) ? free(a),0 : 0)
+#define slotmap_free(a)       ((a) ? SLOT_ALLOC_FREE(slotmap__al(a), a),0 : 0)
+
+// Create an empty slot map 'a' that gets all of its memory from the Ch_SlotAlloc 'al'.
+// Returns: 1 if the slot map was created, 0 if not.
+#define slotmap_init(a,al)    slotmap__init((uint8_t **)&(a), sizeof(*(a)), al)
 
 // A count of how many entries in the slot map 'a' have been used in the allocation block.
 // Some of these may be freed already, however.
@@ -113,17 +165,108 @@ typedef struct {
 // item in the attached block using name of 'item' for the pointer. The pointer is only
 // provided for final access to the element - please do not store the pointer, it is useless
 // to any subsequent calls.
+// Returns: 1 if the element was removed, 0 if it wasn't found. (Not the pointer, since
+// with SLOTMAP_SHOULD_TRIM the block may have moved.)
 #define slotmap_remove_and(a,id,item,...)  (!a ? 0 : ({ \
   __typeof__(a) item = slotmap_at(a,id); \
   if (item) { \
     __VA_ARGS__; \
-    *((SLOTMAP_FREE *)item) = (SLOTMAP_FREE){item->version + 1, slotmap__frl(a)}; \
+    *((SLOTMAP_FREE *)item) = (SLOTMAP_FREE){(uint32_t)(item->version + 1), slotmap__frl(a)}; \
     slotmap__frl(a) = slotmap_index(id); \
     slotmap__frc(a)++; \
+    slotmap__set_dead(a, sizeof(*(a)), slotmap_index(id)); \
+    slotmap__autotrim(a,id); \
   } \
-  item; \
+  item != NULL; \
 }))
 
+// Make room for 'n' more entries in the slot map 'a', so that the next 'n' adds won't
+// have to grow it. The block is grown (at most) once.
+// Returns: 1 if there's room, 0 if the slot map couldn't be grown.
+#define slotmap_reserve(a,n)  slotmap__reserve((uint8_t **)&(a), sizeof(*(a)), n)
+
+// Add 'n' new entries to the slot map 'a', writing their IDs to the SLOT_ID array 'ids'.
+// Entries come from the freelist first and the block grows at most once. The new entries
+// are left for you to fill in, apart from their versions.
+// Returns: The number of entries added - 'n', or 0 if they couldn't all be added.
+#define slotmap_add_n(a,n,ids) \
+  slotmap__make_n((uint8_t **)&(a), sizeof(*(a)), slotmap__vmask(a), n, ids)
+
+// Remove each of the 'n' entries with SLOT_IDs in the array 'ids' from the slot map 'a'.
+// IDs that aren't found are skipped.
+// Returns: The number of entries removed.
+#define slotmap_remove_n(a,ids,n) (!(a) ? 0 : ({ \
+  SLOT_ID __r__ = slotmap__remove_n((uint8_t *)(a), sizeof(*(a)), ids, n); \
+  if (__r__) \
+    slotmap__autotrim(a, slotmap__use(a)); \
+  __r__; \
+}))
+
+// Look up each of the 'n' SLOT_IDs in the array 'ids' in the slot map 'a', writing a
+// pointer to each element (NULL, for an ID that isn't found) to the array 'out'. If
+// 'invalid' isn't NULL, it's an array of (n + 63) / 64 uint64_t words, and each ID that
+// isn't found gets its bit set there.
+// Returns: The number of IDs found.
+#define slotmap_at_many(a,ids,n,out,invalid) \
+  slotmap__at_many((uint8_t *)(a), sizeof(*(a)), slotmap__vmask(a), ids, n, \
+    (void **)(out), invalid)
+
+// Copy 'size' bytes from 'off' bytes into each element of the slot map 'a' with an ID in
+// the array 'ids' to the next 'size' bytes of 'out' - zeroes, for an ID that isn't
+// found. 'invalid' is as for slotmap_at_many.
+// Returns: The number of IDs found.
+#define slotmap_gather(a,ids,n,off,size,out,invalid) \
+  slotmap__gather((uint8_t *)(a), sizeof(*(a)), slotmap__vmask(a), ids, n, off, size, \
+    (uint8_t *)(out), invalid)
+
+// Copy the struct member 'field' of each element with an ID in 'ids' to 'out', an array
+// of that member's type. (See slotmap_gather.)
+// Returns: The number of IDs found.
+#define slotmap_gather_field(a,ids,n,field,out,invalid) \
+  slotmap_gather(a, ids, n, offsetof(__typeof__(*(a)), field), sizeof((a)->field), out, \
+    invalid)
+
+// Give back the free slots at the end of the slot map 'a' and shrink its allocation to
+// fit. Live elements keep their IDs; IDs of the trimmed slots stay invalid, even once the
+// slots are handed out again (until the version byte comes back around, as in any slot.)
+// Returns: The number of slots released.
+#define slotmap_trim(a)       ((a) ? slotmap__trim((uint8_t **)&(a), sizeof(*(a))) : 0)
+
+// Run the attached block for every live element in the slot map 'a', with 'item' naming
+// a pointer to the element. The freelist is skipped and left alone. You can 'break' and
+// 'continue' as in any loop, and remove the current element - but don't add anything
+// in the block (or trim), since the map may move. With SLOTMAP_SHOULD_TRIM, removals
+// written in the block don't trim - the map is trimmed (if need be) after the loop. A
+// removal made by a function called from the block isn't held back, though, so don't.
+// Returns: 1, or 0 if nothing was visited because the live bitmap couldn't be allocated.
+// (That can't happen with SLOTMAP_BITMAP.)
+#define slotmap_each(a,item,...) ({ \
+  int __ok__ = 1; \
+  if (a) { \
+    enum { slotmap__in_each = 1 }; \
+    SLOT_ID __count__ = slotmap_count(a); \
+    uint64_t *__live__ = slotmap__live((uint8_t *)(a), sizeof(*(a))); \
+    SLOT_ID __n__ = __live__ ? (slotmap__use(a) + 63) / 64 : 0, __w__ = 0; \
+    uint64_t __bits__ = 0; \
+    for (;;) { \
+      if (!__bits__) { \
+        if ((__w__ = slotmap__next_word(__live__, __w__, __n__)) >= __n__) \
+          break; \
+        __bits__ = __live__[__w__++]; \
+      } \
+      __typeof__(a) item = slotmap_array(a) + \
+        ((__w__ - 1) * 64 + __builtin_ctzll(__bits__)); \
+      __bits__ &= __bits__ - 1; \
+      __VA_ARGS__; \
+    } \
+    if ((__ok__ = __live__ != NULL)) \
+      slotmap__live_done(a, __live__); \
+    if (slotmap_count(a) < __count__) \
+      slotmap__trim_if(a, slotmap__use(a)); \
+  } \
+  __ok__; \
+})
+
 // Burn the slotmap's freelist (useful to do before looping the structure as an
 // array, to avoid garbled entries which are from the freelist.) I call this
 // 'burn' because it's destructive: we can't regain these entries unless we
@@ -141,7 +284,7 @@ typedef struct {
 }))
 
 // Fetch the beginning of the actual items.
-#define slotmap_array(a)      ((__typeof__(a))(((SLOT_ID *)(a)) + 4))
+#define slotmap_array(a)      ((__typeof__(a))(((SLOT_ID *)(a)) + SLOTMAP__HDR))
 
 //
 // internal macros
@@ -151,6 +294,61 @@ typedef struct {
 #define slotmap__use(a)       ((SLOT_ID *)(a))[1]
 #define slotmap__frl(a)       ((SLOT_ID *)(a))[2]
 #define slotmap__frc(a)       ((SLOT_ID *)(a))[3]
+#define slotmap__gen(a)       ((SLOT_ID *)(a))[4]
+#define slotmap__end(a)       ((SLOT_ID *)(a))[5]
+#define slotmap__al(a)        (*(Ch_SlotAlloc **)((SLOT_ID *)(a) + 6))
+#define SLOTMAP__HDR          8
+
+//
+// The bits of an element's first word that hold its version. The version has to be in
+// the first word (the freelist link overwrites it there) but it can be any width.
+//
+#define slotmap__vmask(a)     ({ \
+  __typeof__(*(a)) __v__; \
+  uint32_t __m__; \
+  memset(&__v__, 0, sizeof(__v__)); \
+  __v__.version = ~__v__.version; \
+  memcpy(&__m__, &__v__, sizeof(__m__)); \
+  __m__; \
+})
+
+// How many IDs ahead slotmap_at_many prefetches, without AVX2.
+#ifndef SLOTMAP_PREFETCH_DISTANCE
+#define SLOTMAP_PREFETCH_DISTANCE 32
+#endif
+
+//
+// The byte size of a block with room for 'n' elements. The live bitmap starts on the
+// first eight-byte boundary after the elements.
+//
+#define slotmap__items_size(n,isz) ((((size_t)(n) * (isz)) + 7) & ~(size_t)7)
+#ifdef SLOTMAP_BITMAP
+#define slotmap__bits_size(n)      ((((size_t)(n) + 63) / 64) * sizeof(uint64_t))
+#define slotmap__bits(a,isz)       \
+  ((uint64_t *)(slotmap_array((uint8_t *)(a)) + slotmap__items_size(slotmap__siz(a), isz)))
+#define slotmap__set_live(a,isz,i) (slotmap__bits(a, isz)[(i) / 64] |= 1ULL << ((i) % 64))
+#define slotmap__set_dead(a,isz,i) (slotmap__bits(a, isz)[(i) / 64] &= ~(1ULL << ((i) % 64)))
+#define slotmap__live_done(a,live) ((void)0)
+#else
+#define slotmap__bits_size(n)      0
+#define slotmap__set_live(a,isz,i) ((void)0)
+#define slotmap__set_dead(a,isz,i) ((void)0)
+#define slotmap__live_done(a,live) SLOT_ALLOC_FREE(slotmap__al(a), live)
+#endif
+#define slotmap__size(n,isz)       \
+  ((sizeof(SLOT_ID) * SLOTMAP__HDR) + slotmap__items_size(n, isz) + slotmap__bits_size(n))
+
+// slotmap_each shadows this with 1, so removals written in its block leave the trim to it.
+enum { slotmap__in_each = 0 };
+
+#ifdef SLOTMAP_SHOULD_TRIM
+#define slotmap__trim_if(a,id)  (void)(slotmap_index(id) >= slotmap_count(a) && \
+  SLOTMAP_SHOULD_TRIM(slotmap_count(a), slotmap__use(a)) ? slotmap_trim(a) : 0)
+#define slotmap__autotrim(a,id) (void)(slotmap__in_each ? 0 : (slotmap__trim_if(a,id), 0))
+#else
+#define slotmap__trim_if(a,id)  (void)0
+#define slotmap__autotrim(a,id) (void)0
+#endif
 
 #define slotmap__new(a,id,...)     ({ \
   __typeof__(a) __item__ = (__typeof__(a))slotmap__make((uint8_t **)&a, sizeof(*(a)), &id); \
@@ -161,7 +359,139 @@ typedef struct {
   __item__; \
 })
 
+#include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__SSE2__) && !defined(SLOTMAP_SCALAR)
+#define SLOTMAP__X86 1
+#include <immintrin.h>
+#endif
+
+#ifdef SLOTMAP_BITMAP
+//
+// Moves the live bitmap of a block sized for 'from' elements to where it belongs in a
+// block sized for 'to' elements, clearing any new words.
+//
+static inline void
+slotmap__move_bits(uint8_t *arr, size_t itemsize, SLOT_ID from, SLOT_ID to)
+{
+  uint8_t *items = slotmap_array(arr);
+  size_t keep = slotmap__bits_size(from < to ? from : to);
+  memmove(items + slotmap__items_size(to, itemsize),
+    items + slotmap__items_size(from, itemsize), keep);
+  memset(items + slotmap__items_size(to, itemsize) + keep, 0,
+    slotmap__bits_size(to) - keep);
+}
+#endif
+
+//
+// Gets a bitmap with a bit set for each live slot. Without SLOTMAP_BITMAP, this is built
+// from the freelist, in memory from the map's allocator, and must be handed to
+// slotmap__live_done.
+// Returns: The bitmap or NULL if it couldn't be allocated.
+//
+static inline uint64_t *
+slotmap__live(uint8_t *arr, size_t itemsize)
+{
+#ifdef SLOTMAP_BITMAP
+  return slotmap__bits(arr, itemsize);
+#else
+  uint8_t *items = slotmap_array(arr);
+  SLOT_ID used = slotmap__use(arr), x;
+  uint64_t *live = (uint64_t *)SLOT_ALLOC_REALLOC(slotmap__al(arr), NULL,
+    ((used + 63) / 64 + 1) * sizeof(uint64_t));
+  if (!live)
+    return NULL;
+  for (x = 0; x < used / 64; x++)
+    live[x] = ~0ULL;
+  if (used % 64)
+    live[x] = (1ULL << (used % 64)) - 1;
+  for (x = slotmap__frl(arr); slotmap_index(x) != SLOTMAP_MAX_ID;
+       x = ((SLOTMAP_FREE *)(items + x * itemsize))->next_free)
+    live[x / 64] &= ~(1ULL << (x % 64));
+  return live;
+#endif
+}
+
+//
+// Finds the next word at or after 'w' in the bitmap 'live' of 'n' words that has any bits
+// set, checking two words at a time where SSE2 is around.
+// Returns: The index of the word, or 'n' if there isn't one.
+//
+static inline SLOT_ID
+slotmap__next_word(const uint64_t *live, SLOT_ID w, SLOT_ID n)
+{
+#ifdef __SSE2__
+  for (; w + 2 <= n; w += 2) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(live + w));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xFFFF)
+      break;
+  }
+#endif
+  while (w < n && !live[w])
+    w++;
+  return w;
+}
+
+//
+// Reallocates the block to hold 'n' elements (or more, if the alignment leaves room),
+// setting up the header of a new block.
+// Returns: 1 if the block was resized, 0 if it couldn't be.
+//
+static inline int
+slotmap__resize(uint8_t **ary, size_t itemsize, SLOT_ID n)
+{
+  uint8_t *arr = *ary;
+  SLOT_ID *p;
+  size_t newsiz = SLOT_ALIGN(slotmap__size(n, itemsize), SLOT_ALIGN_SIZE);
+#ifdef SLOTMAP_BITMAP
+  SLOT_ID siz = arr ? slotmap__siz(arr) : 0;
+  if (arr && n < siz) {
+    slotmap__move_bits(arr, itemsize, siz, n);
+    slotmap__siz(arr) = n;
+  }
+#endif
+  size_t oldsiz = arr ? slotmap__size(slotmap__siz(arr), itemsize) : 0;
+  p = (SLOT_ID *)SLOT_ALLOC_REALLOC(arr ? slotmap__al(arr) : NULL, arr, newsiz);
+  if (!p)
+    return 0;
+  SLOT_STAT(grows, 1);
+  SLOT_STAT(grow_bytes, oldsiz);
+  SLOT_TRACE(grow, oldsiz, newsiz);
+  if (!arr) {
+    memset(p, 0, sizeof(SLOT_ID) * SLOTMAP__HDR);
+    p[2] = SLOT_NONE_ID;
+  }
+#ifdef SLOTMAP_BITMAP
+  if (n > siz)
+    slotmap__move_bits((uint8_t *)p, itemsize, siz, n);
+  p[0] = n;
+#else
+  p[0] = (newsiz - (sizeof(SLOT_ID) * SLOTMAP__HDR)) / itemsize;
+#endif
+  *ary = (uint8_t *)p;
+  return 1;
+}
+
+//
+// Creates an empty block (just the header) that gets its memory from 'al'.
+// Returns: 1 if the block was created, 0 if not.
+//
+static inline int
+slotmap__init(uint8_t **ary, size_t itemsize, Ch_SlotAlloc *al)
+{
+  SLOT_ID *p = (SLOT_ID *)SLOT_ALLOC_REALLOC(al, NULL,
+    SLOT_ALIGN(slotmap__size(0, itemsize), SLOT_ALIGN_SIZE));
+  if (p) {
+    memset(p, 0, sizeof(SLOT_ID) * SLOTMAP__HDR);
+    p[2] = SLOT_NONE_ID;
+    slotmap__al(p) = al;
+  }
+  *ary = (uint8_t *)p;
+  return p != NULL;
+}
 
 //
 // Makes room for a new element.
@@ -171,9 +501,8 @@ static inline uint8_t *
 slotmap__make(uint8_t **ary, size_t itemsize, SLOT_ID *idp)
 {
   uint8_t *arr = *ary;
-  SLOT_ID *p;
   SLOT_ID x;
-  size_t used = 0, siz = 0, newsiz = 0;
+  size_t used = 0, siz = 0;
 
   //
   // Reuse from the freelist.
@@ -185,6 +514,8 @@ slotmap__make(uint8_t **ary, size_t itemsize, SLOT_ID *idp)
       *idp = slotmap__id(x, free_item->version);
       slotmap__frc(arr)--;
       slotmap__frl(arr) = free_item->next_free;
+      slotmap__set_live(arr, itemsize, x);
+      SLOT_STAT(freelist_hits, 1);
       return (uint8_t *)free_item;
     } else {
       siz = slotmap__siz(arr);
@@ -195,33 +526,357 @@ slotmap__make(uint8_t **ary, size_t itemsize, SLOT_ID *idp)
   //
   // Allocate additional space
   //
-  newsiz = SLOT_ALIGN(
-    (SLOT_FLEX_SIZE(siz) * itemsize) +
-    (sizeof(SLOT_ID) * 4), SLOT_ALIGN_SIZE);
-  if (used == siz) {
-    p = (SLOT_ID *)SLOT_REALLOC(arr, newsiz);
-    x = (newsiz - (sizeof(SLOT_ID) * 4)) / itemsize;
-    *ary = (uint8_t *)p;
-    p[0] = x;
-  } else {
-    p = (SLOT_ID *)arr;
+  if (used == siz && !slotmap__resize(ary, itemsize, SLOT_FLEX_SIZE(siz))) {
+    *idp = SLOT_NONE_ID;
+    return NULL;
   }
 
   //
   // Expand the array by one element and give back an ID.
   //
-  if (p) {
-    if (!arr) {
-      p[1] = p[3] = 0;
-      p[2] = SLOT_NONE_ID;
+  arr = *ary;
+  SLOT_STAT(freelist_misses, 1);
+  x = slotmap__use(arr)++;
+  *idp = slotmap__id(x, slotmap__gen(arr));
+  slotmap__set_live(arr, itemsize, x);
+  return slotmap_array(arr) + (x * itemsize);
+}
+
+//
+// Makes sure 'n' more elements can be added without growing the block.
+// Returns: 1 if there's room, 0 if the block couldn't be grown.
+//
+static inline int
+slotmap__reserve(uint8_t **ary, size_t itemsize, SLOT_ID n)
+{
+  uint8_t *arr = *ary;
+  SLOT_ID frc = arr ? slotmap__frc(arr) : 0, siz = arr ? slotmap__siz(arr) : 0;
+  uint64_t need = (arr ? slotmap__use(arr) : 0) + (n > frc ? n - frc : 0);
+  SLOT_ID grow = siz;
+  if (need > SLOTMAP_MAX_ID)
+    return 0;
+  if (arr && need <= siz)
+    return 1;
+  while (grow < need)
+    grow = SLOT_FLEX_SIZE(grow);
+  return slotmap__resize(ary, itemsize, grow);
+}
+
+//
+// Adds 'n' elements, taking what it can from the freelist and the rest from the end, and
+// writes their IDs to 'ids'. Nothing is added unless all of them can be. Each slot gets
+// its version written into the bits 'vmask' of its first word - for a slot from the
+// freelist, that clears the link that shared the word with it.
+// Returns: The number of elements added.
+//
+static inline SLOT_ID
+slotmap__make_n(uint8_t **ary, size_t itemsize, uint32_t vmask, SLOT_ID n, SLOT_ID *ids)
+{
+  uint8_t *arr, *items;
+  SLOT_ID i = 0, x, gen;
+  uint32_t v, w, shift = __builtin_ctz(vmask);
+  if (n == 0 || !slotmap__reserve(ary, itemsize, n))
+    return 0;
+
+  arr = *ary;
+  items = slotmap_array(arr);
+  for (x = slotmap__frl(arr); i < n && slotmap_index(x) != SLOTMAP_MAX_ID; i++) {
+    SLOTMAP_FREE *free_item = (SLOTMAP_FREE *)(items + (x * itemsize));
+    SLOT_ID next = free_item->next_free, ver = free_item->version;
+    ids[i] = slotmap__id(x, ver);
+    memcpy(&v, free_item, sizeof(v));
+    v = (v & ~vmask) | ((ver << shift) & vmask);
+    memcpy(free_item, &v, sizeof(v));
+    slotmap__set_live(arr, itemsize, x);
+    x = next;
+  }
+  slotmap__frl(arr) = x;
+  slotmap__frc(arr) -= i;
+  gen = slotmap__gen(arr);
+  w = (gen << shift) & vmask;
+  for (x = slotmap__use(arr); i < n; i++, x++) {
+    ids[i] = slotmap__id(x, gen);
+    memcpy(&v, items + x * itemsize, sizeof(v));
+    v = (v & ~vmask) | w;
+    memcpy(items + x * itemsize, &v, sizeof(v));
+    slotmap__set_live(arr, itemsize, x);
+  }
+  slotmap__use(arr) = x;
+  return n;
+}
+
+//
+// Removes each of the 'n' elements in 'ids' that's still in the map.
+// Returns: The number of elements removed.
+//
+static inline SLOT_ID
+slotmap__remove_n(uint8_t *arr, size_t itemsize, const SLOT_ID *ids, SLOT_ID n)
+{
+  SLOT_ID i, removed = 0;
+  for (i = 0; i < n; i++) {
+    SLOT_ID x = slotmap_index(ids[i]);
+    SLOTMAP_FREE *item;
+    if (x >= slotmap__use(arr))
+      continue;
+    item = (SLOTMAP_FREE *)(slotmap_array(arr) + (x * itemsize));
+    if (item->version != (ids[i] >> 24))
+      continue;
+    *item = (SLOTMAP_FREE){(uint32_t)(item->version + 1), slotmap__frl(arr)};
+    slotmap__frl(arr) = x;
+    slotmap__set_dead(arr, itemsize, x);
+    removed++;
+  }
+  slotmap__frc(arr) += removed;
+  return removed;
+}
+
+#ifdef SLOTMAP__X86
+static inline int
+slotmap__avx2(void)
+{
+  static int has = -1;
+  if (has < 0) {
+    __builtin_cpu_init();
+    has = __builtin_cpu_supports("avx2") ? 1 : 0;
+  }
+  return has;
+}
+
+//
+// Checks eight IDs at a time: the index is masked off and compared with the used count,
+// the first word of each element that's in range is gathered and its version compared
+// with the top byte of the ID. With a 'size' of zero, pointers are built by adding the
+// byte offsets to 'items' and masking out the lanes that failed; with a 'size' of 4 or
+// 8, the field at 'off' is gathered straight into 'out' (as zero, in those lanes.)
+// Returns: The number of IDs found, with 'out' and 'invalid' filled in up to a multiple
+// of eight.
+//
+__attribute__((target("avx2"))) static inline SLOT_ID
+slotmap__at_many_avx2(uint8_t *items, SLOT_ID used, size_t itemsize, uint32_t vmask,
+  const SLOT_ID *ids, SLOT_ID n, size_t off, size_t size, void *out, uint64_t *invalid)
+{
+  const __m256i index = _mm256_set1_epi32(SLOTMAP_MAX_ID), usedv = _mm256_set1_epi32(used),
+    isize = _mm256_set1_epi32((int)itemsize), mask = _mm256_set1_epi32((int)vmask),
+    base = _mm256_set1_epi64x((long long)(uintptr_t)items), zero = _mm256_setzero_si256();
+  const __m128i shift = _mm_cvtsi32_si128(__builtin_ctz(vmask));
+  SLOT_ID i, found = 0;
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m256i id = _mm256_loadu_si256((const __m256i *)(ids + i));
+    __m256i x = _mm256_and_si256(id, index);
+    __m256i ok = _mm256_cmpgt_epi32(usedv, x);
+    __m256i at = _mm256_mullo_epi32(x, isize);
+    __m256i v = _mm256_mask_i32gather_epi32(zero, (const int *)items, at, ok, 1);
+    v = _mm256_srl_epi32(_mm256_and_si256(v, mask), shift);
+    ok = _mm256_and_si256(ok, _mm256_cmpeq_epi32(v, _mm256_srli_epi32(id, 24)));
+    __m128i at_lo = _mm256_castsi256_si128(at), at_hi = _mm256_extracti128_si256(at, 1);
+    __m256i ok_lo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(ok)),
+      ok_hi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(ok, 1));
+    if (size == 4) {
+      v = _mm256_mask_i32gather_epi32(zero, (const int *)(items + off), at, ok, 1);
+      _mm256_storeu_si256((__m256i *)((uint32_t *)out + i), v);
+    } else if (size == 8) {
+      const long long *field = (const long long *)(items + off);
+      _mm256_storeu_si256((__m256i *)((uint64_t *)out + i),
+        _mm256_mask_i32gather_epi64(zero, field, at_lo, ok_lo, 1));
+      _mm256_storeu_si256((__m256i *)((uint64_t *)out + i + 4),
+        _mm256_mask_i32gather_epi64(zero, field, at_hi, ok_hi, 1));
+    } else {
+      __m256i lo = _mm256_add_epi64(base, _mm256_cvtepu32_epi64(at_lo));
+      __m256i hi = _mm256_add_epi64(base, _mm256_cvtepu32_epi64(at_hi));
+      _mm256_storeu_si256((__m256i *)((void **)out + i), _mm256_and_si256(lo, ok_lo));
+      _mm256_storeu_si256((__m256i *)((void **)out + i + 4), _mm256_and_si256(hi, ok_hi));
+    }
+    uint32_t m = _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+    found += __builtin_popcount(m);
+    if (invalid)
+      invalid[i / 64] |= (uint64_t)(~m & 0xFF) << (i % 64);
+  }
+  return found;
+}
+#endif
+
+//
+// Looks up each of the 'n' IDs, as slotmap_at does, comparing the version bits 'vmask' of
+// each element's first word with the top byte of its ID.
+// Returns: The number of IDs found.
+//
+static inline SLOT_ID
+slotmap__at_many(uint8_t *arr, size_t itemsize, uint32_t vmask, const SLOT_ID *ids,
+  SLOT_ID n, void **out, uint64_t *invalid)
+{
+  uint8_t *items = arr ? slotmap_array(arr) : NULL;
+  SLOT_ID used = arr ? slotmap__use(arr) : 0, i = 0, found = 0, d = SLOTMAP_PREFETCH_DISTANCE;
+  uint32_t shift = __builtin_ctz(vmask);
+  uint64_t bits = 0;
+  if (invalid)
+    memset(invalid, 0, ((n + 63) / 64) * sizeof(uint64_t));
+#ifdef SLOTMAP__X86
+  //
+  // The gather takes 32-bit signed offsets, so a block over 2GB is left to the loop.
+  //
+  if (used && (uint64_t)used * itemsize <= INT32_MAX && slotmap__avx2()) {
+    found = slotmap__at_many_avx2(items, used, itemsize, vmask, ids, n, 0, 0, out, invalid);
+    i = n & ~(SLOT_ID)7;
+  }
+#endif
+  for (; i < n; i++) {
+    SLOT_ID x = slotmap_index(ids[i]);
+    uint8_t *item = NULL;
+    uint32_t w;
+    if (d && i + d < n && slotmap_index(ids[i + d]) < used)
+      __builtin_prefetch(items + (size_t)slotmap_index(ids[i + d]) * itemsize);
+    if (x < used) {
+      memcpy(&w, items + (size_t)x * itemsize, sizeof(w));
+      if (((w & vmask) >> shift) == (ids[i] >> 24))
+        item = items + (size_t)x * itemsize;
+    }
+    out[i] = item;
+    found += item != NULL;
+    bits |= (uint64_t)(item == NULL) << (i % 64);
+    if (i % 64 == 63 || i + 1 == n) {
+      if (invalid)
+        invalid[i / 64] |= bits;
+      bits = 0;
     }
-    *idp = x = p[1]++;
-    arr = *ary;
-    return slotmap_array(arr) + (x * itemsize);
   }
+  return found;
+}
+
+//
+// Copies 'size' bytes of an element, with the common sizes as fixed-size copies.
+//
+static inline void
+slotmap__copy(uint8_t *dst, const uint8_t *src, size_t size)
+{
+  switch (size) {
+    case 4: memcpy(dst, src, 4); break;
+    case 8: memcpy(dst, src, 8); break;
+    case 12: memcpy(dst, src, 12); break;
+    case 16: memcpy(dst, src, 16); break;
+    default: memcpy(dst, src, size); break;
+  }
+}
+
+//
+// Looks up the IDs a run at a time with slotmap__at_many, then copies the field out of
+// each element in the run. With AVX2, 4 and 8 byte fields are gathered along with the
+// versions instead, and only the last few IDs are left to the runs.
+// Returns: The number of IDs found.
+//
+static inline SLOT_ID
+slotmap__gather(uint8_t *arr, size_t itemsize, uint32_t vmask, const SLOT_ID *ids,
+  SLOT_ID n, size_t off, size_t size, uint8_t *out, uint64_t *invalid)
+{
+  void *p[256];
+  SLOT_ID i = 0, j, k, found = 0;
+#ifdef SLOTMAP__X86
+  SLOT_ID used = arr ? slotmap__use(arr) : 0;
+  if ((size == 4 || size == 8) && used && (uint64_t)used * itemsize <= INT32_MAX &&
+      slotmap__avx2()) {
+    if (invalid)
+      memset(invalid, 0, ((n + 63) / 64) * sizeof(uint64_t));
+    found = slotmap__at_many_avx2(slotmap_array(arr), used, itemsize, vmask, ids, n, off,
+      size, out, invalid);
+    i = n & ~(SLOT_ID)7;
+    out += i * size;
+  }
+#endif
+  for (; i < n; i += k) {
+    //
+    // A run that doesn't start on a word of 'invalid' is the tail after the gathers
+    // (fewer than eight IDs) and gets its bits shifted in.
+    //
+    uint64_t tail = 0;
+    k = n - i < 256 ? n - i : 256;
+    found += slotmap__at_many(arr, itemsize, vmask, ids + i, k, p,
+      !invalid ? NULL : i % 64 ? &tail : invalid + i / 64);
+    if (invalid)
+      invalid[i / 64] |= tail << (i % 64);
+    for (j = 0; j < k; j++, out += size) {
+      if (p[j])
+        slotmap__copy(out, (uint8_t *)p[j] + off, size);
+      else
+        memset(out, 0, size);
+    }
+  }
+  return found;
+}
+
+//
+// Finds the end of the shortest arc of the version ring that covers every version set in
+// the 256-bit 'seen' - the version just before the widest gap. There has to be one.
+// Returns: The version.
+//
+static inline SLOT_ID
+slotmap__arc_end(const uint64_t *seen)
+{
+  int v, first = -1, prev = -1, gap = -1;
+  SLOT_ID end = 0;
+  for (v = 0; v < 256; v++) {
+    if (!((seen[v / 64] >> (v % 64)) & 1))
+      continue;
+    if (first < 0)
+      first = v;
+    else if (v - prev > gap)
+      gap = v - prev, end = prev;
+    prev = v;
+  }
+  if (first + 256 - prev > gap)
+    end = prev;
+  return end;
+}
+
+//
+// Releases the run of free slots at the end of the map.
+// Returns: The number of slots released.
+//
+static inline SLOT_ID
+slotmap__trim(uint8_t **ary, size_t itemsize)
+{
+  uint8_t *arr = *ary, *items = slotmap_array(arr);
+  SLOT_ID used = slotmap__use(arr), keep = used, x;
+  SLOTMAP_FREE *prev = NULL;
+  uint64_t *live, seen[4] = {0};
 
-  *idp = SLOT_NONE_ID;
-  return NULL;
+  //
+  // Find where the trailing run of free slots starts.
+  //
+  if (!slotmap__frc(arr) || !(live = slotmap__live(arr, itemsize)))
+    return 0;
+  while (keep > 0 && !((live[(keep - 1) / 64] >> ((keep - 1) % 64)) & 1))
+    keep--;
+  slotmap__live_done(arr, live);
+  if (keep == used)
+    return 0;
+
+  //
+  // Unlink the trimmed slots from the freelist, marking the version each would have
+  // been handed out at next. Slots trimmed before, which are still past the end, are
+  // waiting on the fresh version.
+  //
+  if (slotmap__end(arr) > used)
+    seen[slotmap__gen(arr) / 64] |= 1ULL << (slotmap__gen(arr) % 64);
+  for (x = slotmap__frl(arr); slotmap_index(x) != SLOTMAP_MAX_ID; ) {
+    SLOTMAP_FREE *free_item = (SLOTMAP_FREE *)(items + x * itemsize);
+    SLOT_ID next = free_item->next_free;
+    if (x >= keep) {
+      seen[free_item->version / 64] |= 1ULL << (free_item->version % 64);
+      if (prev)
+        prev->next_free = next;
+      else
+        slotmap__frl(arr) = next;
+      slotmap__frc(arr)--;
+    } else {
+      prev = free_item;
+    }
+    x = next;
+  }
+  slotmap__gen(arr) = slotmap__arc_end(seen);
+  if (slotmap__end(arr) < used)
+    slotmap__end(arr) = used;
+  slotmap__use(arr) = keep;
+  slotmap__resize(ary, itemsize, keep);
+  return used - keep;
 }
 
 #endif
@@ -3,13 +3,41 @@
 //
 // This is a larger slotmap, designed to use 64-bit IDs. This allows for more
 // storage space and fewer version number conflicts. (See slotmap.h for details,
-// of the internals are identical, with the exception of the increased sizing.)
+// of the internals are identical, with the exception of the increased sizing
+// and the pages - see below.)
 //
 // PLEASE NOTE! IT IS CRUCIAL that your stored structure be at least 8 bytes
 // (64-bit) in size. I mean this makes sense: why pass around 64-bit IDs to
 // a structure that is smaller than 64-bit? Sure, for boxing primitives, but
 // still - make the box at least 64-bit in size (including the version number).
 //
+// PAGES
+//
+// At this size, growing a single block would copy gigabytes at a time. So the elements
+// are kept in fixed-size pages of SLOTMAP64_PAGE_ITEMS elements each, and the slot map
+// itself is just a small block with the header and a directory of pages:
+//
+//   uint32_t pages_allocated
+//   uint32_t filled_entries
+//   uint32_t next_free_entry
+//   uint32_t total_free_entries
+//   uint32_t pages
+//   uint32_t reserved
+//   Ch_SlotAlloc *alloc                (two fields - set by slotmap64_init)
+//   user_struct *page[pages_allocated]
+//
+// Growth adds a page and, now and then, reallocates the directory. (Both through the
+// allocator, if slotmap64_init was given one.) Pages never move, so
+// a pointer to an element stays good until the element is removed. (The slot map pointer
+// itself may still move on an add.)
+//
+// Each page starts on a multiple of the largest power of two that fits in it, and just
+// before it is a Ch_SlotPage64 holding its number. So an element's address, rounded down
+// to that power of two, lands either on its own page or inside it, one step past the
+// start - slotmap64_id tries both, checking each against the directory, and never has to
+// search for the page. The price is that each page is allocated with up to its own size
+// again in slack (address space that's never touched.)
+//
 // LICENSE
 //
 //   This software is dual-licensed to the public domain and under the following
@@ -31,15 +59,31 @@ typedef struct {
   uint32_t next_free;
 } SLOTMAP64_FREE;
 
+typedef struct {
+  void *block;                    // what the allocator handed back, for freeing
+  uint32_t page;
+  uint32_t reserved;
+} Ch_SlotPage64;
+
+// The number of elements in each page, as a power of two.
+#ifndef SLOTMAP64_PAGE_BITS
+#define SLOTMAP64_PAGE_BITS     12
+#endif
+#define SLOTMAP64_PAGE_ITEMS    (1U << SLOTMAP64_PAGE_BITS)
+
 // The maximum element index for a slot map.
 #define SLOTMAP64_MAX_INDEX     UINT32_MAX
 
 #define SLOTMAP64_NONE_ID       slotmap64__id(UINT32_MAX, UINT32_MAX)
 
 // Free an entire slot map 'a' from memory. This doesn't just free the slot map metadata -
-// everything is freed. Elements are part of the contiguous block of the slot map.
+// every page of elements is freed too.
 // Returns: NULL.
-#define slotmap64_free(a)       ((a) ? free(a),0 : 0)
+#define slotmap64_free(a)       ((a) ? slotmap64__free((uint8_t *)(a)),0 : 0)
+
+// Create an empty slot map 'a' that gets its directory and pages from the Ch_SlotAlloc 'al'.
+// Returns: 1 if the slot map was created, 0 if not.
+#define slotmap64_init(a,al)    slotmap64__init((uint8_t **)&(a), al)
 
 // A count of how many entries in the slot map 'a' have been used in the allocation block.
 // Some of these may be freed already, however.
@@ -51,8 +95,8 @@ typedef struct {
 #define slotmap64_count(a)      ((a) ? slotmap64__use(a) - slotmap64__frc(a) : 0)
 
 // A count of how many entries the slot map 'a' already has allocated space for.
-// Returns: A uint32_t.
-#define slotmap64_allocated(a)  ((a) ? slotmap64__siz(a) : 0)
+// Returns: A uint64_t.
+#define slotmap64_allocated(a)  ((a) ? (uint64_t)slotmap64__pgs(a) << SLOTMAP64_PAGE_BITS : 0)
 
 // Add a new entry in the slot map 'a' and set SLOTMAP64_ID variable 'id' to the ID of the new entry.
 // Returns: A pointer to the new item or NULL if the slot map has reached its maximum.
@@ -63,50 +107,63 @@ typedef struct {
 #define slotmap64_copy(a,o,id)  slotmap64__new(a,id, { *__item__ = *((__typeof__(a))o); })
 
 // Determine an element's ID by supplying the slot map 'a' that contains it and a pointer 'o'
-// to the element itself.
+// to the element itself. 'o' must be an element of 'a'.
 // Returns: A SLOTMAP64_ID.
-#define slotmap64_id(a,o)       slotmap64__id((o)-slotmap64_array(a), (o)->version)
+#define slotmap64_id(a,o)       \
+  slotmap64__id(slotmap64__index((uint8_t *)(a), sizeof(*(a)), (uint8_t *)(o)), (o)->version)
 
 // Get a pointer to an element by supplying the slot map 'a' that contains it and its SLOTMAP64_ID 'id'.
 // Returns: A pointer to the element or NULL if the element is not found.
 #define slotmap64_at(a,id)     (!a ? 0 : ({ \
   __typeof__(a) __item__ = NULL; \
   if ((id).index < slotmap64__use(a)) { \
-    __item__ = slotmap64_array(a) + (id).index; \
+    __item__ = slotmap64__item(a, (id).index); \
     __item__ = (__item__->version != (id).version ? NULL : __item__); \
   } \
   __item__; \
 }))
 
 // Removes an element with SLOTMAP64_ID 'id' from the slot map 'a'.
-#define slotmap_remove(a,id)  slotmap_remove_and(a,id,__item__,{})
+#define slotmap64_remove(a,id)  slotmap64_remove_and(a,id,__item__,{})
 
 // Removes an element with SLOTMAP64_ID 'id' from the slot map 'a' and handles the
 // item in the attached block using name of 'item' for the pointer. The pointer is only
 // provided for final access to the element - please do not store the pointer, it is useless
 // to any subsequent calls.
 #define slotmap64_remove_and(a,id,item,...)  (!a ? 0 : ({ \
-  __typeof__(a) __item__ = slotmap64_at(a,id); \
-  if (__item__) { \
+  __typeof__(a) item = slotmap64_at(a,id); \
+  if (item) { \
     __VA_ARGS__; \
-    *((SLOTMAP64_FREE *)__item__) = (SLOTMAP64_FREE){__item__->version + 1, slotmap64__frl(a)}; \
+    *((SLOTMAP64_FREE *)item) = (SLOTMAP64_FREE){item->version + 1, slotmap64__frl(a)}; \
     slotmap64__frl(a) = (id).index; \
-    slotmap64__frc(c)++; \
+    slotmap64__frc(a)++; \
   } \
-  __item__; \
+  item; \
 }))
 
-// Fetch the beginning of the actual items.
-#define slotmap64_array(a)      ((__typeof__(a))(((uint32_t *)(a)) + 4))
+// The number of pages in the slot map 'a'.
+// Returns: A uint32_t.
+#define slotmap64_pages(a)      ((a) ? slotmap64__pgs(a) : 0)
+
+// Fetch the first of the SLOTMAP64_PAGE_ITEMS elements in page 'n' of the slot map 'a'.
+// (Like slotmap_array, this includes free slots.)
+#define slotmap64_page(a,n)     ((__typeof__(a))slotmap64__dir(a)[n])
 
 //
 // internal macros
 //
 #define slotmap64__id(index,v)  ((SLOTMAP64_ID){index, v})
-#define slotmap64__siz(a)       ((uint32_t *)(a))[0]
+#define slotmap64__cap(a)       ((uint32_t *)(a))[0]
 #define slotmap64__use(a)       ((uint32_t *)(a))[1]
 #define slotmap64__frl(a)       ((uint32_t *)(a))[2]
 #define slotmap64__frc(a)       ((uint32_t *)(a))[3]
+#define slotmap64__pgs(a)       ((uint32_t *)(a))[4]
+#define slotmap64__al(a)        (*(Ch_SlotAlloc **)(((uint32_t *)(a)) + 6))
+#define slotmap64__dir(a)       ((uint8_t **)(((uint32_t *)(a)) + 8))
+#define slotmap64__page(p)      (((Ch_SlotPage64 *)(p)) - 1)
+#define slotmap64__span(size)   ((size_t)1 << (63 - __builtin_clzll((uint64_t)(size))))
+#define slotmap64__item(a,x)    \
+  (slotmap64_page(a, (x) >> SLOTMAP64_PAGE_BITS) + ((x) & (SLOTMAP64_PAGE_ITEMS - 1)))
 
 #define slotmap64__new(a,id,...)     ({ \
   __typeof__(a) __item__ = (__typeof__(a))slotmap64__make((uint8_t **)&a, sizeof(*(a)), &id); \
@@ -117,8 +174,26 @@ typedef struct {
   __item__; \
 })
 
+#include <stdlib.h>
 #include <string.h>
 
+//
+// Creates an empty directory that gets its memory from 'al'.
+// Returns: 1 if the directory was created, 0 if not.
+//
+static inline int
+slotmap64__init(uint8_t **ary, Ch_SlotAlloc *al)
+{
+  uint8_t *p = (uint8_t *)SLOT_ALLOC_REALLOC(al, NULL, sizeof(uint32_t) * 8);
+  if (p) {
+    memset(p, 0, sizeof(uint32_t) * 8);
+    slotmap64__frl(p) = SLOTMAP64_MAX_INDEX;
+    slotmap64__al(p) = al;
+  }
+  *ary = p;
+  return p != NULL;
+}
+
 //
 // Makes room for a new element.
 // Returns: A pointer to the new object or NULL if no further objects could be created.
@@ -126,10 +201,8 @@ typedef struct {
 static inline uint8_t *
 slotmap64__make(uint8_t **ary, size_t itemsize, SLOTMAP64_ID *idp)
 {
-  uint8_t *arr = *ary;
-  uint32_t *p;
-  uint32_t x;
-  size_t used = 0, siz = 0, newsiz = 0;
+  uint8_t *arr = *ary, *block, *page;
+  uint32_t x, pgs = 0, cap = 0;
 
   //
   // Reuse from the freelist.
@@ -137,47 +210,91 @@ slotmap64__make(uint8_t **ary, size_t itemsize, SLOTMAP64_ID *idp)
   if (arr) {
     x = slotmap64__frl(arr);
     if (x != SLOTMAP64_MAX_INDEX) {
-      SLOTMAP64_FREE *free_item = (SLOTMAP64_FREE *)(slotmap64_array(arr) + (x * itemsize));
+      SLOTMAP64_FREE *free_item = (SLOTMAP64_FREE *)(slotmap64__dir(arr)[x >> SLOTMAP64_PAGE_BITS] +
+        ((x & (SLOTMAP64_PAGE_ITEMS - 1)) * itemsize));
       *idp = slotmap64__id(x, free_item->version);
       slotmap64__frc(arr)--;
       slotmap64__frl(arr) = free_item->next_free;
       return (uint8_t *)free_item;
-    } else {
-      siz = slotmap64__siz(arr);
-      used = slotmap64__use(arr);
+    }
+    pgs = slotmap64__pgs(arr);
+    cap = slotmap64__cap(arr);
+    if (slotmap64__use(arr) == SLOTMAP64_MAX_INDEX) {
+      *idp = SLOTMAP64_NONE_ID;
+      return NULL;
     }
   }
 
   //
-  // Allocate additional space
+  // Add a page when the last one is full, growing the directory if it's full too.
   //
-  newsiz = SLOT_ALIGN(
-    (SLOT_FLEX_SIZE(siz) * itemsize) +
-    (sizeof(uint32_t) * 4), SLOT_ALIGN_SIZE);
-  if (used == siz) {
-    p = (uint32_t *)SLOT_REALLOC(arr, newsiz);
-    x = (newsiz - (sizeof(uint32_t) * 4)) / itemsize;
-    *ary = (uint8_t *)p;
-    p[0] = x;
-  } else {
-    p = (uint32_t *)arr;
+  if (!arr || slotmap64__use(arr) == (uint64_t)pgs << SLOTMAP64_PAGE_BITS) {
+    if (pgs == cap) {
+      uint32_t newcap = SLOT_FLEX_SIZE(cap);
+      uint8_t *p = (uint8_t *)SLOT_ALLOC_REALLOC(arr ? slotmap64__al(arr) : NULL, arr,
+        (sizeof(uint32_t) * 8) + (sizeof(uint8_t *) * newcap));
+      if (!p) {
+        *idp = SLOTMAP64_NONE_ID;
+        return NULL;
+      }
+      if (!arr) {
+        memset(p, 0, sizeof(uint32_t) * 8);
+        slotmap64__frl(p) = SLOTMAP64_MAX_INDEX;
+      }
+      slotmap64__cap(p) = newcap;
+      *ary = arr = p;
+    }
+    size_t span = slotmap64__span(itemsize << SLOTMAP64_PAGE_BITS);
+    if (!(block = (uint8_t *)SLOT_ALLOC_REALLOC(slotmap64__al(arr), NULL,
+        (itemsize << SLOTMAP64_PAGE_BITS) + span + sizeof(Ch_SlotPage64)))) {
+      *idp = SLOTMAP64_NONE_ID;
+      return NULL;
+    }
+    page = (uint8_t *)(((uintptr_t)block + sizeof(Ch_SlotPage64) + span - 1) &
+      ~(uintptr_t)(span - 1));
+    slotmap64__page(page)->block = block;
+    slotmap64__page(page)->page = slotmap64__pgs(arr);
+    slotmap64__dir(arr)[slotmap64__pgs(arr)++] = page;
   }
 
   //
   // Expand the array by one element and give back an ID.
   //
-  if (p) {
-    if (!arr) {
-      p[1] = p[3] = 0;
-      p[2] = SLOTMAP64_MAX_INDEX;
-    }
-    *idp = slotmap64__id(x = p[1]++, 0);
-    arr = *ary;
-    return slotmap64_array(arr) + (x * itemsize);
+  *idp = slotmap64__id(x = slotmap64__use(arr)++, 0);
+  return slotmap64__dir(arr)[x >> SLOTMAP64_PAGE_BITS] +
+    ((x & (SLOTMAP64_PAGE_ITEMS - 1)) * itemsize);
+}
+
+//
+// Finds the index of the element at 'o' from its address. Rounding down lands on the page
+// or one span past its start - in which case the header read is really element data, but
+// no page starts there, so the directory turns it down.
+// Returns: The index or SLOTMAP64_MAX_INDEX if 'o' isn't in the slot map.
+//
+static inline uint32_t
+slotmap64__index(uint8_t *arr, size_t itemsize, uint8_t *o)
+{
+  size_t span = slotmap64__span(itemsize << SLOTMAP64_PAGE_BITS);
+  uint8_t *page = (uint8_t *)((uintptr_t)o & ~(uintptr_t)(span - 1));
+  uint32_t i = slotmap64__page(page)->page;
+  if (i >= slotmap64__pgs(arr) || slotmap64__dir(arr)[i] != page) {
+    page -= span;
+    i = slotmap64__page(page)->page;
   }
+  if (i < slotmap64__pgs(arr) && slotmap64__dir(arr)[i] == page &&
+      o < page + (itemsize << SLOTMAP64_PAGE_BITS))
+    return (i << SLOTMAP64_PAGE_BITS) + (uint32_t)((o - page) / itemsize);
+  return SLOTMAP64_MAX_INDEX;
+}
 
-  *idp = SLOTMAP64_NONE_ID;
-  return NULL;
+static inline void
+slotmap64__free(uint8_t *arr)
+{
+  Ch_SlotAlloc *al = slotmap64__al(arr);
+  uint32_t i;
+  for (i = 0; i < slotmap64__pgs(arr); i++)
+    SLOT_ALLOC_FREE(al, slotmap64__page(slotmap64__dir(arr)[i])->block);
+  SLOT_ALLOC_FREE(al, arr);
 }
 
 #endif
@@ -0,0 +1,264 @@
+//
+// slotmap_mt.h
+//
+// A slot map that many threads can add to and remove from at once, without a lock.
+// It gives up growth to get there: the capacity is reserved up front, so elements never
+// move and a pointer from slotmap_mt_at stays good for as long as the element lives.
+//
+//   Ch_SlotMapMT *m = slotmap_mt_new(Entity, 100000);
+//   static __thread Ch_SlotMapCache cache;
+//
+//   SLOT_ID id;
+//   Entity *e = slotmap_mt_add(m, Entity, &cache, id);
+//   ...
+//   e = slotmap_mt_at(m, Entity, id);
+//   slotmap_mt_remove(m, &cache, id);
+//
+//   // before the thread exits
+//   slotmap_mt_flush(m, &cache);
+//
+// IDs are the same as in slotmap.h: a 24-bit index and an 8-bit version.
+//
+// INTERNALS
+//
+// The versions aren't kept in the elements but in a separate array of words, one per slot,
+// packed like SLOTMAP_FREE: the version in the low eight bits, the next free slot in the
+// upper 24. A slot that's been handed out has SLOTMAP_MT_LIVE there instead, which is never
+// a slot (so a map holds at most SLOTMAP_MAX_ID - 1 elements.) A remove bumps the version
+// and clears the mark with a compare-and-swap, so two threads removing the same ID can't
+// both win, and slotmap_mt_at checks an ID against a single atomic load. Slots that were
+// never handed out, or that sit free in a cache or on the freelist, don't carry the mark,
+// so no ID finds them.
+//
+// Free slots are kept in three places:
+//
+// * The caller's Ch_SlotMapCache: a small magazine of free slots for one thread. Most
+//   adds and removes only touch this.
+// * A global freelist, which is a lock-free stack. The top is a 64-bit word holding the
+//   top slot and a tag that counts pops and pushes, so that a slot popped and pushed back
+//   while another thread was looking can't fool its compare-and-swap (the ABA problem.)
+//   A full cache hands half its slots to the stack with a single push.
+// * The untouched slots past 'used'. An empty cache that finds the stack empty claims
+//   a run of these with a single atomic add.
+//
+// Since slots sit in caches, there's no exact count of live elements.
+//
+// LICENSE
+//
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+//
+#ifndef SLOTMAP_MT_H
+#define SLOTMAP_MT_H
+
+#include "slotmap.h"
+
+// The number of free slots a Ch_SlotMapCache can hold.
+#ifndef SLOTMAP_MT_MAGAZINE
+#define SLOTMAP_MT_MAGAZINE 64
+#endif
+
+// The upper 24 bits of a slot's word while it holds an element.
+#define SLOTMAP_MT_LIVE     (SLOTMAP_MAX_ID - 1)
+
+typedef struct {
+  uint32_t count;
+  SLOT_ID slot[SLOTMAP_MT_MAGAZINE];
+} Ch_SlotMapCache;
+
+typedef struct {
+  uint64_t head;                     // freelist top: tag << 32 | index
+  uint8_t pad0[56];
+  uint32_t used;
+  uint8_t pad1[60];
+  uint32_t allocated;
+  uint32_t itemsize;
+  uint32_t *slot;                    // version | next_free (or SLOTMAP_MT_LIVE) << 8
+  uint8_t *items;
+} Ch_SlotMapMT;
+
+// Create a concurrent slot map with room for 'n' elements of type 'T'.
+// Returns: A pointer to the slot map or NULL if it couldn't be allocated.
+#define slotmap_mt_new(T,n)   slotmap_mt__new(sizeof(T), n)
+
+// A count of how many slots in the slot map 'm' have ever been handed out.
+// Returns: A uint32_t.
+#define slotmap_mt_used(m)    __atomic_load_n(&(m)->used, __ATOMIC_RELAXED)
+
+// Add a new entry of type 'T' to the slot map 'm' and set SLOT_ID variable 'id' to its ID.
+// 'cache' is the calling thread's Ch_SlotMapCache (or NULL to go straight to the freelist.)
+// Returns: A pointer to the new item or NULL if the slot map is full.
+#define slotmap_mt_add(m,T,cache,id) ({ \
+  SLOT_ID __x__ = slotmap_mt__take(m, cache); \
+  (id) = __x__ == SLOT_NONE_ID ? SLOT_NONE_ID : \
+    slotmap__id(__x__, __atomic_load_n(&(m)->slot[__x__], __ATOMIC_RELAXED) & 0xFF); \
+  __x__ == SLOT_NONE_ID ? (T *)NULL : ((T *)(m)->items) + __x__; \
+})
+
+// Get a pointer to an element of type 'T' in the slot map 'm' by its SLOT_ID 'id'. Another
+// thread can still remove the element afterward - keeping it alive is up to you.
+// Returns: A pointer to the element or NULL if the element is not found.
+#define slotmap_mt_at(m,T,id) ({ \
+  SLOT_ID __id__ = slotmap_index(id); \
+  __id__ < (m)->allocated && __atomic_load_n(&(m)->slot[__id__], __ATOMIC_ACQUIRE) == \
+    slotmap_mt__word((id) >> 24, SLOTMAP_MT_LIVE) ? ((T *)(m)->items) + __id__ : (T *)NULL; \
+})
+
+// Removes the element with SLOT_ID 'id' from the slot map 'm', putting the slot in 'cache'.
+// Returns: 1 if the element was removed, 0 if it wasn't found.
+#define slotmap_mt_remove(m,cache,id) slotmap_mt__remove(m, cache, id)
+
+// Give all of the slots in 'cache' back to the slot map 'm'. Do this before a thread exits.
+#define slotmap_mt_flush(m,cache) slotmap_mt__give(m, cache, (cache)->count)
+
+// Free the slot map 'm'. No thread may be using it.
+#define slotmap_mt_free(m)    ((m) ? free(m),0 : 0)
+
+//
+// internal functions
+//
+#include <stdlib.h>
+#include <string.h>
+
+#define slotmap_mt__word(v,next) (((v) & 0xFF) | ((uint32_t)(next) << 8))
+
+static inline Ch_SlotMapMT *
+slotmap_mt__new(size_t itemsize, SLOT_ID n)
+{
+  void *mem = NULL;
+  size_t slots = SLOT_ALIGN(sizeof(uint32_t) * n, 64);
+  if (n > SLOTMAP_MT_LIVE ||
+      posix_memalign(&mem, 64, sizeof(Ch_SlotMapMT) + slots + itemsize * n) != 0)
+    return NULL;
+  Ch_SlotMapMT *m = (Ch_SlotMapMT *)mem;
+  memset(m, 0, sizeof(Ch_SlotMapMT) + slots);
+  m->head = SLOTMAP_MAX_ID;
+  m->allocated = n;
+  m->itemsize = itemsize;
+  m->slot = (uint32_t *)(m + 1);
+  m->items = (uint8_t *)m->slot + slots;
+  return m;
+}
+
+//
+// Pushes the slots 'first' through 'last' (already linked to each other) on to the freelist.
+//
+static inline void
+slotmap_mt__push(Ch_SlotMapMT *m, SLOT_ID first, SLOT_ID last)
+{
+  uint64_t head = __atomic_load_n(&m->head, __ATOMIC_ACQUIRE);
+  uint32_t v = __atomic_load_n(&m->slot[last], __ATOMIC_RELAXED);
+  do {
+    __atomic_store_n(&m->slot[last], slotmap_mt__word(v, (uint32_t)head), __ATOMIC_RELAXED);
+  } while (!__atomic_compare_exchange_n(&m->head, &head,
+    (((head >> 32) + 1) << 32) | first, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+//
+// Pops a slot from the freelist.
+// Returns: The slot or SLOT_NONE_ID if the freelist is empty.
+//
+static inline SLOT_ID
+slotmap_mt__pop(Ch_SlotMapMT *m)
+{
+  uint64_t head = __atomic_load_n(&m->head, __ATOMIC_ACQUIRE);
+  for (;;) {
+    SLOT_ID x = (uint32_t)head;
+    if (x == SLOTMAP_MAX_ID)
+      return SLOT_NONE_ID;
+    uint32_t next = __atomic_load_n(&m->slot[x], __ATOMIC_RELAXED) >> 8;
+    if (__atomic_compare_exchange_n(&m->head, &head,
+        (((head >> 32) + 1) << 32) | next, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+      return x;
+  }
+}
+
+//
+// Fills an empty cache with up to half a magazine of slots: from the freelist if it has
+// any, otherwise from the untouched end of the map.
+//
+static inline void
+slotmap_mt__fill(Ch_SlotMapMT *m, Ch_SlotMapCache *cache)
+{
+  uint32_t want = SLOTMAP_MT_MAGAZINE / 2, used;
+  SLOT_ID x;
+  while (cache->count < want && (x = slotmap_mt__pop(m)) != SLOT_NONE_ID)
+    cache->slot[cache->count++] = x;
+  if (cache->count)
+    return;
+
+  used = __atomic_load_n(&m->used, __ATOMIC_RELAXED);
+  do {
+    if (used >= m->allocated)
+      return;
+    if (want > m->allocated - used)
+      want = m->allocated - used;
+  } while (!__atomic_compare_exchange_n(&m->used, &used, used + want, 1,
+    __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  for (x = used + want; x > used; )
+    cache->slot[cache->count++] = --x;
+}
+
+//
+// Returns the last 'n' slots of the cache to the freelist, in one push.
+//
+static inline void
+slotmap_mt__give(Ch_SlotMapMT *m, Ch_SlotMapCache *cache, uint32_t n)
+{
+  SLOT_ID *s;
+  uint32_t i;
+  if (n == 0)
+    return;
+  cache->count -= n;
+  s = cache->slot + cache->count;
+  for (i = 0; i + 1 < n; i++) {
+    uint32_t v = __atomic_load_n(&m->slot[s[i]], __ATOMIC_RELAXED);
+    __atomic_store_n(&m->slot[s[i]], slotmap_mt__word(v, s[i + 1]), __ATOMIC_RELAXED);
+  }
+  slotmap_mt__push(m, s[0], s[n - 1]);
+}
+
+static inline SLOT_ID
+slotmap_mt__take(Ch_SlotMapMT *m, Ch_SlotMapCache *cache)
+{
+  Ch_SlotMapCache one = {0};
+  if (!cache)
+    cache = &one;
+  if (!cache->count)
+    slotmap_mt__fill(m, cache);
+  if (!cache->count)
+    return SLOT_NONE_ID;
+  SLOT_ID x = cache->slot[--cache->count];
+  uint32_t v = __atomic_load_n(&m->slot[x], __ATOMIC_RELAXED);
+  __atomic_store_n(&m->slot[x], slotmap_mt__word(v, SLOTMAP_MT_LIVE), __ATOMIC_RELEASE);
+  if (cache == &one && one.count)
+    slotmap_mt__give(m, &one, one.count);
+  return x;
+}
+
+static inline int
+slotmap_mt__remove(Ch_SlotMapMT *m, Ch_SlotMapCache *cache, SLOT_ID id)
+{
+  SLOT_ID x = slotmap_index(id);
+  uint32_t w;
+  if (x >= m->allocated)
+    return 0;
+  w = __atomic_load_n(&m->slot[x], __ATOMIC_RELAXED);
+  do {
+    if (w != slotmap_mt__word(id >> 24, SLOTMAP_MT_LIVE))
+      return 0;
+  } while (!__atomic_compare_exchange_n(&m->slot[x], &w,
+    slotmap_mt__word((w & 0xFF) + 1, SLOTMAP_MAX_ID), 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+  if (!cache) {
+    slotmap_mt__push(m, x, x);
+  } else {
+    if (cache->count == SLOTMAP_MT_MAGAZINE)
+      slotmap_mt__give(m, cache, SLOTMAP_MT_MAGAZINE / 2);
+    cache->slot[cache->count++] = x;
+  }
+  return 1;
+}
+
+#endif
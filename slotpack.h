@@ -0,0 +1,208 @@
+//
+// slotpack.h
+//
+// A packed slot map. IDs work just as in slotmap.h - a 24-bit index and an 8-bit version,
+// with stale IDs caught by the version - but the elements themselves are kept in a dense
+// array with no holes. A remove moves the last element into the hole it leaves.
+//
+// So looping over the elements is a plain loop over an array:
+//
+//   Entity *ents = NULL;
+//   SLOT_ID id;
+//   Entity *e = slotpack_add(ents, id);
+//   ...
+//   for (SLOT_ID i = 0; i < slotpack_count(ents); i++)
+//     update(&slotpack_array(ents)[i]);
+//
+// The cost is an extra lookup on slotpack_at and that elements move: a pointer into the
+// array is only good until the next add or remove. Hold on to IDs instead.
+//
+// INTERNALS
+//
+//   uint32_t allocated_entries
+//   uint32_t dense_entries
+//   uint32_t sparse_entries
+//   uint32_t next_free_entry
+//   uint32_t reserved[2]
+//   Ch_SlotAlloc *alloc                             (two fields - set by slotpack_init)
+//   user_struct[allocated_entries] items            (dense)
+//   uint32_t sparse[allocated_entries]              (by ID index)
+//   uint32_t back[allocated_entries]                (by dense index)
+//
+// The 'sparse' table is what an ID's index points at. Each entry is packed like
+// SLOTMAP_FREE: the version in the low eight bits and, above that, the element's place in
+// the dense array (or the next free entry, once it's removed.) The 'back' table goes the
+// other way - from a dense element to its sparse entry - so a moved element can have its
+// sparse entry fixed up.
+//
+// LICENSE
+//
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+//
+#ifndef SLOTPACK_H
+#define SLOTPACK_H
+
+#include "slotmap.h"
+
+// Free an entire packed slot map 'a' from memory.
+// Returns: NULL.
+#define slotpack_free(a)      ((a) ? SLOT_ALLOC_FREE(slotmap__al(a), a),0 : 0)
+
+// Create an empty packed slot map 'a' that gets all of its memory from the Ch_SlotAlloc 'al'.
+// Returns: 1 if the slot map was created, 0 if not.
+#define slotpack_init(a,al)   slotpack__init((uint8_t **)&(a), al)
+
+// A count of how many elements are in the packed slot map 'a'. These are all at the start
+// of slotpack_array(a).
+// Returns: A uint32_t.
+#define slotpack_count(a)     ((a) ? slotpack__cnt(a) : 0)
+
+// A count of how many entries the packed slot map 'a' has space for.
+// Returns: A uint32_t.
+#define slotpack_allocated(a) ((a) ? slotpack__siz(a) : 0)
+
+// Fetch the dense array of elements.
+#define slotpack_array(a)     ((__typeof__(a))(((SLOT_ID *)(a)) + SLOTMAP__HDR))
+
+// Add a new entry to the end of the packed slot map 'a' and set SLOT_ID variable 'id' to its ID.
+// Returns: A pointer to the new item or NULL if the slot map has reached its maximum.
+#define slotpack_add(a,id)    \
+  ((__typeof__(a))slotpack__make((uint8_t **)&(a), sizeof(*(a)), &(id)))
+
+// Get the ID of the element at 'n' in the dense array of the packed slot map 'a'.
+// Returns: A SLOT_ID.
+#define slotpack_id(a,n)      ({ \
+  SLOT_ID __x__ = slotpack__back(a, sizeof(*(a)))[n]; \
+  slotmap__id(__x__, slotpack__sparse(a, sizeof(*(a)))[__x__] & 0xFF); \
+})
+
+// Get a pointer to an element by supplying the packed slot map 'a' and its SLOT_ID 'id'.
+// Returns: A pointer to the element or NULL if the element is not found.
+#define slotpack_at(a,id)     (!(a) ? NULL : ({ \
+  SLOT_ID __id__ = slotmap_index(id), __s__; \
+  __typeof__(a) __item__ = NULL; \
+  if (__id__ < slotpack__use(a)) { \
+    __s__ = slotpack__sparse(a, sizeof(*(a)))[__id__]; \
+    if ((__s__ & 0xFF) == ((id) >> 24)) \
+      __item__ = slotpack_array(a) + (__s__ >> 8); \
+  } \
+  __item__; \
+}))
+
+// Removes the element with SLOT_ID 'id' from the packed slot map 'a'. The last element in
+// the array is moved into its place.
+// Returns: 1 if the element was removed, 0 if it wasn't found.
+#define slotpack_remove(a,id) ((a) ? slotpack__remove((uint8_t *)(a), sizeof(*(a)), id) : 0)
+
+//
+// internal macros
+//
+#define slotpack__siz(a)      ((SLOT_ID *)(a))[0]
+#define slotpack__cnt(a)      ((SLOT_ID *)(a))[1]
+#define slotpack__use(a)      ((SLOT_ID *)(a))[2]
+#define slotpack__frl(a)      ((SLOT_ID *)(a))[3]
+#define slotpack__sparse(a,isz) ((uint32_t *)((uint8_t *)slotpack_array(a) + \
+  slotmap__items_size(slotpack__siz(a), isz)))
+#define slotpack__back(a,isz) (slotpack__sparse(a, isz) + slotpack__siz(a))
+#define slotpack__size(n,isz) ((sizeof(SLOT_ID) * SLOTMAP__HDR) + \
+  slotmap__items_size(n, isz) + (sizeof(uint32_t) * 2 * (n)))
+
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Creates an empty block (just the header) that gets its memory from 'al'.
+// Returns: 1 if the block was created, 0 if not.
+//
+static inline int
+slotpack__init(uint8_t **ary, Ch_SlotAlloc *al)
+{
+  uint8_t *p = (uint8_t *)SLOT_ALLOC_REALLOC(al, NULL, sizeof(SLOT_ID) * SLOTMAP__HDR);
+  if (p) {
+    memset(p, 0, sizeof(SLOT_ID) * SLOTMAP__HDR);
+    slotpack__frl(p) = SLOT_NONE_ID;
+    slotmap__al(p) = al;
+  }
+  *ary = p;
+  return p != NULL;
+}
+
+//
+// Makes room for a new element at the end of the dense array.
+// Returns: A pointer to the new object or NULL if no further objects could be created.
+//
+static inline uint8_t *
+slotpack__make(uint8_t **ary, size_t itemsize, SLOT_ID *idp)
+{
+  uint8_t *arr = *ary;
+  SLOT_ID siz = arr ? slotpack__siz(arr) : 0, cnt = arr ? slotpack__cnt(arr) : 0, x;
+  uint32_t *sparse;
+
+  //
+  // Grow, moving the two tables out past the bigger item array.
+  //
+  if (cnt == siz) {
+    SLOT_ID newsiz = SLOT_FLEX_SIZE(siz);
+    uint8_t *p;
+    if (newsiz > SLOTMAP_MAX_ID ||
+        !(p = (uint8_t *)SLOT_ALLOC_REALLOC(arr ? slotmap__al(arr) : NULL, arr,
+          slotpack__size(newsiz, itemsize)))) {
+      *idp = SLOT_NONE_ID;
+      return NULL;
+    }
+    if (!arr) {
+      memset(p, 0, sizeof(SLOT_ID) * SLOTMAP__HDR);
+      slotpack__frl(p) = SLOT_NONE_ID;
+    } else {
+      uint32_t *from = slotpack__sparse(p, itemsize);
+      slotpack__siz(p) = newsiz;
+      memmove(slotpack__back(p, itemsize), from + siz, sizeof(uint32_t) * cnt);
+      memmove(slotpack__sparse(p, itemsize), from, sizeof(uint32_t) * slotpack__use(p));
+    }
+    slotpack__siz(p) = newsiz;
+    *ary = arr = p;
+  }
+
+  //
+  // Take a sparse entry from the freelist or the end, and point it at the new element.
+  //
+  sparse = slotpack__sparse(arr, itemsize);
+  x = slotpack__frl(arr);
+  if (slotmap_index(x) != SLOTMAP_MAX_ID)
+    slotpack__frl(arr) = sparse[x] >> 8;
+  else
+    sparse[x = slotpack__use(arr)++] = 0;
+  cnt = slotpack__cnt(arr)++;
+  sparse[x] = (sparse[x] & 0xFF) | (cnt << 8);
+  slotpack__back(arr, itemsize)[cnt] = x;
+  *idp = slotmap__id(x, sparse[x] & 0xFF);
+  return (uint8_t *)slotpack_array(arr) + (cnt * itemsize);
+}
+
+static inline int
+slotpack__remove(uint8_t *arr, size_t itemsize, SLOT_ID id)
+{
+  uint32_t *sparse = slotpack__sparse(arr, itemsize), *back = slotpack__back(arr, itemsize);
+  SLOT_ID x = slotmap_index(id), d, last;
+  if (x >= slotpack__use(arr) || (sparse[x] & 0xFF) != (id >> 24))
+    return 0;
+
+  //
+  // Move the last element into the hole, then put the sparse entry on the freelist.
+  //
+  d = sparse[x] >> 8;
+  last = --slotpack__cnt(arr);
+  if (d != last) {
+    memcpy((uint8_t *)slotpack_array(arr) + d * itemsize,
+      (uint8_t *)slotpack_array(arr) + last * itemsize, itemsize);
+    back[d] = back[last];
+    sparse[back[d]] = (sparse[back[d]] & 0xFF) | (d << 8);
+  }
+  sparse[x] = (((sparse[x] & 0xFF) + 1) & 0xFF) | (slotmap_index(slotpack__frl(arr)) << 8);
+  slotpack__frl(arr) = x;
+  return 1;
+}
+
+#endif
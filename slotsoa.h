@@ -0,0 +1,208 @@
+//
+// slotsoa.h
+//
+// A slot map that keeps each field in its own column - a struct of arrays rather than an
+// array of structs. Updating one field across the whole map only touches that field's
+// memory, loops over a column can be vectorized, and a column can be handed straight to
+// the GPU.
+//
+// The fields are given as a list of F(type, name) entries:
+//
+//   #define PARTICLE_FIELDS(F) F(float, x) F(float, y) F(uint32_t, color)
+//   SLOTSOA_DECLARE(Particles, PARTICLE_FIELDS)
+//
+//   Particles *p = NULL;
+//   SLOT_ID id;
+//   SLOT_ID i = slotsoa_add(Particles, p, id);
+//   p->x[i] = 1.0f; p->y[i] = 2.0f; p->color[i] = 0xFFFFFF;
+//
+//   float *x = slotsoa_at(p, id, x);
+//   for (i = 0; i < slotsoa_used(p); i++)
+//     p->x[i] += 0.5f;
+//
+// IDs work just as in slotmap.h - a 24-bit index and an 8-bit version - and stay valid as
+// the map grows. Column pointers do not: 'p' (and so p->x) may move on every add.
+//
+// INTERNALS
+//
+// Everything is in a single block:
+//
+//   Ch_SlotSoA hdr                   (as in slotmap.h, plus the 'slot' pointer)
+//   type *name                       (a pointer to each column)
+//   SLOTMAP_FREE slot[allocated]     (versions and the freelist)
+//   type name[allocated]             (one column per field)
+//
+// Each column starts on a SLOTSOA_ALIGN boundary. Since the freelist lives in its own
+// column, a free row's fields are left alone - so a loop over every used row just reads
+// stale values in the free ones, rather than freelist links.
+//
+// LICENSE
+//
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+//
+#ifndef SLOTSOA_H
+#define SLOTSOA_H
+
+#include "slotmap.h"
+
+// The alignment of the block and each column inside it, in bytes.
+#ifndef SLOTSOA_ALIGN
+#define SLOTSOA_ALIGN 64
+#endif
+
+typedef struct {
+  SLOT_ID siz, use, frl, frc, gen;
+  uint32_t reserved[3];
+  SLOTMAP_FREE *slot;
+} Ch_SlotSoA;
+
+// Declare a struct-of-arrays slot map type 'T' with the field list 'FIELDS'.
+#define SLOTSOA_DECLARE(T, FIELDS) \
+  typedef struct T { \
+    Ch_SlotSoA hdr; \
+    FIELDS(SLOTSOA__MEMBER) \
+  } T; \
+  static const uint16_t T##__cols[] = { sizeof(SLOTMAP_FREE), FIELDS(SLOTSOA__SIZE) 0 }; \
+  static inline void \
+  T##__rebase(Ch_SlotSoA *h) \
+  { \
+    T *a = (T *)h; \
+    uint8_t *col = (uint8_t *)a + SLOTSOA__ROUND(sizeof(T)); \
+    a->hdr.slot = (SLOTMAP_FREE *)col; \
+    col += SLOTSOA__ROUND((size_t)a->hdr.siz * sizeof(SLOTMAP_FREE)); \
+    FIELDS(SLOTSOA__REBASE) \
+  }
+
+// Free an entire SoA slot map 'a' from memory, columns and all.
+// Returns: NULL.
+#define slotsoa_free(a)       ((a) ? free(a),0 : 0)
+
+// A count of how many rows in the SoA slot map 'a' have been used, including freed ones.
+// Returns: A uint32_t.
+#define slotsoa_used(a)       ((a) ? (a)->hdr.use : 0)
+
+// A count of how many live rows there are in the SoA slot map 'a'.
+// Returns: A uint32_t.
+#define slotsoa_count(a)      ((a) ? (a)->hdr.use - (a)->hdr.frc : 0)
+
+// A count of how many rows the SoA slot map 'a' has space for.
+// Returns: A uint32_t.
+#define slotsoa_allocated(a)  ((a) ? (a)->hdr.siz : 0)
+
+// Add a row to the SoA slot map 'a' of type 'T' and set SLOT_ID variable 'id' to its ID.
+// The fields aren't cleared.
+// Returns: The row's index into each column, or SLOT_NONE_ID if the map is full.
+#define slotsoa_add(T,a,id)   \
+  slotsoa__make((Ch_SlotSoA **)&(a), sizeof(T), T##__cols, T##__rebase, &(id))
+
+// Get a pointer to the 'field' of the row with SLOT_ID 'id' in the SoA slot map 'a'.
+// Returns: A pointer into the field's column, or NULL if the row is not found.
+#define slotsoa_at(a,id,field) (!(a) ? NULL : ({ \
+  SLOT_ID __id__ = slotmap_index(id); \
+  __id__ < (a)->hdr.use && (a)->hdr.slot[__id__].version == ((id) >> 24) ? \
+    (a)->field + __id__ : NULL; \
+}))
+
+// Removes the row with SLOT_ID 'id' from the SoA slot map 'a'.
+// Returns: 1 if the row was removed, 0 if it wasn't found.
+#define slotsoa_remove(a,id)  ((a) ? slotsoa__remove(&(a)->hdr, id) : 0)
+
+//
+// internal macros
+//
+#define SLOTSOA__ROUND(n)            (((n) + SLOTSOA_ALIGN - 1) & ~(size_t)(SLOTSOA_ALIGN - 1))
+#define SLOTSOA__MEMBER(type, name)  type *name;
+#define SLOTSOA__SIZE(type, name)    sizeof(type),
+#define SLOTSOA__REBASE(type, name)  \
+  a->name = (type *)col; \
+  col += SLOTSOA__ROUND((size_t)a->hdr.siz * sizeof(type));
+
+#include <stdlib.h>
+#include <string.h>
+
+//
+// The byte size of a block with room for 'n' rows of the columns in 'cols'.
+//
+static inline size_t
+slotsoa__size(size_t hdrsize, const uint16_t *cols, size_t n)
+{
+  size_t size = SLOTSOA__ROUND(hdrsize);
+  for (; *cols; cols++)
+    size += SLOTSOA__ROUND(n * *cols);
+  return size;
+}
+
+//
+// Makes room for a new row, moving every column over to a bigger block if needed.
+// Returns: The index of the new row or SLOT_NONE_ID if no further rows could be created.
+//
+static inline SLOT_ID
+slotsoa__make(Ch_SlotSoA **ary, size_t hdrsize, const uint16_t *cols,
+  void (*rebase)(Ch_SlotSoA *), SLOT_ID *idp)
+{
+  Ch_SlotSoA *arr = *ary, *p;
+  SLOT_ID x, siz = arr ? arr->siz : 0;
+
+  //
+  // Reuse from the freelist.
+  //
+  if (arr && slotmap_index(arr->frl) != SLOTMAP_MAX_ID) {
+    x = arr->frl;
+    arr->frl = arr->slot[x].next_free;
+    arr->frc--;
+    *idp = slotmap__id(x, arr->slot[x].version);
+    return x;
+  }
+
+  //
+  // Allocate a bigger block and copy each column across.
+  //
+  if (!arr || arr->use == siz) {
+    size_t newsiz = SLOT_FLEX_SIZE(siz), n = arr ? arr->use : 0;
+    void *mem = NULL;
+    if (newsiz > SLOTMAP_MAX_ID ||
+        posix_memalign(&mem, SLOTSOA_ALIGN, slotsoa__size(hdrsize, cols, newsiz)) != 0) {
+      *idp = SLOT_NONE_ID;
+      return SLOT_NONE_ID;
+    }
+    p = (Ch_SlotSoA *)mem;
+    if (arr) {
+      uint8_t *from = (uint8_t *)arr + SLOTSOA__ROUND(hdrsize),
+              *to = (uint8_t *)p + SLOTSOA__ROUND(hdrsize);
+      memcpy(p, arr, hdrsize);
+      for (; *cols; cols++) {
+        memcpy(to, from, n * *cols);
+        from += SLOTSOA__ROUND(siz * *cols);
+        to += SLOTSOA__ROUND(newsiz * *cols);
+      }
+      free(arr);
+    } else {
+      memset(p, 0, hdrsize);
+      p->frl = SLOT_NONE_ID;
+    }
+    p->siz = newsiz;
+    rebase(p);
+    *ary = arr = p;
+  }
+
+  x = arr->use++;
+  arr->slot[x] = (SLOTMAP_FREE){arr->gen, SLOTMAP_MAX_ID};
+  *idp = slotmap__id(x, arr->gen);
+  return x;
+}
+
+static inline int
+slotsoa__remove(Ch_SlotSoA *arr, SLOT_ID id)
+{
+  SLOT_ID x = slotmap_index(id);
+  if (x >= arr->use || arr->slot[x].version != (id >> 24))
+    return 0;
+  arr->slot[x] = (SLOTMAP_FREE){arr->slot[x].version + 1, arr->frl};
+  arr->frl = x;
+  arr->frc++;
+  return 1;
+}
+
+#endif
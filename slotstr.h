@@ -0,0 +1,55 @@
+//
+// slotstr.h
+//
+// A string region kept in a slotlist of chars. Strings are appended along with their
+// terminating NUL and are referred to by their offset into the region, rather than by
+// pointer. So the region can be grown (and moved) by realloc, or written out with a
+// slottable and mapped back in somewhere else, and the offsets are still good.
+//
+//   char *strs = NULL;
+//   SLOT_ID key = slotstr_add(strs, "hello");
+//   puts(slotstr_at(strs, key));
+//
+// LICENSE
+//
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+//
+#ifndef SLOTSTR_H
+#define SLOTSTR_H
+
+#include "slotlist.h"
+#include <string.h>
+
+// Append the NUL-terminated string 'str' to the string region 's'.
+// Returns: The SLOT_ID offset of the string in the region.
+#define slotstr_add(s, str)        slotstr__add(&(s), str, strlen(str))
+
+// Append 'len' bytes of 'str' to the string region 's', adding a NUL.
+// Returns: The SLOT_ID offset of the string in the region.
+#define slotstr_addn(s, str, len)  slotstr__add(&(s), str, len)
+
+// Get the string at offset 'off' in the string region 's'.
+// Returns: A char pointer.
+#define slotstr_at(s, off)         (slotlist_array(s) + (off))
+
+// The number of bytes used by the string region 's', including NULs.
+// Returns: A uint32_t.
+#define slotstr_size(s)            slotlist_count(s)
+
+// Free the entire string region 's'.
+// Returns: NULL.
+#define slotstr_free(s)            slotlist_free(s)
+
+static inline SLOT_ID
+slotstr__add(char **s, const char *str, size_t len)
+{
+  SLOT_ID off = slotlist_count(*s);
+  char *p = slotlist_add(*s, len + 1);
+  memcpy(p, str, len);
+  p[len] = '\0';
+  return off;
+}
+
+#endif
@@ -20,16 +20,59 @@
 // A four-byte 'SLOT_ID next' and a four-byte 'SLOT_ID hash' is also added to the end of every entry.
 // This means that every entry in the slot table has a 12-byte overhead.
 //
+// CONTROL BYTES
+//
+// Define SLOTTABLE_CTRL before including this file to switch the index over to an
+// open-addressed layout in the style of Google's SwissTable. The index then has two
+// slots for every allocated item, and each slot has a one-byte tag holding the top
+// seven bits of the hash. Lookups compare sixteen tags at once (with SSE2, if it's
+// around) and only visit an item when its tag matches - so most misses never touch
+// the item data or call 'cmp'. The items themselves are laid out just as before, so
+// IDs, SLOTTABLE_ORDERED and SLOTTABLE_FIXED_ID all work the same. Each entry costs
+// an extra five bytes of index this way.
+//
+// INCREMENTAL GROWTH
+//
+// Normally a full table is copied and rehashed all at once. Define SLOTTABLE_INCREMENTAL
+// to spread that work out: growth allocates the new block and hangs on to the old one,
+// then each insert and remove moves SLOTTABLE_MIGRATE_STEP items across. Finds look in
+// the new block first and then fall back to the old one, so they stay correct (and
+// read-only) during the move. In this mode IDs never change on growth - holes are carried
+// over as if SLOTTABLE_FIXED_ID were set - and the table must be released with
+// slottable_free, so that a block still being emptied isn't leaked.
+//
+// SNAPSHOTS
+//
+// Since the whole table is one block, it can be written straight to disk and mapped
+// back in without rehashing anything. Define SLOTTABLE_SNAPSHOT for slottable_save and
+// slottable_load. A loaded table is used in place - read-only, or copy-on-write if it
+// needs to change afterwards. Items must not hold pointers, of course: keep string keys
+// in a slotstr.h region and store offsets into it instead. The region can be saved
+// alongside the table.
+//
 #ifndef SLOTTABLE_H
 #define SLOTTABLE_H
 
 #include "slotbase.h"
+#include <string.h>
 
-typedef struct {
+typedef struct Ch_SlotTable {
   uint32_t allocated;
   uint32_t used;
   uint32_t active;
   SLOT_ID next_free;
+  uint32_t flags;                    // SLOTTABLE_MAPPED, if the block is a loaded snapshot
+  uint32_t itemsize;
+  uint32_t deleted;                  // tombstones in the index (SLOTTABLE_CTRL)
+  uint32_t migrated;                 // items moved out of 'old' (SLOTTABLE_INCREMENTAL)
+  union {
+    Ch_SlotAlloc *alloc;             // from slottable_init, or NULL for SLOT_REALLOC
+    uint64_t alloc__pad;
+  };
+  union {
+    struct Ch_SlotTable *old;        // the block being emptied (SLOTTABLE_INCREMENTAL)
+    uint64_t old__pad;
+  };
   SLOT_ID index[0];
 } Ch_SlotTable;
 
@@ -57,14 +100,161 @@ static inline uint32_t slottable_strnhash(const char *s, size_t len)
   return h;
 }
 
+//
+// Faster hashes. The ones above go a byte at a time and leave the low bits (the ones
+// that pick a bucket) poorly mixed. These read the key eight bytes at a time, in four
+// independent 64-bit lanes for longer keys, and finish with a full avalanche. This is
+// the XXH64 construction; the seeded form is there to make collision flooding harder
+// when keys come from outside.
+//
+#define SLOTTABLE_PRIME64_1 0x9E3779B185EBCA87ULL
+#define SLOTTABLE_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define SLOTTABLE_PRIME64_3 0x165667B19E3779F9ULL
+#define SLOTTABLE_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define SLOTTABLE_PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define slottable__rotl64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t slottable__read64(const char *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t slottable__read32(const char *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t slottable__round64(uint64_t acc, uint64_t v)
+{
+  acc += v * SLOTTABLE_PRIME64_2;
+  acc = slottable__rotl64(acc, 31);
+  return acc * SLOTTABLE_PRIME64_1;
+}
+
+static inline uint64_t slottable__merge64(uint64_t h, uint64_t acc)
+{
+  h ^= slottable__round64(0, acc);
+  return h * SLOTTABLE_PRIME64_1 + SLOTTABLE_PRIME64_4;
+}
+
+static inline uint32_t slottable_strn_seedhash(const char *s, size_t len, uint64_t seed)
+{
+  const char *end = s + len;
+  uint64_t h;
+
+  if (len >= 32) {
+    uint64_t v1 = seed + SLOTTABLE_PRIME64_1 + SLOTTABLE_PRIME64_2,
+             v2 = seed + SLOTTABLE_PRIME64_2,
+             v3 = seed,
+             v4 = seed - SLOTTABLE_PRIME64_1;
+    do {
+      v1 = slottable__round64(v1, slottable__read64(s));
+      v2 = slottable__round64(v2, slottable__read64(s + 8));
+      v3 = slottable__round64(v3, slottable__read64(s + 16));
+      v4 = slottable__round64(v4, slottable__read64(s + 24));
+      s += 32;
+    } while (s + 32 <= end);
+    h = slottable__rotl64(v1, 1) + slottable__rotl64(v2, 7) +
+        slottable__rotl64(v3, 12) + slottable__rotl64(v4, 18);
+    h = slottable__merge64(h, v1);
+    h = slottable__merge64(h, v2);
+    h = slottable__merge64(h, v3);
+    h = slottable__merge64(h, v4);
+  } else {
+    h = seed + SLOTTABLE_PRIME64_5;
+  }
+
+  h += (uint64_t)len;
+  for (; s + 8 <= end; s += 8) {
+    h ^= slottable__round64(0, slottable__read64(s));
+    h = slottable__rotl64(h, 27) * SLOTTABLE_PRIME64_1 + SLOTTABLE_PRIME64_4;
+  }
+  if (s + 4 <= end) {
+    h ^= (uint64_t)slottable__read32(s) * SLOTTABLE_PRIME64_1;
+    h = slottable__rotl64(h, 23) * SLOTTABLE_PRIME64_2 + SLOTTABLE_PRIME64_3;
+    s += 4;
+  }
+  for (; s < end; s++) {
+    h ^= (uint8_t)*s * SLOTTABLE_PRIME64_5;
+    h = slottable__rotl64(h, 11) * SLOTTABLE_PRIME64_1;
+  }
+
+  h ^= h >> 33;
+  h *= SLOTTABLE_PRIME64_2;
+  h ^= h >> 29;
+  h *= SLOTTABLE_PRIME64_3;
+  h ^= h >> 32;
+  return (uint32_t)h;
+}
+
+static inline uint32_t slottable_strn_fasthash(const char *s, size_t len)
+{
+  return slottable_strn_seedhash(s, len, 0);
+}
+
+static inline uint32_t slottable_str_fasthash(const char *s)
+{
+  return slottable_strn_seedhash(s, strlen(s), 0);
+}
+
+//
+// Integer mixers, for tables keyed directly on numbers.
+//
+static inline uint32_t slottable_u32_hash(uint32_t x)
+{
+  x ^= x >> 16;
+  x *= 0x7FEB352DU;
+  x ^= x >> 15;
+  x *= 0x846CA68BU;
+  x ^= x >> 16;
+  return x;
+}
+
+static inline uint32_t slottable_u64_hash(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDULL;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53ULL;
+  x ^= x >> 33;
+  return (uint32_t)x;
+}
+
 #ifndef SLOT_DOUBLE_SIZE
 #define SLOT_DOUBLE_SIZE(n) (!(n) ? 8 : ((n) * 2))
 #endif
 
 #define slottable__size(a,itemsize) \
-  (((a) * (itemsize + sizeof(SLOT_ID) + sizeof(Ch_SlotTableItem))) + \
-    sizeof(Ch_SlotTable))
+  (((a) * (itemsize + sizeof(Ch_SlotTableItem))) + \
+    slottable__index_size(a) + sizeof(Ch_SlotTable))
 #define slottable_mem_usage(a)  (slottable__size(slottable_allocated(a), sizeof(*(a))))
+
+#ifndef SLOTTABLE_PREFETCH_DISTANCE
+#define SLOTTABLE_PREFETCH_DISTANCE 8
+#endif
+
+#ifndef SLOTTABLE_MIGRATE_STEP
+#define SLOTTABLE_MIGRATE_STEP 16
+#endif
+
+// Free an entire slot table 'a' from memory, along with any block that is still being
+// migrated from.
+// Returns: NULL.
+#define slottable_free(a)       ((a) ? slottable__release((Ch_SlotTable *)(a)),0 : 0)
+
+// Create an empty slot table 'a' that gets all of its memory from the Ch_SlotAlloc 'al'.
+// Returns: 1 if the table was created, 0 if not.
+#define slottable_init(a,al)    slottable__init((uint8_t **)&(a), sizeof(*(a)), al)
+
+// Finish moving items out of the old block, if the slot table 'a' is partway through
+// an incremental resize. This does nothing unless SLOTTABLE_INCREMENTAL is defined.
+#define slottable_migrate(a)    slottable__step(a, sizeof(*(a)), UINT32_MAX)
+
 // A count of how many entries in the slot table 'a' have been used in the allocation block.
 // Some of these may be deleted already, however.
 // Returns: A uint32_t.
@@ -80,6 +270,20 @@ static inline uint32_t slottable_strnhash(const char *s, size_t len)
 
 #define SLOTTABLE_ORDERED  1
 #define SLOTTABLE_FIXED_ID 2
+#define SLOTTABLE_SHRINK   4
+
+// When a table fills up with 'dead' of its 'used' items removed, the holes are reclaimed
+// instead of doubling the table: compacted away, or reused from the freelist if the
+// table has SLOTTABLE_FIXED_ID. Define this as 0 to always double.
+#ifndef SLOTTABLE_SHOULD_COMPACT
+#define SLOTTABLE_SHOULD_COMPACT(dead, used) ((dead) >= (used) / 4)
+#endif
+
+// Internal flags kept in the table itself. SLOTTABLE_MAPPED means the block belongs to
+// a mapped snapshot. SLOTTABLE_SHARED means it has been published to other threads by
+// slottable_mt.h, which frees it once they're done with it.
+#define SLOTTABLE_MAPPED   0x100
+#define SLOTTABLE_SHARED   0x200
 
 // Add a new entry in the slot table 'a' and set SLOT_ID variable 'id' to the ID of the new entry.
 // The ID is also stored in the index array spot corresponding to the 32-bit hash 'hsh'.
@@ -108,26 +312,142 @@ static inline uint32_t slottable_strnhash(const char *s, size_t len)
 // The key in the slot table item is compared with 'key' using the 'cmp' function.
 // If a matching item is found, the 'id' is set to the item's ID in the slot table.
 // Returns: A pointer to the slot table item's data or NULL if no item is found.
+#ifndef SLOTTABLE_INCREMENTAL
+#define slottable_find_and_id(a, hsh, cmp, key, idref) (!(a) ? (NULL) : ({ \
+  Ch_SlotTableItem *__itf__ = slottable__find_in((Ch_SlotTable *)(a), hsh, \
+    cmp, key, __typeof__(a), idref, 0); \
+  __itf__ == NULL ? NULL : (__typeof__(a))__itf__->data; \
+}))
+#else
 #define slottable_find_and_id(a, hsh, cmp, key, idref) (!(a) ? (NULL) : ({ \
-  Ch_SlotTable *__tblf__ = (Ch_SlotTable *)a; \
+  Ch_SlotTable *__tbli__ = (Ch_SlotTable *)(a); \
+  uint32_t __hshi__ = (hsh); \
+  Ch_SlotTableItem *__itf__ = slottable__find_in(__tbli__, __hshi__, \
+    cmp, key, __typeof__(a), idref, 0); \
+  if (__itf__ == NULL && __tbli__->old != NULL) \
+    __itf__ = slottable__find_in(__tbli__->old, __hshi__, \
+      cmp, key, __typeof__(a), idref, __tbli__->migrated); \
+  __itf__ == NULL ? NULL : (__typeof__(a))__itf__->data; \
+}))
+#endif
+
+// Find 'n' entries in slot table 'a' at once, using the uint32_t hashes in 'hashes' and the
+// keys in 'keys', compared using 'cmp' just like slottable_find. A pointer to each match (or
+// NULL) is written to 'out'. Lookups are pipelined: the index slot for one key is prefetched
+// while the chain head for an earlier key is being prefetched and an earlier one still is
+// resolved, so cache misses overlap rather than wait on one another.
+// Returns: The number of keys found, as a uint32_t.
+#define slottable_find_batch(a, hashes, keys, cmp, out, n) ({ \
+  SLOT_ID *__idref__ = NULL; \
+  slottable__find_batch(a, hashes, keys, cmp, out, n, __idref__, (void)0); \
+})
+
+// Find 'n' entries in slot table 'a' at once, like slottable_find_batch, also writing the
+// ID of each match (or SLOT_NONE_ID) to the SLOT_ID array 'ids'.
+// Returns: The number of keys found, as a uint32_t.
+#define slottable_find_batch_and_id(a, hashes, keys, cmp, out, ids, n) ({ \
+  SLOT_ID *__idref__ = NULL; \
+  slottable__find_batch(a, hashes, keys, cmp, out, n, __idref__, \
+    (ids)[__j__] = __idref__ != NULL ? *__idref__ : SLOT_NONE_ID); \
+})
+
+#define slottable__find_batch(a, hashes, keys, cmp, out, n, idref, ...) ({ \
+  uint32_t __n__ = (n), __found__ = 0, __d__ = SLOTTABLE_PREFETCH_DISTANCE; \
+  for (uint32_t __i__ = 0; __i__ < __n__ + 2 * __d__; __i__++) { \
+    if ((a) != NULL && __i__ < __n__) \
+      slottable__prefetch_index((Ch_SlotTable *)(a), (hashes)[__i__]); \
+    if ((a) != NULL && __i__ >= __d__ && __i__ - __d__ < __n__) \
+      slottable__prefetch_item((Ch_SlotTable *)(a), (hashes)[__i__ - __d__], sizeof(*(a))); \
+    if (__i__ >= 2 * __d__) { \
+      uint32_t __j__ = __i__ - 2 * __d__; \
+      idref = NULL; \
+      (out)[__j__] = slottable_find_and_id(a, (hashes)[__j__], cmp, (keys)[__j__], idref); \
+      __found__ += (out)[__j__] != NULL; \
+      __VA_ARGS__; \
+    } \
+  } \
+  __found__; \
+})
+
+//
+// Searches the index of a single block 'tbl', skipping any items whose IDs are below 'minid'.
+// Returns: A pointer to the Ch_SlotTableItem or NULL if no item is found.
+//
+#ifndef SLOTTABLE_CTRL
+#define slottable__find_in(tbl, hsh, cmp, key, T, idref, minid) ({ \
+  Ch_SlotTable *__tblf__ = (tbl); \
   uint32_t __hsh__ = slottable__fix_hash(hsh); \
   uint32_t __idx__ = __hsh__ & (__tblf__->allocated - 1); \
-  uint8_t *items = (uint8_t *)slottable__data(a); \
+  SLOT_ID __min__ = (minid); \
+  uint8_t *items = slottable__data(__tblf__); \
   idref = __tblf__->index + __idx__; \
   Ch_SlotTableItem *item = NULL; \
+  uint32_t __probes__ = 0; \
   while (SLOT_NONE_ID != *idref && ({ \
-    item = slottable__data_item(items, *idref, sizeof(*(a))); \
-    __hsh__ != item->hash || cmp(key, (__typeof__(a))item->data) != 0;})) { \
+    item = slottable__data_item(items, *idref, sizeof(*((T)0))); \
+    __hsh__ != item->hash || *idref < __min__ || cmp(key, (T)item->data) != 0;})) { \
       idref = &item->next; \
       item = NULL; \
+      __probes__++; \
   } \
-  item == NULL ? (idref = NULL, NULL) : (__typeof__(a))item->data; \
-}))
+  if (item == NULL) idref = NULL; \
+  slottable__stat_find(item, __probes__); \
+  item; \
+})
+#else
+#define slottable__find_in(tbl, hsh, cmp, key, T, idref, minid) ({ \
+  Ch_SlotTable *__tblf__ = (tbl); \
+  uint32_t __hsh__ = slottable__fix_hash(hsh); \
+  uint32_t __mask__ = slottable__slots(__tblf__->allocated) - 1, __step__ = 0; \
+  uint32_t __pos__ = __hsh__ & __mask__ & ~(SLOTTABLE_GROUP - 1); \
+  SLOT_ID __min__ = (minid); \
+  uint8_t __tag__ = slottable__tag(__hsh__); \
+  uint8_t *__ctrl__ = slottable__ctrl(__tblf__); \
+  uint8_t *items = slottable__data(__tblf__); \
+  Ch_SlotTableItem *item = NULL; \
+  idref = NULL; \
+  for (;;) { \
+    uint32_t __m__ = slottable__group_match(__ctrl__ + __pos__, __tag__); \
+    while (__m__) { \
+      SLOT_ID *__ref__ = __tblf__->index + __pos__ + __builtin_ctz(__m__); \
+      __m__ &= __m__ - 1; \
+      item = slottable__data_item(items, *__ref__, sizeof(*((T)0))); \
+      if (__hsh__ == item->hash && *__ref__ >= __min__ && cmp(key, (T)item->data) == 0) { \
+        idref = __ref__; \
+        break; \
+      } \
+      item = NULL; \
+    } \
+    if (item || slottable__group_empty(__ctrl__ + __pos__)) \
+      break; \
+    __pos__ = (__pos__ + SLOTTABLE_GROUP * ++__step__) & __mask__; \
+  } \
+  (void)idref; \
+  slottable__stat_find(item, __step__); \
+  item; \
+})
+#endif
+
+//
+// Counts a find that visited 'n' items (or groups) past the first. (With
+// SLOTTABLE_INCREMENTAL, a find that goes on to the old block counts once for each.)
+//
+#ifdef SLOT_STATS
+#define slottable__stat_find(item, n) ({ \
+  SLOT_STAT(finds, 1); \
+  if ((item) == NULL) SLOT_STAT(find_misses, 1); \
+  SLOT_STAT(probes[(n) < SLOT_STATS_PROBES ? (n) : SLOT_STATS_PROBES - 1], 1); \
+})
+#else
+#define slottable__stat_find(item, n) ((void)(n))
+#endif
 
 // Loop through the slottable contents in hash order. While the scan will be
 // out of order, this technique is the fastest and the safest way to allow
 // deletion during the loop.
+#ifndef SLOTTABLE_CTRL
 #define slottable_scan(a, id, item, v, ...) if (a) { \
+  slottable_migrate(a); \
   Ch_SlotTable *tbl = (Ch_SlotTable *)(a); \
   for (uint32_t i = 0; i < tbl->allocated; i++) { \
     SLOT_ID *id = tbl->index + i; \
@@ -152,18 +472,48 @@ static inline uint32_t slottable_strnhash(const char *s, size_t len)
   __tbl__->next_free = this_id; \
   __tbl__->active--; \
 }
+#else
+#define slottable_scan(a, id, item, v, ...) if (a) { \
+  slottable_migrate(a); \
+  Ch_SlotTable *tbl = (Ch_SlotTable *)(a); \
+  uint8_t *__ctrl__ = slottable__ctrl(tbl); \
+  for (uint32_t g = 0; g < slottable__slots(tbl->allocated); g += SLOTTABLE_GROUP) { \
+    uint32_t __m__ = ~slottable__group_free(__ctrl__ + g) & 0xFFFF; \
+    while (__m__) { \
+      SLOT_ID *id = tbl->index + g + __builtin_ctz(__m__); \
+      Ch_SlotTableItem *item = slottable__item(a, *id, sizeof(*(a))); \
+      __typeof__(a) v = (__typeof__(a))item->data; \
+      __m__ &= __m__ - 1; \
+      __VA_ARGS__; \
+    } \
+  } \
+}
+
+#define slottable_remove_item(a, idref, item) { \
+  Ch_SlotTable *__tbl__ = (Ch_SlotTable *)a; \
+  SLOT_ID this_id = *idref; \
+  slottable__ctrl_erase(slottable__owner(__tbl__, idref), idref); \
+  item->hash = SLOT_NONE_ID; \
+  item->next = __tbl__->next_free; \
+  __tbl__->next_free = this_id; \
+  __tbl__->active--; \
+}
+#endif
 
 // Remove an item from the slot table 'a' that matches the uint32_t 'hash' and
 // the 'key'. The key in the slot table item is compared with 'key' using the
 // 'cmp' function. Items are not freed, but only marked for removal. Items will
-// be removed the next time the hash table is resized, if the SLOTTABLE_FIXED_ID
+// be removed the next time the hash table is resized or compacted, if the SLOTTABLE_FIXED_ID
 // flag is not used.
 // Returns: A pointer to the slot table item's data or NULL if no item is found.
 #define slottable_remove(a, hsh, cmp, key) (!(a) ? NULL : ({ \
   SLOT_ID *__id__ = NULL; \
+  slottable__step(a, sizeof(*(a)), SLOTTABLE_MIGRATE_STEP); \
   __typeof__(a) data = slottable_find_and_id(a, hsh, cmp, key, __id__); \
-  Ch_SlotTableItem *item = slottable__item(a, *__id__, sizeof(*(a))); \
-  slottable_remove_item(a, __id__, item); \
+  if (data != NULL) { \
+    Ch_SlotTableItem *item = slottable__item(a, *__id__, sizeof(*(a))); \
+    slottable_remove_item(a, __id__, item); \
+  } \
   data; \
 }))
 
@@ -175,13 +525,50 @@ static inline uint32_t slottable_strnhash(const char *s, size_t len)
   item == NULL ? NULL : (__typeof__(a))item->data; \
 }))
 
-// Get the ID of an element 'v' in the slot table 'a'.
-// Returns: A Q_ID.
+// Reclaim the holes left by removed items in the slot table 'a', and rebuild its index.
+// Items slide down to fill the holes, unless 'flags' has SLOTTABLE_FIXED_ID: then
+// they stay put, trailing holes are dropped and the rest go back on the freelist to be
+// reused. With SLOTTABLE_SHRINK in 'flags', the table is also sized down to the
+// smallest allocation that still fits.
+#define slottable_compact(a, flags) \
+  ((a) ? (slottable__compact((uint8_t **)&(a), sizeof(*(a)), flags), 0) : 0)
+
+// Tally how far lookups have to go in the slot table 'a'. For each live item, 'hist[n]' is
+// bumped where 'n' is the number of items (or, with SLOTTABLE_CTRL, groups) visited before
+// reaching it. Anything past the last of the 'len' entries is counted in the last one.
+// Useful for checking how well a hash function is spreading keys.
+// Returns: The longest distance seen, as a uint32_t.
+#define slottable_histogram(a, hist, len) (!(a) ? 0 : ({ \
+  slottable_migrate(a); \
+  slottable__histogram((Ch_SlotTable *)(a), sizeof(*(a)), hist, len); \
+}))
+
+#ifdef SLOT_STATS
+// Print a look over the slot table 'a' to the FILE 'f': its size, how much of it is holes
+// and tombstones and the slottable_histogram of lookup distances. (SLOT_STATS only.)
+#define slottable_stats_dump(a, f) ({ \
+  uint32_t __hist__[SLOT_STATS_PROBES] = {0}, __long__ = slottable_histogram(a, __hist__, \
+    SLOT_STATS_PROBES); \
+  slottable__stats_dump((Ch_SlotTable *)(a), __hist__, __long__, f); \
+})
+#endif
+
+// Get the ID of an element 'v' in the slot table 'a'. (With SLOTTABLE_INCREMENTAL, 'v'
+// can still be in the block being emptied - the ID is the same in either.)
+// Returns: A SLOT_ID.
 #define slottable_id(a, v) \
-  (Q_ID)(((uint8_t *)(v) - (uint8_t *)slottable__data(a)) / \
-    (sizeof(*(a)) + sizeof(Ch_SlotTableItem)))
+  slottable__id((Ch_SlotTable *)(a), (const uint8_t *)(v), sizeof(*(a)))
 
+#ifndef SLOTTABLE_INCREMENTAL
 #define slottable__item(a, id, sz) slottable__data_item((uint8_t *)slottable__data(a), id, sz)
+#define slottable__migrating(a)    0
+#define slottable__step(a, sz, n)  ((void)0)
+#else
+#define slottable__item(a, id, sz) slottable__item_in((Ch_SlotTable *)(a), id, sz)
+#define slottable__migrating(a)    (((Ch_SlotTable *)(a))->old != NULL)
+#define slottable__step(a, sz, n)  ((a) && slottable__migrating(a) ? \
+  slottable__migrate((Ch_SlotTable *)(a), sz, n) : (void)0)
+#endif
 #define slottable__data_item(data, id, sz) ((Ch_SlotTableItem *)(((uint8_t *)(data)) + (id * (sz + sizeof(Ch_SlotTableItem)))))
 
 #define slottable__fix_hash(hsh) ({ \
@@ -189,18 +576,444 @@ static inline uint32_t slottable_strnhash(const char *s, size_t len)
   __hsh__ == SLOT_NONE_ID ? SLOT_NONE_ID - 1 : __hsh__; \
 })
 
+#define slottable__data(a) ({ \
+  Ch_SlotTable *__tbl__ = (Ch_SlotTable *)(a); \
+  (uint8_t *)__tbl__->index + slottable__index_size(__tbl__->allocated); \
+})
+
+#ifndef SLOTTABLE_CTRL
+#define slottable__slots(n)       (n)
+#define slottable__index_size(n)  ((n) * sizeof(SLOT_ID))
+
 #define slottable__add_hash(a, id, item) ({ \
   uint32_t __idx__ = item->hash & ((a)->allocated - 1); \
   item->next = (a)->index[__idx__]; \
   (a)->index[__idx__] = id; \
 })
 
-#define slottable__data(a) ({ \
-  Ch_SlotTable *__tbl__ = (Ch_SlotTable *)(a); \
-  __tbl__->index + __tbl__->allocated; \
+#define slottable__index_clear(a) \
+  memset((a)->index, SLOT_NONE_ID, sizeof(SLOT_ID) * (a)->allocated)
+#else
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The number of control bytes compared at once.
+#define SLOTTABLE_GROUP           16
+
+// Control byte states. A full slot holds the 7-bit tag instead, so the top
+// bit alone tells whether a slot is free.
+#define SLOTTABLE_CTRL_EMPTY      0x80
+#define SLOTTABLE_CTRL_DELETED    0xFE
+
+#define slottable__slots(n)       (!(n) ? 0 : \
+  (n) * 2 < SLOTTABLE_GROUP ? SLOTTABLE_GROUP : (n) * 2)
+#define slottable__index_size(n)  (slottable__slots(n) * (sizeof(SLOT_ID) + 1))
+#define slottable__ctrl(a)        ((uint8_t *)((a)->index + slottable__slots((a)->allocated)))
+#define slottable__tag(hsh)       ((uint8_t)((hsh) >> 25))
+
+#define slottable__add_hash(a, id, item)  slottable__ctrl_add(a, id, item)
+
+#define slottable__index_clear(a) ({ \
+  memset((a)->index, SLOT_NONE_ID, sizeof(SLOT_ID) * slottable__slots((a)->allocated)); \
+  memset(slottable__ctrl(a), SLOTTABLE_CTRL_EMPTY, slottable__slots((a)->allocated)); \
+  (a)->deleted = 0; \
 })
 
-#include <string.h>
+//
+// Compare a group of control bytes against 'tag'.
+// Returns: A bitmask with a bit set for each matching slot.
+//
+static inline uint32_t
+slottable__group_match(const uint8_t *ctrl, uint8_t tag)
+{
+#ifdef __SSE2__
+  __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)tag)));
+#else
+  uint32_t m = 0;
+  for (int i = 0; i < SLOTTABLE_GROUP; i++)
+    m |= (uint32_t)(ctrl[i] == tag) << i;
+  return m;
+#endif
+}
+
+//
+// Returns: A bitmask of the slots in the group that are empty or deleted.
+//
+static inline uint32_t
+slottable__group_free(const uint8_t *ctrl)
+{
+#ifdef __SSE2__
+  return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+  uint32_t m = 0;
+  for (int i = 0; i < SLOTTABLE_GROUP; i++)
+    m |= (uint32_t)(ctrl[i] >> 7) << i;
+  return m;
+#endif
+}
+
+#define slottable__group_empty(ctrl) slottable__group_match(ctrl, SLOTTABLE_CTRL_EMPTY)
+
+//
+// Places an item's ID in the first free slot along its probe sequence.
+//
+static inline void
+slottable__ctrl_add(Ch_SlotTable *tbl, SLOT_ID id, Ch_SlotTableItem *item)
+{
+  uint8_t *ctrl = slottable__ctrl(tbl);
+  uint32_t mask = slottable__slots(tbl->allocated) - 1, step = 0, m;
+  uint32_t pos = item->hash & mask & ~(SLOTTABLE_GROUP - 1);
+  while (!(m = slottable__group_free(ctrl + pos)))
+    pos = (pos + SLOTTABLE_GROUP * ++step) & mask;
+  pos += __builtin_ctz(m);
+  if (ctrl[pos] == SLOTTABLE_CTRL_DELETED)
+    tbl->deleted--;
+  ctrl[pos] = slottable__tag(item->hash);
+  tbl->index[pos] = id;
+}
+
+//
+// Clears slot 'ref' from the index. If its group still has an empty slot, no
+// probe has ever gone past it, so the slot can go straight back to empty.
+// Otherwise it has to be left as a tombstone.
+//
+static inline void
+slottable__ctrl_erase(Ch_SlotTable *tbl, SLOT_ID *ref)
+{
+  uint8_t *ctrl = slottable__ctrl(tbl);
+  uint32_t pos = ref - tbl->index;
+  if (slottable__group_empty(ctrl + (pos & ~(SLOTTABLE_GROUP - 1)))) {
+    ctrl[pos] = SLOTTABLE_CTRL_EMPTY;
+  } else {
+    ctrl[pos] = SLOTTABLE_CTRL_DELETED;
+    tbl->deleted++;
+  }
+  tbl->index[pos] = SLOT_NONE_ID;
+}
+
+#ifndef SLOTTABLE_INCREMENTAL
+#define slottable__owner(a, ref)  (a)
+#else
+#define slottable__owner(a, ref)  ({ \
+  Ch_SlotTable *__old__ = (a)->old; \
+  __old__ != NULL && (ref) >= __old__->index && \
+    (ref) < __old__->index + slottable__slots(__old__->allocated) ? __old__ : (a); \
+})
+#endif
+#endif
+
+#ifdef SLOTTABLE_SNAPSHOT
+static inline void slottable__unmap(Ch_SlotTable *tbl);
+#else
+#define slottable__unmap(tbl)
+#endif
+
+static inline void
+slottable__release(Ch_SlotTable *tbl)
+{
+#ifdef SLOTTABLE_INCREMENTAL
+  if (tbl->old)
+    slottable__release(tbl->old);
+#endif
+  if (tbl->flags & SLOTTABLE_SHARED)
+    return;
+  if (tbl->flags & SLOTTABLE_MAPPED)
+    slottable__unmap(tbl);
+  else
+    SLOT_ALLOC_FREE(tbl->alloc, tbl);
+}
+
+//
+// Allocates an empty block with room for 'n' items.
+// Returns: The block or NULL if it couldn't be allocated.
+//
+static inline Ch_SlotTable *
+slottable__new(size_t itemsize, uint32_t n, Ch_SlotAlloc *al)
+{
+  Ch_SlotTable *tbl = (Ch_SlotTable *)SLOT_ALLOC_REALLOC(al, NULL, slottable__size(n, itemsize));
+  if (tbl) {
+    memset(tbl, 0, sizeof(Ch_SlotTable));
+    tbl->allocated = n;
+    tbl->itemsize = itemsize;
+    tbl->next_free = SLOT_NONE_ID;
+    tbl->alloc = al;
+    slottable__index_clear(tbl);
+  }
+  return tbl;
+}
+
+static inline int
+slottable__init(uint8_t **ary, size_t itemsize, Ch_SlotAlloc *al)
+{
+  Ch_SlotTable *tbl = slottable__new(itemsize, SLOT_DOUBLE_SIZE(0), al);
+  *ary = (uint8_t *)tbl;
+  return tbl != NULL;
+}
+
+//
+// Works out the ID of the item with its data at 'v', from its place in 'tbl' - or in the
+// old block, if it hasn't been moved out yet.
+//
+static inline SLOT_ID
+slottable__id(Ch_SlotTable *tbl, const uint8_t *v, size_t itemsize)
+{
+  size_t stride = itemsize + sizeof(Ch_SlotTableItem);
+#ifdef SLOTTABLE_INCREMENTAL
+  Ch_SlotTable *old = tbl->old;
+  if (old != NULL && v >= slottable__data(old) && v < slottable__data(old) + old->used * stride)
+    tbl = old;
+#endif
+  return (SLOT_ID)((v - slottable__data(tbl)) / stride);
+}
+
+#ifdef SLOTTABLE_INCREMENTAL
+static inline Ch_SlotTableItem *
+slottable__item_in(Ch_SlotTable *tbl, SLOT_ID id, size_t itemsize)
+{
+  if (tbl->old != NULL && id >= tbl->migrated && id < tbl->old->used)
+    tbl = tbl->old;
+  return slottable__data_item(slottable__data(tbl), id, itemsize);
+}
+
+//
+// Moves up to 'count' items from the old block into 'tbl' and indexes them. Items keep
+// their IDs, holes included. The old block is freed once it has been emptied.
+//
+static inline void
+slottable__migrate(Ch_SlotTable *tbl, size_t itemsize, uint32_t count)
+{
+  Ch_SlotTable *old = tbl->old;
+  uint32_t end = old->used - tbl->migrated > count ? tbl->migrated + count : old->used;
+  uint8_t *from = slottable__data(old), *to = slottable__data(tbl);
+  for (uint32_t i = tbl->migrated; i < end; i++) {
+    Ch_SlotTableItem *item = slottable__data_item(to, i, itemsize);
+    memcpy(item, slottable__data_item(from, i, itemsize), itemsize + sizeof(Ch_SlotTableItem));
+    if (item->hash != SLOT_NONE_ID)
+      slottable__add_hash(tbl, i, item);
+  }
+  tbl->migrated = end;
+  if (end == old->used) {
+    slottable__release(old);
+    tbl->old = NULL;
+  }
+}
+#endif
+
+//
+// Clears the index and adds back every live item.
+//
+static inline void
+slottable__reindex(Ch_SlotTable *tbl, size_t itemsize)
+{
+  uint8_t *items = slottable__data(tbl);
+  SLOT_STAT(rehashes, 1);
+  SLOT_TRACE(rehash, tbl->allocated, tbl->allocated);
+  slottable__index_clear(tbl);
+  for (uint32_t i = 0; i < tbl->used; i++) {
+    Ch_SlotTableItem *item = slottable__data_item(items, i, itemsize);
+    if (item->hash != SLOT_NONE_ID)
+      slottable__add_hash(tbl, i, item);
+  }
+}
+
+//
+// Prefetches the index slot (or control group) for hash 'hsh'.
+//
+static inline void
+slottable__prefetch_index(Ch_SlotTable *tbl, uint32_t hsh)
+{
+#ifndef SLOTTABLE_CTRL
+  __builtin_prefetch(tbl->index + (hsh & (tbl->allocated - 1)));
+#else
+  uint32_t pos = hsh & (slottable__slots(tbl->allocated) - 1) & ~(SLOTTABLE_GROUP - 1);
+  __builtin_prefetch(slottable__ctrl(tbl) + pos);
+  __builtin_prefetch(tbl->index + pos);
+#endif
+}
+
+//
+// Prefetches the first item that a lookup for 'hsh' will compare against. The index
+// slot should already be on its way in from slottable__prefetch_index.
+//
+static inline void
+slottable__prefetch_item(Ch_SlotTable *tbl, uint32_t hsh, size_t itemsize)
+{
+  SLOT_ID x;
+  hsh = slottable__fix_hash(hsh);
+#ifndef SLOTTABLE_CTRL
+  x = tbl->index[hsh & (tbl->allocated - 1)];
+#else
+  uint32_t pos = hsh & (slottable__slots(tbl->allocated) - 1) & ~(SLOTTABLE_GROUP - 1);
+  uint32_t m = slottable__group_match(slottable__ctrl(tbl) + pos, slottable__tag(hsh));
+  x = m ? tbl->index[pos + __builtin_ctz(m)] : SLOT_NONE_ID;
+#endif
+  if (x != SLOT_NONE_ID && x < tbl->used)
+    __builtin_prefetch(slottable__data_item(slottable__data(tbl), x, itemsize));
+}
+
+static inline uint32_t
+slottable__histogram(Ch_SlotTable *tbl, size_t itemsize, uint32_t *hist, uint32_t len)
+{
+  uint32_t longest = 0;
+  memset(hist, 0, sizeof(uint32_t) * len);
+#ifndef SLOTTABLE_CTRL
+  for (uint32_t i = 0; i < tbl->allocated; i++) {
+    uint32_t n = 0;
+    for (SLOT_ID x = tbl->index[i]; x != SLOT_NONE_ID; n++) {
+      hist[n < len ? n : len - 1]++;
+      x = slottable__item(tbl, x, itemsize)->next;
+    }
+    if (n > longest)
+      longest = n;
+  }
+#else
+  uint8_t *ctrl = slottable__ctrl(tbl);
+  uint32_t mask = slottable__slots(tbl->allocated) - 1;
+  for (uint32_t i = 0; i <= mask; i++) {
+    if (ctrl[i] & SLOTTABLE_CTRL_EMPTY)
+      continue;
+    uint32_t hsh = slottable__item(tbl, tbl->index[i], itemsize)->hash;
+    uint32_t pos = hsh & mask & ~(SLOTTABLE_GROUP - 1), n = 0;
+    while (pos != (i & ~(SLOTTABLE_GROUP - 1)))
+      pos = (pos + SLOTTABLE_GROUP * ++n) & mask;
+    hist[n < len ? n : len - 1]++;
+    if (n > longest)
+      longest = n;
+  }
+#endif
+  return longest;
+}
+
+#ifdef SLOT_STATS
+static inline void
+slottable__stats_dump(Ch_SlotTable *tbl, uint32_t *hist, uint32_t longest, FILE *f)
+{
+  uint32_t allocated = tbl ? tbl->allocated : 0, used = tbl ? tbl->used : 0,
+           active = tbl ? tbl->active : 0, deleted = tbl ? tbl->deleted : 0;
+  fprintf(f, "allocated %u used %u active %u\n", allocated, used, active);
+  fprintf(f, "holes %u (%.1f%%) tombstones %u (%.1f%%)\n", used - active,
+    used ? 100.0 * (used - active) / used : 0.0, deleted,
+    allocated ? 100.0 * deleted / allocated : 0.0);
+  fprintf(f, "distance (longest %u):", longest);
+  for (int i = 0; i < SLOT_STATS_PROBES; i++)
+    fprintf(f, " %u", hist[i]);
+  fprintf(f, "\n");
+}
+#endif
+
+static inline void
+slottable__compact(uint8_t **ary, size_t itemsize, uint8_t flags)
+{
+  Ch_SlotTable *tbl = (Ch_SlotTable *)*ary;
+  size_t stride = itemsize + sizeof(Ch_SlotTableItem);
+  uint32_t i, used = 0;
+  uint8_t *items;
+
+  slottable__step(tbl, itemsize, UINT32_MAX);
+#ifdef SLOTTABLE_INCREMENTAL
+  flags |= SLOTTABLE_FIXED_ID;
+#endif
+
+  items = slottable__data(tbl);
+  if (flags & SLOTTABLE_FIXED_ID) {
+    SLOT_ID *link = &tbl->next_free;
+    for (i = 0; i < tbl->used; i++)
+      if (slottable__data_item(items, i, itemsize)->hash != SLOT_NONE_ID)
+        used = i + 1;
+    for (i = 0; i < used; i++) {
+      Ch_SlotTableItem *item = slottable__data_item(items, i, itemsize);
+      if (item->hash == SLOT_NONE_ID) {
+        *link = i;
+        link = &item->next;
+      }
+    }
+    *link = SLOT_NONE_ID;
+  } else {
+    for (i = 0; i < tbl->used; i++) {
+      Ch_SlotTableItem *item = slottable__data_item(items, i, itemsize);
+      if (item->hash != SLOT_NONE_ID) {
+        if (used != i)
+          memcpy(slottable__data_item(items, used, itemsize), item, stride);
+        used++;
+      }
+    }
+    tbl->next_free = SLOT_NONE_ID;
+  }
+  SLOT_STAT(compacts, 1);
+  SLOT_TRACE(compact, tbl->used, used);
+  tbl->used = used;
+
+  //
+  // Shrink to the smallest power of two that holds what's left. A block we don't own
+  // outright (mapped or shared) gets copied out instead of reallocated.
+  //
+  if (flags & SLOTTABLE_SHRINK) {
+    uint32_t newsiz = SLOT_DOUBLE_SIZE(0);
+    while (newsiz < used)
+      newsiz = SLOT_DOUBLE_SIZE(newsiz);
+    if (newsiz < tbl->allocated) {
+      if (tbl->flags & (SLOTTABLE_MAPPED | SLOTTABLE_SHARED)) {
+        Ch_SlotTable *newtbl = (Ch_SlotTable *)SLOT_ALLOC_REALLOC(tbl->alloc, NULL,
+          slottable__size(newsiz, itemsize));
+        if (newtbl) {
+          memcpy(newtbl, tbl, sizeof(Ch_SlotTable));
+          newtbl->flags = 0;
+          newtbl->allocated = newsiz;
+          memcpy(slottable__data(newtbl), items, used * stride);
+          slottable__release(tbl);
+          tbl = newtbl;
+        }
+      } else {
+        Ch_SlotTable *newtbl;
+        tbl->allocated = newsiz;
+        memmove(slottable__data(tbl), items, used * stride);
+        if ((newtbl = (Ch_SlotTable *)SLOT_ALLOC_REALLOC(tbl->alloc, tbl,
+            slottable__size(newsiz, itemsize))))
+          tbl = newtbl;
+      }
+    }
+  }
+
+  slottable__reindex(tbl, itemsize);
+  *ary = (uint8_t *)tbl;
+}
+
+//
+// Copies the items of 'tbl' into a new block with room for 'n' of them and indexes them
+// there. Holes are squeezed out, unless 'flags' has SLOTTABLE_FIXED_ID. 'tbl' itself is
+// only read, so it can still be in use while this runs.
+// Returns: The new block or NULL if it couldn't be allocated.
+//
+static inline Ch_SlotTable *
+slottable__rehash(Ch_SlotTable *tbl, size_t itemsize, uint32_t n, uint8_t flags)
+{
+  Ch_SlotTable *newtbl = slottable__new(itemsize, n, tbl->alloc);
+  uint32_t newid = 0, newactive = 0;
+  if (!newtbl)
+    return NULL;
+  for (uint32_t i = 0; i < tbl->used; i++) {
+    Ch_SlotTableItem *item = slottable__item(tbl, i, itemsize), *copy;
+    if (item->hash == SLOT_NONE_ID && !(flags & SLOTTABLE_FIXED_ID))
+      continue;
+    copy = slottable__item(newtbl, newid, itemsize);
+    memcpy(copy, item, itemsize + sizeof(Ch_SlotTableItem));
+    if (copy->hash != SLOT_NONE_ID) {
+      slottable__add_hash(newtbl, newid, copy);
+      newactive++;
+    }
+    newid++;
+  }
+  SLOT_STAT(rehashes, 1);
+  SLOT_STAT(rehash_bytes, (uint64_t)newid * (itemsize + sizeof(Ch_SlotTableItem)));
+  SLOT_TRACE(rehash, tbl->allocated, n);
+  if (flags & SLOTTABLE_FIXED_ID)
+    newtbl->next_free = tbl->next_free;
+  newtbl->used = newid;
+  newtbl->active = newactive;
+  return newtbl;
+}
 
 //
 // Makes room for a new element.
@@ -214,16 +1027,41 @@ slottable__insert(uint8_t **ary, size_t itemsize, SLOT_ID *idp, uint8_t flags)
   size_t used = 0, siz = 0, newsiz = 0;
 
   //
-  // Reuse from the freelist if insertion order doesn't need to be kept.
+  // Reuse from the freelist if insertion order doesn't need to be kept. A full table
+  // with fixed IDs also falls back on the freelist once enough of it is holes.
   //
   if (tbl) {
+    slottable__step(tbl, itemsize, SLOTTABLE_MIGRATE_STEP);
+    int crowded = tbl->used == tbl->allocated &&
+      SLOTTABLE_SHOULD_COMPACT(tbl->used - tbl->active, tbl->used);
+#ifdef SLOTTABLE_INCREMENTAL
+    flags |= SLOTTABLE_FIXED_ID;
+#endif
     x = tbl->next_free;
-    if (x != SLOT_NONE_ID && (flags & SLOTTABLE_ORDERED)) {
+    if (x != SLOT_NONE_ID && !slottable__migrating(tbl) &&
+        ((flags & SLOTTABLE_ORDERED) || (crowded && (flags & SLOTTABLE_FIXED_ID)))) {
       Ch_SlotTableItem *item = slottable__item(tbl, x, itemsize);
+#ifdef SLOTTABLE_CTRL
+      //
+      // Reused items don't bump 'used', so tombstones could otherwise fill the
+      // index. Rebuild it before the last empty slot is gone.
+      //
+      if (tbl->active + tbl->deleted >= tbl->allocated)
+        slottable__reindex(tbl, itemsize);
+#endif
       tbl->next_free = item->next;
+      tbl->active++;
       *idp = x;
+      SLOT_STAT(freelist_hits, 1);
       return item;
     } else {
+      //
+      // Otherwise, squeeze the holes out of a crowded table rather than doubling it.
+      //
+      if (crowded && !(flags & SLOTTABLE_FIXED_ID)) {
+        slottable__compact(ary, itemsize, flags & ~SLOTTABLE_SHRINK);
+        tbl = (Ch_SlotTable *)*ary;
+      }
       siz = tbl->allocated;
       used = tbl->used;
     }
@@ -234,35 +1072,35 @@ slottable__insert(uint8_t **ary, size_t itemsize, SLOT_ID *idp, uint8_t flags)
   //
   if (used == siz) {
     newsiz = SLOT_DOUBLE_SIZE(siz);
-    Ch_SlotTable *newtbl = (Ch_SlotTable *)malloc(slottable__size(newsiz, itemsize));
-    newtbl->allocated = newsiz;
-
+    Ch_SlotTable *newtbl;
+#ifdef SLOTTABLE_INCREMENTAL
     //
-    // Copy and rehash the table, removing holes along the way.
+    // Leave the items where they are for now - they'll be moved across a few at a time.
     //
-    memset(newtbl->index, SLOT_NONE_ID, sizeof(SLOT_ID) * newsiz);
-    newtbl->next_free = SLOT_NONE_ID;
-    uint32_t newid = 0, newactive = 0;
-    if (tbl) {
-      for (uint32_t i = 0; i < used; i++) {
-        Ch_SlotTableItem *item = slottable__item(tbl, i, itemsize);
-        if (item->hash != SLOT_NONE_ID) {
-          slottable__add_hash(newtbl, newid, item);
-          newactive++;
-        } else if (!(flags & SLOTTABLE_FIXED_ID)) {
-          continue;
-        }
-        memcpy(slottable__item(newtbl, newid, itemsize), item, itemsize + sizeof(Ch_SlotTableItem));
-        newid++;
-      }
-      if (flags & SLOTTABLE_FIXED_ID) {
-        newtbl->next_free = tbl->next_free;
-      }
-      free(tbl);
+    newtbl = slottable__new(itemsize, newsiz, tbl ? tbl->alloc : NULL);
+    if (newtbl && tbl) {
+      slottable__step(tbl, itemsize, UINT32_MAX);
+      newtbl->old = tbl;
+      newtbl->migrated = 0;
+      newtbl->next_free = tbl->next_free;
+      newtbl->used = used;
+      newtbl->active = tbl->active;
     }
-    newtbl->used = newid;
-    newtbl->active = newactive;
-
+#else
+    newtbl = tbl ? slottable__rehash(tbl, itemsize, newsiz, flags) :
+      slottable__new(itemsize, newsiz, NULL);
+#endif
+    if (!newtbl) {
+      *idp = SLOT_NONE_ID;
+      return NULL;
+    }
+    SLOT_STAT(grows, 1);
+    SLOT_STAT(grow_bytes, tbl ? slottable__size(siz, itemsize) : 0);
+    SLOT_TRACE(grow, tbl ? slottable__size(siz, itemsize) : 0, slottable__size(newsiz, itemsize));
+#ifndef SLOTTABLE_INCREMENTAL
+    if (tbl)
+      slottable__release(tbl);
+#endif
     *ary = (uint8_t *)(tbl = newtbl);
   }
 
@@ -272,6 +1110,7 @@ slottable__insert(uint8_t **ary, size_t itemsize, SLOT_ID *idp, uint8_t flags)
   if (tbl) {
     tbl->active++;
     *idp = x = tbl->used++;
+    SLOT_STAT(freelist_misses, 1);
     return slottable__item(tbl, x, itemsize);
   }
 
@@ -279,4 +1118,207 @@ slottable__insert(uint8_t **ary, size_t itemsize, SLOT_ID *idp, uint8_t flags)
   return NULL;
 }
 
+#ifdef SLOTTABLE_SNAPSHOT
+#include "slotlist.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SLOTTABLE_SNAPSHOT_MAGIC    "CHSLOTTB"
+#define SLOTTABLE_SNAPSHOT_VERSION  2
+
+// Modes for slottable_load. A read-only table can be searched but not changed. A
+// copy-on-write table can be changed freely; pages are only copied as they're written.
+// Either can be combined with SLOTTABLE_LOAD_VERIFY to check the checksum first
+// (which reads the entire file.)
+#define SLOTTABLE_LOAD_READONLY     0
+#define SLOTTABLE_LOAD_COW          1
+#define SLOTTABLE_LOAD_VERIFY       2
+
+// Layout bits, so a snapshot is never mapped by code compiled for another layout.
+#ifdef SLOTTABLE_CTRL
+#define SLOTTABLE__LAYOUT           1
+#else
+#define SLOTTABLE__LAYOUT           0
+#endif
+
+//
+// The file header. The table block follows directly after it and the string region (if
+// there is one) after that, at a 16 byte boundary.
+//
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t itemsize;
+  uint32_t hashid;
+  uint32_t layout;
+  uint32_t hdrsize;
+  uint32_t reserved;
+  uint64_t tblsize;
+  uint64_t strsize;
+  uint64_t checksum;
+  uint8_t pad[8];
+} Ch_SlotSnapshot;
+
+// Write the slot table 'a' to the file at 'path'. The 'hashid' is any number you like
+// that identifies the hash function used - it must match again when loading.
+// Returns: 1 if the file was written, 0 otherwise.
+#define slottable_save(a, path, hashid) \
+  slottable_save_with_strings(a, path, hashid, (char *)NULL)
+
+// Write the slot table 'a' to the file at 'path', along with the slotstr region 'strs'.
+// Returns: 1 if the file was written, 0 otherwise.
+#define slottable_save_with_strings(a, path, hashid, strs) (!(a) ? 0 : ({ \
+  slottable_migrate(a); \
+  slottable__save((Ch_SlotTable *)(a), sizeof(*(a)), path, hashid, strs, \
+    (strs) ? sizeof(SLOT_ID) * SLOTLIST__HDR + slotlist_count(strs) : 0); \
+}))
+
+// Map the slot table saved at 'path' into 'a', using one of the SLOTTABLE_LOAD_* modes.
+// The table is used in place. Release it with slottable_free as usual.
+// Returns: The table pointer, or NULL if the file can't be used (wrong item size, hash
+// function or layout, or a bad checksum.)
+#define slottable_load(a, path, hashid, mode) \
+  ((a) = (__typeof__(a))slottable__load(path, sizeof(*(a)), hashid, mode, NULL))
+
+// Map the slot table saved at 'path' into 'a', and point 'strs' at the string region
+// saved with it. In copy-on-write mode the string region is copied out, so it can grow.
+// Otherwise it lives in the mapping and must not be changed or freed.
+// Returns: The table pointer, or NULL if the file can't be used.
+#define slottable_load_with_strings(a, path, hashid, mode, strs) \
+  ((a) = (__typeof__(a))slottable__load(path, sizeof(*(a)), hashid, mode, (void **)&(strs)))
+
+static inline uint64_t
+slottable__checksum(const void *data, size_t len, uint64_t h)
+{
+  const char *s = (const char *)data, *end = s + len;
+  for (; s + 8 <= end; s += 8)
+    h = slottable__rotl64(h ^ slottable__round64(0, slottable__read64(s)), 27) * SLOTTABLE_PRIME64_1;
+  for (; s < end; s++)
+    h = slottable__rotl64(h ^ ((uint8_t)*s * SLOTTABLE_PRIME64_5), 11) * SLOTTABLE_PRIME64_1;
+  return h;
+}
+
+#define slottable__strs_offset(tblsize) \
+  (sizeof(Ch_SlotSnapshot) + (((tblsize) + 15) & ~(size_t)15))
+
+static inline int
+slottable__save(Ch_SlotTable *tbl, size_t itemsize, const char *path,
+  uint32_t hashid, const void *strs, size_t strsize)
+{
+  static const uint8_t zeroes[16] = {0};
+  Ch_SlotSnapshot snap;
+  Ch_SlotTable head = *tbl;
+  SLOT_ID strhead[SLOTLIST__HDR] = {0};
+  size_t padding;
+  FILE *f;
+
+  memset(&snap, 0, sizeof(snap));
+  memcpy(snap.magic, SLOTTABLE_SNAPSHOT_MAGIC, sizeof(snap.magic));
+  snap.version = (uint32_t)SLOTTABLE_SNAPSHOT_VERSION;
+  snap.itemsize = (uint32_t)itemsize;
+  snap.hashid = (uint32_t)hashid;
+  snap.layout = (uint32_t)SLOTTABLE__LAYOUT;
+  snap.hdrsize = (uint32_t)sizeof(Ch_SlotTable);
+
+  //
+  // The saved copy is marked as mapped, since that's the only way it'll ever be read.
+  // The string region is saved as exactly full.
+  //
+  head.flags = (head.flags & ~SLOTTABLE_SHARED) | SLOTTABLE_MAPPED;
+  head.alloc = NULL;
+  head.old = NULL;
+  snap.tblsize = slottable__size(tbl->allocated, itemsize);
+  snap.strsize = strsize;
+  padding = slottable__strs_offset(snap.tblsize) - sizeof(Ch_SlotSnapshot) - snap.tblsize;
+  snap.checksum = slottable__checksum(&head, sizeof(head), hashid);
+  snap.checksum = slottable__checksum(tbl->index, snap.tblsize - sizeof(head), snap.checksum);
+  if (strsize) {
+    strhead[0] = strhead[1] = strsize - sizeof(strhead);
+    snap.checksum = slottable__checksum(strhead, sizeof(strhead), snap.checksum);
+    snap.checksum = slottable__checksum((SLOT_ID *)strs + SLOTLIST__HDR, strsize - sizeof(strhead), snap.checksum);
+  }
+
+  if (!(f = fopen(path, "wb")))
+    return 0;
+  int ok = fwrite(&snap, sizeof(snap), 1, f) == 1 &&
+    fwrite(&head, sizeof(head), 1, f) == 1 &&
+    fwrite(tbl->index, snap.tblsize - sizeof(head), 1, f) == 1 &&
+    (!strsize || (fwrite(zeroes, 1, padding, f) == padding &&
+      fwrite(strhead, sizeof(strhead), 1, f) == 1 &&
+      fwrite((SLOT_ID *)strs + SLOTLIST__HDR, 1, strsize - sizeof(strhead), f) == strsize - sizeof(strhead)));
+  return fclose(f) == 0 && ok;
+}
+
+static inline void *
+slottable__load(const char *path, size_t itemsize, uint32_t hashid, int mode, void **strs)
+{
+  Ch_SlotSnapshot *snap;
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Ch_SlotSnapshot)) {
+    close(fd);
+    return NULL;
+  }
+
+  snap = (Ch_SlotSnapshot *)mmap(NULL, st.st_size,
+    PROT_READ | ((mode & SLOTTABLE_LOAD_COW) ? PROT_WRITE : 0), MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (snap == MAP_FAILED)
+    return NULL;
+
+  uint8_t *base = (uint8_t *)snap;
+  Ch_SlotTable *tbl = (Ch_SlotTable *)(snap + 1);
+  if (memcmp(snap->magic, SLOTTABLE_SNAPSHOT_MAGIC, sizeof(snap->magic)) != 0 ||
+      snap->version != SLOTTABLE_SNAPSHOT_VERSION || snap->itemsize != itemsize ||
+      snap->hashid != hashid || snap->layout != SLOTTABLE__LAYOUT ||
+      snap->hdrsize != sizeof(Ch_SlotTable) ||
+      snap->tblsize < sizeof(Ch_SlotTable) ||
+      (size_t)st.st_size < sizeof(Ch_SlotSnapshot) + snap->tblsize ||
+      (snap->strsize && (size_t)st.st_size < slottable__strs_offset(snap->tblsize) + snap->strsize) ||
+      snap->tblsize != slottable__size(tbl->allocated, itemsize))
+    goto fail;
+
+  if (mode & SLOTTABLE_LOAD_VERIFY) {
+    uint64_t sum = slottable__checksum(tbl, snap->tblsize, hashid);
+    if (snap->strsize)
+      sum = slottable__checksum(base + slottable__strs_offset(snap->tblsize), snap->strsize, sum);
+    if (sum != snap->checksum)
+      goto fail;
+  }
+
+  if (strs) {
+    *strs = NULL;
+    if (snap->strsize) {
+      void *region = base + slottable__strs_offset(snap->tblsize);
+      if (mode & SLOTTABLE_LOAD_COW) {
+        if (!(*strs = SLOT_REALLOC(NULL, snap->strsize)))
+          goto fail;
+        memcpy(*strs, region, snap->strsize);
+      } else {
+        *strs = region;
+      }
+    }
+  }
+  return tbl;
+
+fail:
+  munmap(base, st.st_size);
+  return NULL;
+}
+
+static inline void
+slottable__unmap(Ch_SlotTable *tbl)
+{
+  Ch_SlotSnapshot *snap = (Ch_SlotSnapshot *)tbl - 1;
+  munmap(snap, snap->strsize ?
+    slottable__strs_offset(snap->tblsize) + snap->strsize :
+    sizeof(Ch_SlotSnapshot) + snap->tblsize);
+}
+#endif
+
 #endif
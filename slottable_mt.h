@@ -0,0 +1,337 @@
+//
+// slottable_mt.h
+//
+// A slot table shared between threads, for tables that are read far more often than
+// they're written. Readers never take a lock. Writers take turns with a mutex.
+//
+//   Ch_SlotTableMT mt;
+//   slottable_mt_init(&mt);
+//   mt.flags = SLOTTABLE_FIXED_ID;        // if that's what the writers add with
+//
+//   // a writer
+//   slottable_mt_write(&mt, TestTable, t, {
+//     TestTable *e = slottable_add(t, slottable_str_hash(key), 0);
+//     e->key = key;
+//   });
+//
+//   // a reader, on its own thread
+//   int r = slottable_mt_reader(&mt);
+//   TestTable copy;
+//   if (slottable_mt_find(&mt, r, TestTable, slottable_str_hash(key), cmp, key, &copy))
+//     ...
+//
+// INTERNALS
+//
+// Two things keep readers safe. The first is a sequence lock: a writer makes the
+// sequence odd while it works on the block and even again when it's done. A reader
+// that saw the sequence change during its lookup just tries again. Because of that, a
+// find copies the item out rather than handing back a pointer into a block that may
+// change under it.
+//
+// The second is epoch-based reclamation. Growing the table never touches the block that
+// readers are using: a bigger one is built beside it and published with a single pointer
+// swap. The old block is kept on a retired list along with the epoch it was retired in.
+// Each reader announces the epoch it read in, in its own cache line, and a retired block
+// is only freed once every reader has moved past that epoch.
+//
+// So that the rehash doesn't hold readers up, a writer makes room before it takes the
+// sequence lock: if the adds it's about to do (one, or 'n' for slottable_mt_write_n)
+// won't fit, the new block is built and published while readers carry on with the old
+// one. The sequence is only odd while the block's code changes the published table in
+// place. A block that adds more than it asked room for can still grow the table inside
+// the lock - that stays correct, but readers wait out the rehash. Set 'flags' in the
+// Ch_SlotTableMT to the flags the writers pass to slottable_add, so that the room is
+// made the way slottable_add would make it (keeping holes for SLOTTABLE_FIXED_ID, say.)
+//
+// Readers must register (once per thread) to get a slot for their epoch. There are
+// SLOTTABLE_MT_READERS slots.
+//
+// LICENSE
+//
+//   This software is dual-licensed to the public domain and under the following
+//   license: you are granted a perpetual, irrevocable license to copy, modify,
+//   publish, and distribute this file as you see fit.
+//
+#ifndef SLOTTABLE_MT_H
+#define SLOTTABLE_MT_H
+
+#ifdef SLOTTABLE_INCREMENTAL
+#error "slottable_mt.h publishes whole blocks, so it can't be used with SLOTTABLE_INCREMENTAL."
+#endif
+
+#include "slottable.h"
+#include "slotlist.h"
+#include <pthread.h>
+
+#ifndef SLOTTABLE_MT_READERS
+#define SLOTTABLE_MT_READERS 64
+#endif
+
+typedef struct {
+  uint64_t epoch;                    // zero while the reader is outside a lookup
+  uint8_t pad[56];
+} Ch_SlotTableReader;
+
+typedef struct {
+  Ch_SlotTable *tbl;
+  uint64_t epoch;
+} Ch_SlotTableRetired;
+
+typedef struct {
+  Ch_SlotTable *tbl;
+  uint32_t seq;
+  uint32_t readers;
+  uint64_t epoch;
+  uint32_t flags;                    // the slottable_add flags writers use
+  uint8_t pad[36];
+  pthread_mutex_t lock;
+  Ch_SlotTableRetired *retired;      // a slotlist
+  Ch_SlotTableReader reader[SLOTTABLE_MT_READERS];
+} Ch_SlotTableMT;
+
+// Register the calling thread as a reader of the shared table 'mt'.
+// Returns: The reader slot to pass to slottable_mt_find, or -1 if all are taken.
+#define slottable_mt_reader(mt) ({ \
+  uint32_t __r__ = __atomic_fetch_add(&(mt)->readers, 1, __ATOMIC_RELAXED); \
+  __r__ < SLOTTABLE_MT_READERS ? (int)__r__ : -1; \
+})
+
+// Find an entry in the shared table 'mt' of item type 'T', using uint32_t hash 'hsh'
+// and 'key', compared by 'cmp' just as in slottable_find. If found, the item is copied
+// to the 'T' pointer 'out'. 'reader' is the slot from slottable_mt_reader.
+// Returns: 1 if the item was found, 0 if not.
+#define slottable_mt_find(mt, reader, T, hsh, cmp, key, out) ({ \
+  Ch_SlotTableMT *__mt__ = (mt); \
+  uint32_t __hshm__ = slottable__fix_hash(hsh), __seq__; \
+  int __found__; \
+  slottable_mt__enter(__mt__, reader); \
+  do { \
+    __seq__ = slottable_mt__read_begin(__mt__); \
+    Ch_SlotTable *__tblm__ = __atomic_load_n(&__mt__->tbl, __ATOMIC_SEQ_CST); \
+    Ch_SlotTableItem *__itm__ = __tblm__ == NULL ? NULL : \
+      slottable_mt__find_in(__tblm__, __hshm__, cmp, key, T *); \
+    if ((__found__ = __itm__ != NULL)) \
+      *(out) = *(T *)__itm__->data; \
+  } while (slottable_mt__read_retry(__mt__, __seq__)); \
+  slottable_mt__exit(__mt__, reader); \
+  __found__; \
+})
+
+// Change the shared table 'mt' of item type 'T'. The code in the block can use the
+// regular slottable macros on the table pointer named 'a'. Writers wait on each other
+// and readers will retry any lookup that overlaps the block, so keep it short. Room for
+// one add is made before the block runs.
+#define slottable_mt_write(mt, T, a, ...) slottable_mt_write_n(mt, T, a, 1, __VA_ARGS__)
+
+// Change the shared table 'mt' as slottable_mt_write does, making room for 'n' adds
+// before the block runs.
+#define slottable_mt_write_n(mt, T, a, n, ...) { \
+  Ch_SlotTableMT *__mtw__ = (mt); \
+  T *a = (T *)slottable_mt__write_begin(__mtw__, sizeof(T), n); \
+  __VA_ARGS__; \
+  slottable_mt__write_end(__mtw__, (Ch_SlotTable *)a); \
+}
+
+//
+// internal macros
+//
+#define slottable_mt__enter(mt, r) \
+  __atomic_store_n(&(mt)->reader[r].epoch, \
+    __atomic_load_n(&(mt)->epoch, __ATOMIC_ACQUIRE), __ATOMIC_SEQ_CST)
+#define slottable_mt__exit(mt, r) \
+  __atomic_store_n(&(mt)->reader[r].epoch, 0, __ATOMIC_RELEASE)
+
+//
+// Readers can see a chain halfway through being relinked, so the walk is cut off after
+// 'used' hops rather than trusting it to end. With control bytes, a reader can see a tag
+// before its index is stored (or after it's cleared), so an index past 'used' is skipped
+// and probing stops after every group has been seen once.
+//
+#ifndef SLOTTABLE_CTRL
+#define slottable_mt__find_in(tbl, hsh, cmp, key, T) ({ \
+  Ch_SlotTable *__tblf__ = (tbl); \
+  uint8_t *items = slottable__data(__tblf__); \
+  uint32_t __hops__ = __tblf__->used; \
+  SLOT_ID __x__ = __tblf__->index[(hsh) & (__tblf__->allocated - 1)]; \
+  Ch_SlotTableItem *item = NULL; \
+  while (__x__ < __tblf__->used && __hops__--) { \
+    item = slottable__data_item(items, __x__, sizeof(*((T)0))); \
+    if ((hsh) == item->hash && cmp(key, (T)item->data) == 0) \
+      break; \
+    __x__ = item->next; \
+    item = NULL; \
+  } \
+  item; \
+})
+#else
+#define slottable_mt__find_in(tbl, hsh, cmp, key, T) ({ \
+  Ch_SlotTable *__tblf__ = (tbl); \
+  uint32_t __hsh__ = slottable__fix_hash(hsh); \
+  uint32_t __mask__ = slottable__slots(__tblf__->allocated) - 1, __step__ = 0; \
+  uint32_t __pos__ = __hsh__ & __mask__ & ~(SLOTTABLE_GROUP - 1); \
+  uint32_t __groups__ = (__mask__ + 1) / SLOTTABLE_GROUP; \
+  uint8_t __tag__ = slottable__tag(__hsh__); \
+  uint8_t *__ctrl__ = slottable__ctrl(__tblf__); \
+  uint8_t *items = slottable__data(__tblf__); \
+  Ch_SlotTableItem *item = NULL; \
+  while (__groups__--) { \
+    uint32_t __m__ = slottable__group_match(__ctrl__ + __pos__, __tag__); \
+    while (__m__) { \
+      SLOT_ID __x__ = __atomic_load_n(__tblf__->index + __pos__ + __builtin_ctz(__m__), \
+        __ATOMIC_RELAXED); \
+      __m__ &= __m__ - 1; \
+      if (__x__ >= __tblf__->used) \
+        continue; \
+      item = slottable__data_item(items, __x__, sizeof(*((T)0))); \
+      if (__hsh__ == item->hash && cmp(key, (T)item->data) == 0) \
+        break; \
+      item = NULL; \
+    } \
+    if (item || slottable__group_empty(__ctrl__ + __pos__)) \
+      break; \
+    __pos__ = (__pos__ + SLOTTABLE_GROUP * ++__step__) & __mask__; \
+  } \
+  item; \
+})
+#endif
+
+static inline uint32_t
+slottable_mt__read_begin(Ch_SlotTableMT *mt)
+{
+  uint32_t seq;
+  while ((seq = __atomic_load_n(&mt->seq, __ATOMIC_ACQUIRE)) & 1)
+    ;
+  return seq;
+}
+
+static inline int
+slottable_mt__read_retry(Ch_SlotTableMT *mt, uint32_t seq)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&mt->seq, __ATOMIC_RELAXED) != seq;
+}
+
+static inline void
+slottable_mt_init(Ch_SlotTableMT *mt)
+{
+  memset(mt, 0, sizeof(*mt));
+  mt->epoch = 1;
+  pthread_mutex_init(&mt->lock, NULL);
+}
+
+//
+// Frees any retired blocks that no reader can still be looking at.
+//
+static inline void
+slottable_mt__reclaim(Ch_SlotTableMT *mt)
+{
+  uint64_t oldest = UINT64_MAX;
+  uint32_t i, kept = 0;
+  for (i = 0; i < SLOTTABLE_MT_READERS; i++) {
+    uint64_t e = __atomic_load_n(&mt->reader[i].epoch, __ATOMIC_SEQ_CST);
+    if (e && e < oldest)
+      oldest = e;
+  }
+  for (i = 0; i < slotlist_count(mt->retired); i++) {
+    Ch_SlotTableRetired *r = &slotlist_at(mt->retired, i);
+    if (r->epoch < oldest) {
+      r->tbl->flags &= ~SLOTTABLE_SHARED;
+      slottable__release(r->tbl);
+    } else {
+      slotlist_at(mt->retired, kept++) = *r;
+    }
+  }
+  if (mt->retired)
+    slotlist__sbn(mt->retired) = kept;
+}
+
+//
+// Swaps 'tbl' in for the shared block and retires the old one in the current epoch.
+//
+static inline void
+slottable_mt__publish(Ch_SlotTableMT *mt, Ch_SlotTable *tbl)
+{
+  Ch_SlotTable *old = mt->tbl;
+  if (tbl)
+    tbl->flags |= SLOTTABLE_SHARED;
+  __atomic_store_n(&mt->tbl, tbl, __ATOMIC_SEQ_CST);
+  if (old)
+    slotlist_push(mt->retired, ((Ch_SlotTableRetired){old, mt->epoch}));
+  __atomic_store_n(&mt->epoch, mt->epoch + 1, __ATOMIC_SEQ_CST);
+}
+
+//
+// Makes sure the next 'n' adds fit in the shared block, as slottable__insert would make
+// room for them - holes reused, squeezed out or doubled past - but into a new block,
+// which is then published. The shared block is only read.
+//
+static inline void
+slottable_mt__make_room(Ch_SlotTableMT *mt, size_t itemsize, uint32_t n)
+{
+  Ch_SlotTable *tbl = mt->tbl, *newtbl;
+  uint32_t siz = SLOT_DOUBLE_SIZE(0);
+  if (tbl) {
+    uint32_t dead = tbl->used - tbl->active, room = tbl->allocated - tbl->used, keep;
+    int crowded = SLOTTABLE_SHOULD_COMPACT(dead, tbl->used),
+      fixed = mt->flags & SLOTTABLE_FIXED_ID;
+    if ((mt->flags & SLOTTABLE_ORDERED) || (fixed && crowded))
+      room += dead;
+    if (room >= n)
+      return;
+    keep = fixed ? tbl->used : tbl->active;
+    siz = !fixed && crowded ? tbl->allocated : SLOT_DOUBLE_SIZE(tbl->allocated);
+    while (siz < keep + n)
+      siz = SLOT_DOUBLE_SIZE(siz);
+    newtbl = slottable__rehash(tbl, itemsize, siz, mt->flags);
+  } else {
+    while (siz < n)
+      siz = SLOT_DOUBLE_SIZE(siz);
+    newtbl = slottable__new(itemsize, siz, NULL);
+  }
+  if (newtbl)
+    slottable_mt__publish(mt, newtbl);
+}
+
+static inline Ch_SlotTable *
+slottable_mt__write_begin(Ch_SlotTableMT *mt, size_t itemsize, uint32_t n)
+{
+  pthread_mutex_lock(&mt->lock);
+  if (n)
+    slottable_mt__make_room(mt, itemsize, n);
+  __atomic_store_n(&mt->seq, mt->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return mt->tbl;
+}
+
+static inline void
+slottable_mt__write_end(Ch_SlotTableMT *mt, Ch_SlotTable *tbl)
+{
+  if (tbl != mt->tbl)
+    slottable_mt__publish(mt, tbl);
+  __atomic_store_n(&mt->seq, mt->seq + 1, __ATOMIC_RELEASE);
+  if (slotlist_count(mt->retired))
+    slottable_mt__reclaim(mt);
+  pthread_mutex_unlock(&mt->lock);
+}
+
+//
+// Frees the shared table and everything retired from it. No thread may be using it.
+//
+static inline void
+slottable_mt_free(Ch_SlotTableMT *mt)
+{
+  for (uint32_t i = 0; i < slotlist_count(mt->retired); i++) {
+    slotlist_at(mt->retired, i).tbl->flags &= ~SLOTTABLE_SHARED;
+    slottable__release(slotlist_at(mt->retired, i).tbl);
+  }
+  slotlist_free(mt->retired);
+  if (mt->tbl) {
+    mt->tbl->flags &= ~SLOTTABLE_SHARED;
+    slottable__release(mt->tbl);
+  }
+  pthread_mutex_destroy(&mt->lock);
+  mt->tbl = NULL;
+  mt->retired = NULL;
+}
+
+#endif